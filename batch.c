@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compressedInput.h"
+#include "corpus.h"
+#include "disassembler.h"
+#include "machineImage.h"
+#include "objectListing.h"
+#include "outputSink.h"
+#include "threadPool.h"
+
+// listings are small and there may be a thread per processor, so each file
+// gets a smaller write buffer than the single-file run
+#define BATCH_SINK_CAPACITY (64 * 1024)
+
+typedef struct {
+  char *inputPath;
+  char *outputPath;
+  int failed;
+  int corpusMode;         // CORPUS_OFF unless segments are shared
+  SegmentTable *table;    // the batch's segments, with --corpus
+  CorpusImage *segments;  // this image's, once scanned
+} Job;
+
+typedef struct {
+  Job *jobs;
+  size_t count;
+  size_t capacity;
+  const char *outputDir;
+} JobList;
+
+static int hasMemSuffix(const char *name, size_t length) {
+  return length > 4 && strncmp(name + length - 4, ".mem", 4) == 0;
+}
+
+// whether name ends in .mem or .yo, with or without a compressed suffix
+static int isInputName(const char *name) {
+  size_t length = strlen(name);
+  return hasMemSuffix(name, length - compressedSuffixLength(name, length)) ||
+         isObjectListing(name);
+}
+
+// the file name of path with any directory and .mem or .yo suffix (and a
+// compressed one after it) removed
+static void baseName(const char *path, const char **name, size_t *length) {
+  const char *slash = strrchr(path, '/');
+  *name = slash == NULL ? path : slash + 1;
+  *length = strlen(*name);
+  size_t compressed = compressedSuffixLength(*name, *length);
+  if (hasMemSuffix(*name, *length - compressed)) {
+    *length -= compressed + 4;
+  } else if (isObjectListing(*name)) {
+    *length -= compressed + 3;
+  }
+}
+
+static int addJob(JobList *list, const char *inputPath) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+    Job *grown = realloc(list->jobs, capacity * sizeof(Job));
+    if (grown == NULL) {
+      return -1;
+    }
+    list->jobs = grown;
+    list->capacity = capacity;
+  }
+
+  const char *name;
+  size_t nameLength;
+  baseName(inputPath, &name, &nameLength);
+  size_t dirLength = strlen(list->outputDir);
+  char *outputPath = malloc(dirLength + nameLength + sizeof("/.ys"));
+  char *copy = strdup(inputPath);
+  if (outputPath == NULL || copy == NULL) {
+    free(outputPath);
+    free(copy);
+    return -1;
+  }
+  sprintf(outputPath, "%s/%.*s.ys", list->outputDir, (int)nameLength, name);
+
+  Job *job = &list->jobs[list->count++];
+  job->inputPath = copy;
+  job->outputPath = outputPath;
+  job->failed = 0;
+  job->corpusMode = CORPUS_OFF;
+  job->table = NULL;
+  job->segments = NULL;
+  return 0;
+}
+
+// add every regular .mem or .yo file in the directory at path, compressed
+// or not. hidden files are left out.
+static int addDirectory(JobList *list, const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  struct stat info;
+  int res = 0;
+
+  if (dir == NULL) {
+    return -1;
+  }
+  while (res == 0 && (entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.' || !isInputName(entry->d_name)) {
+      continue;
+    }
+    char *child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+    if (child == NULL) {
+      res = -1;
+      break;
+    }
+    sprintf(child, "%s/%s", path, entry->d_name);
+    if (stat(child, &info) == 0 && S_ISREG(info.st_mode)) {
+      res = addJob(list, child);
+    }
+    free(child);
+  }
+  closedir(dir);
+  return res;
+}
+
+// add each non-empty line of standard input as a path.
+static int addManifest(JobList *list) {
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t length;
+  int res = 0;
+
+  while (res == 0 && (length = getline(&line, &size, stdin)) >= 0) {
+    while (length > 0 &&
+           (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      line[--length] = '\0';
+    }
+    if (length > 0) {
+      res = addJob(list, line);
+    }
+  }
+  free(line);
+  return res;
+}
+
+static int addInput(JobList *list, const char *input) {
+  struct stat info;
+  if (strcmp(input, "-") == 0) {
+    return addManifest(list);
+  }
+  if (stat(input, &info) == 0 && S_ISDIR(info.st_mode)) {
+    return addDirectory(list, input);
+  }
+  // anything else is taken as a file; if it cannot be opened that is
+  // reported with the other per-file failures
+  return addJob(list, input);
+}
+
+static int compareOutputPaths(const void *a, const void *b) {
+  const Job *first = a;
+  const Job *second = b;
+  int order = strcmp(first->outputPath, second->outputPath);
+  return order != 0 ? order : strcmp(first->inputPath, second->inputPath);
+}
+
+// two inputs with the same file name would overwrite each other's listing,
+// so only the first of them (by input path) is disassembled.
+static void rejectCollisions(JobList *list) {
+  size_t kept = 0;
+  qsort(list->jobs, list->count, sizeof(Job), compareOutputPaths);
+  for (size_t i = 1; i < list->count; i++) {
+    Job *first = &list->jobs[kept];
+    Job *job = &list->jobs[i];
+    if (strcmp(first->outputPath, job->outputPath) == 0) {
+      fprintf(stderr, "Skipping %s: %s is already written from %s\n",
+              job->inputPath, job->outputPath, first->inputPath);
+      job->failed = 1;
+    } else {
+      kept = i;
+    }
+  }
+}
+
+// open the job's listing for writing. returns 0, or -1 after reporting the
+// failure and recording it in the job.
+static int openJobOutput(Job *job, OutputSink *outputFile) {
+  int outputFd = open(job->outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (outputFd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", job->outputPath,
+            strerror(errno));
+    job->failed = 1;
+    return -1;
+  }
+  if (openOutputSink(outputFile, outputFd, BATCH_SINK_CAPACITY) != 0) {
+    fprintf(stderr, "Failed to allocate output buffer for %s\n",
+            job->inputPath);
+    close(outputFd);
+    job->failed = 1;
+    return -1;
+  }
+  return 0;
+}
+
+static void closeJobOutput(Job *job, OutputSink *outputFile) {
+  int outputFd = outputFile->fd;
+  if (closeOutputSink(outputFile) != 0 || close(outputFd) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", job->outputPath,
+            strerror(errno));
+    job->failed = 1;
+  }
+}
+
+/**
+ * Disassemble one file of the batch. Any failure is reported straight away
+ * and recorded in the job; it does not affect the other files.
+ **/
+static void disassembleJob(void *arg) {
+  Job *job = arg;
+  MachineImage image;
+  OutputSink outputFile;
+
+  if (openMachineImage(job->inputPath, &image) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", job->inputPath,
+            strerror(errno));
+    job->failed = 1;
+    return;
+  }
+  if (openJobOutput(job, &outputFile) != 0) {
+    closeMachineImage(&image);
+    return;
+  }
+
+  disassemble(image.bytes, image.length, 0, printRecord, &outputFile, NULL);
+
+  closeMachineImage(&image);
+  closeJobOutput(job, &outputFile);
+}
+
+// with --corpus, first split the file into segments, adding them to the
+// batch's table
+static void scanJob(void *arg) {
+  Job *job = arg;
+  MachineImage image;
+
+  if (openMachineImage(job->inputPath, &image) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", job->inputPath,
+            strerror(errno));
+    job->failed = 1;
+    return;
+  }
+  job->segments = scanCorpusImage(job->table, image.bytes, image.length);
+  if (job->segments == NULL) {
+    fprintf(stderr, "Failed to scan %s: %s\n", job->inputPath,
+            strerror(errno));
+    job->failed = 1;
+  }
+  closeMachineImage(&image);
+}
+
+// then, once every file is scanned, write its listing from the segments
+static void listJob(void *arg) {
+  Job *job = arg;
+  OutputSink outputFile;
+
+  if (openJobOutput(job, &outputFile) != 0) {
+    return;
+  }
+  if (printCorpusImage(job->segments, job->corpusMode, &outputFile) != 0) {
+    fprintf(stderr, "Failed to list %s: %s\n", job->inputPath,
+            strerror(errno));
+    job->failed = 1;
+  }
+  closeJobOutput(job, &outputFile);
+}
+
+// run task on every job that has not failed yet, on pool if there is one
+static void runJobs(ThreadPool *pool, JobList *list, TaskFunction task) {
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->jobs[i].failed) {
+      continue;
+    }
+    if (pool == NULL || submitTask(pool, task, &list->jobs[i]) != 0) {
+      // without a pool the files are simply done on this thread
+      task(&list->jobs[i]);
+    }
+  }
+  if (pool != NULL) {
+    waitThreadPool(pool);
+  }
+}
+
+// write the shared segments the listings refer to into the output
+// directory. returns 0, or -1 after reporting the failure.
+static int writeSharedSegments(const JobList *list, SegmentTable *table) {
+  Job job = {NULL, NULL, 0, CORPUS_OFF, NULL, NULL};
+  OutputSink outputFile;
+  char *path = malloc(strlen(list->outputDir) + sizeof("/" CORPUS_SEGMENTS));
+  if (path == NULL) {
+    fprintf(stderr, "Failed to allocate the segment list path\n");
+    return -1;
+  }
+  sprintf(path, "%s/%s", list->outputDir, CORPUS_SEGMENTS);
+  job.inputPath = path;
+  job.outputPath = path;
+  if (openJobOutput(&job, &outputFile) == 0) {
+    if (printSharedSegments(table, &outputFile) < 0) {
+      fprintf(stderr, "Failed to list the shared segments: %s\n",
+              strerror(errno));
+      job.failed = 1;
+    }
+    closeJobOutput(&job, &outputFile);
+  }
+  free(path);
+  return job.failed ? -1 : 0;
+}
+
+// list every file through the batch's segment table: scan them all, then
+// print them all
+static int disassembleCorpus(JobList *list, ThreadPool *pool, int mode) {
+  SegmentTable *table = createSegmentTable();
+  if (table == NULL) {
+    fprintf(stderr, "Failed to allocate the segment table\n");
+    return -1;
+  }
+  for (size_t i = 0; i < list->count; i++) {
+    Job *job = &list->jobs[i];
+    job->corpusMode = mode;
+    job->table = table;
+    // the shared segments have a file of their own
+    if (mode == CORPUS_REFERENCES && !job->failed &&
+        strcmp(job->outputPath + strlen(list->outputDir) + 1,
+               CORPUS_SEGMENTS) == 0) {
+      fprintf(stderr, "Skipping %s: %s lists the shared segments\n",
+              job->inputPath, job->outputPath);
+      job->failed = 1;
+    }
+  }
+
+  runJobs(pool, list, scanJob);
+  runJobs(pool, list, listJob);
+  int res = mode == CORPUS_REFERENCES ? writeSharedSegments(list, table) : 0;
+  reportSegmentSharing(table);
+
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->jobs[i].segments != NULL) {
+      freeCorpusImage(list->jobs[i].segments);
+    }
+  }
+  freeSegmentTable(table);
+  return res;
+}
+
+int disassembleBatch(const char *outputDir, char **inputs, int inputCount,
+                     int threads, int corpusMode) {
+  JobList list = {NULL, 0, 0, outputDir};
+  size_t failed = 0;
+  int res = 0;
+
+  if (inputCount == 0) {
+    res = addManifest(&list);
+  }
+  for (int i = 0; res == 0 && i < inputCount; i++) {
+    res = addInput(&list, inputs[i]);
+    if (res != 0) {
+      fprintf(stderr, "Failed to read %s: %s\n",
+              strcmp(inputs[i], "-") == 0 ? "standard input" : inputs[i],
+              strerror(errno));
+    }
+  }
+
+  int corpusFailed = 0;
+  if (res == 0) {
+    rejectCollisions(&list);
+    ThreadPool *pool = createThreadPool(threads);
+    if (corpusMode != CORPUS_OFF) {
+      corpusFailed = disassembleCorpus(&list, pool, corpusMode) != 0;
+    } else {
+      runJobs(pool, &list, disassembleJob);
+    }
+    if (pool != NULL) {
+      destroyThreadPool(pool);
+    }
+    for (size_t i = 0; i < list.count; i++) {
+      failed += list.jobs[i].failed ? 1 : 0;
+    }
+  }
+
+  for (size_t i = 0; i < list.count; i++) {
+    free(list.jobs[i].inputPath);
+    free(list.jobs[i].outputPath);
+  }
+  free(list.jobs);
+  if (res != 0) {
+    return -1;
+  }
+  fprintf(stderr, "Disassembled %zu of %zu files into %s\n",
+          list.count - failed, list.count, outputDir);
+  return failed == 0 && !corpusFailed ? 0 : -1;
+}
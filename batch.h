@@ -0,0 +1,23 @@
+/* This file contains the prototype for batch mode, defined in batch.c, which
+   disassembles many images in one process (the --batch option).
+*/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+// Disassemble every input into outputDir/<name>.ys, where <name> is the
+// input's file name without a .mem or .yo suffix. An input may be a .mem
+// file, a .yo listing, a directory (each .mem file in it is taken) or "-"
+// for a manifest of
+// paths on standard input, one per line; no inputs at all also reads the
+// manifest. The files are spread over a work-stealing pool of threads
+// workers. A file that fails is reported on stderr and the rest carry on.
+// With corpusMode CORPUS_REFERENCES or CORPUS_EXPANDED (corpus.h) each
+// distinct segment of the files is decoded and formatted only once; with
+// references, the shared ones are listed once in outputDir/segments.ys and
+// only named in the listings. Returns 0 if every file was disassembled, -1
+// otherwise.
+int disassembleBatch(const char *outputDir, char **inputs, int inputCount,
+                     int threads, int corpusMode);
+
+#endif /* BATCH */
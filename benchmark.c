@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "machineImage.h"
+#include "outputSink.h"
+#include "printRoutines.h"
+#include "recordList.h"
+
+/*
+  benchmark times one path through the disassembler on one image (make
+  bench runs each path on an image from genImage):
+
+    decode      y86Decode() over the mapped image, no output
+    format      printRecord() over records decoded beforehand, into a sink
+                writing to /dev/null
+    end-to-end  open and map the image, decode, format and write to
+                /dev/null, as the disassembler does
+
+  Each path is run several times and the fastest run is reported, with the
+  peak resident set size of the process. Run one path per process so the
+  peak belongs to that path alone.
+*/
+
+#define DEFAULT_REPEATS 5
+#define RECORD_BATCH 1024
+
+typedef struct {
+  double seconds;
+  size_t records;
+} Run;
+
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-r repeats] decode|format|end-to-end InputFilename\n",
+          program);
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static int openNull(OutputSink *sink) {
+  int fd = open("/dev/null", O_WRONLY);
+  if (fd < 0 || openOutputSink(sink, fd, OUTPUT_SINK_CAPACITY) != 0) {
+    fprintf(stderr, "Failed to open /dev/null: %s\n", strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static void closeNull(OutputSink *sink) {
+  int fd = sink->fd;
+  closeOutputSink(sink);
+  close(fd);
+}
+
+// decode and print the whole image, as disassemble() does.
+static size_t sweep(const MachineImage *image, OutputSink *sink) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  size_t count;
+  size_t total = 0;
+  int isFirstPosFlag = 1;
+
+  y86StartCursor(&cursor, 0);
+  while ((count = y86Decode(image->bytes, image->length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    if (sink != NULL) {
+      for (size_t i = 0; i < count; i++) {
+        printRecord(sink, &records[i], isFirstPosFlag);
+        isFirstPosFlag = 0;
+      }
+    }
+    total += count;
+  }
+  return total;
+}
+
+static int runDecode(const char *path, Run *run) {
+  MachineImage image;
+  if (openMachineImage(path, &image) != 0) {
+    return -1;
+  }
+  double start = now();
+  run->records = sweep(&image, NULL);
+  run->seconds = now() - start;
+  closeMachineImage(&image);
+  return 0;
+}
+
+static int runFormat(const char *path, Run *run) {
+  MachineImage image;
+  RecordList list;
+  Y86Cursor cursor;
+  OutputSink sink;
+
+  if (openMachineImage(path, &image) != 0) {
+    return -1;
+  }
+  initRecordList(&list);
+  y86StartCursor(&cursor, 0);
+  if (decodeIntoList(image.bytes, image.length, &cursor, image.length,
+                     &list) != 0 ||
+      openNull(&sink) != 0) {
+    freeRecordList(&list);
+    closeMachineImage(&image);
+    return -1;
+  }
+
+  double start = now();
+  for (size_t i = 0; i < list.count; i++) {
+    printRecord(&sink, &list.records[i], i == 0);
+  }
+  flushOutputSink(&sink);
+  run->seconds = now() - start;
+  run->records = list.count;
+
+  closeNull(&sink);
+  freeRecordList(&list);
+  closeMachineImage(&image);
+  return 0;
+}
+
+static int runEndToEnd(const char *path, Run *run) {
+  MachineImage image;
+  OutputSink sink;
+
+  double start = now();
+  if (openMachineImage(path, &image) != 0) {
+    return -1;
+  }
+  if (openNull(&sink) != 0) {
+    closeMachineImage(&image);
+    return -1;
+  }
+  run->records = sweep(&image, &sink);
+  closeNull(&sink);
+  closeMachineImage(&image);
+  run->seconds = now() - start;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int repeats = DEFAULT_REPEATS;
+  int (*path)(const char *, Run *) = NULL;
+  int i = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+    repeats = atoi(argv[2]);
+    i = 3;
+  }
+  if (argc - i != 2 || repeats < 1) {
+    printUsage(argv[0]);
+    return -1;
+  }
+  if (strcmp(argv[i], "decode") == 0) {
+    path = runDecode;
+  } else if (strcmp(argv[i], "format") == 0) {
+    path = runFormat;
+  } else if (strcmp(argv[i], "end-to-end") == 0) {
+    path = runEndToEnd;
+  } else {
+    printUsage(argv[0]);
+    return -1;
+  }
+
+  const char *inputName = argv[i + 1];
+  MachineImage image;
+  if (openMachineImage(inputName, &image) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", inputName, strerror(errno));
+    return -1;
+  }
+  double megabytes = (double)image.length / (1 << 20);
+  closeMachineImage(&image);
+
+  Run best = {0, 0};
+  for (int r = 0; r < repeats; r++) {
+    Run run;
+    if (path(inputName, &run) != 0) {
+      fprintf(stderr, "Failed to run %s on %s: %s\n", argv[i], inputName,
+              strerror(errno));
+      return -1;
+    }
+    if (r == 0 || run.seconds < best.seconds) {
+      best = run;
+    }
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-10s %8.1f MB  %8.3f s  %9.1f MB/s  %8.2f M records/s  "
+         "peak RSS %ld KB\n",
+         argv[i], megabytes, best.seconds, megabytes / best.seconds,
+         (double)best.records / best.seconds / 1e6, usage.ru_maxrss);
+  return 0;
+}
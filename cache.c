@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hashWords.h"
+
+/*
+  The listing cache is a directory of finished listings, one file per key.
+  A key names the input by the xxHash64 of its bytes and its length, and
+  the listing by the starting offset and format, so equal inputs share an
+  entry wherever they live. Entries are written to a temporary file and
+  renamed into place, so a reader never sees half an entry and concurrent
+  runs writing the same key simply replace one another. A hit touches the
+  entry's modification time, which eviction treats as its last use.
+*/
+
+#define COPY_BUFFER_BYTES (256 * 1024)
+#define COUNTERS_NAME "counters"
+#define ENTRY_SUFFIX ".ys"
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t prime3 = 0x165667B19E3779F9ull;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+static uint64_t mixRound(uint64_t accumulator, uint64_t input) {
+  accumulator += input * prime2;
+  return rotateLeft(accumulator, 31) * prime1;
+}
+
+static uint64_t mergeRound(uint64_t hash, uint64_t accumulator) {
+  hash ^= mixRound(0, accumulator);
+  return hash * prime1 + prime4;
+}
+
+uint64_t xxHash64(const void *data, size_t length, uint64_t seed) {
+  const uint8_t *bytes = data;
+  const uint8_t *end = bytes + length;
+  uint64_t hash;
+
+  if (length >= 32) {
+    // four lanes over 32-byte stripes
+    uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed,
+                         seed - prime1};
+    for (; end - bytes >= 32; bytes += 32) {
+      for (int lane = 0; lane < 4; lane++) {
+        lanes[lane] = mixRound(lanes[lane], load64(bytes + 8 * lane));
+      }
+    }
+    hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) +
+           rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+    for (int lane = 0; lane < 4; lane++) {
+      hash = mergeRound(hash, lanes[lane]);
+    }
+  } else {
+    hash = seed + prime5;
+  }
+  hash += (uint64_t)length;
+
+  for (; end - bytes >= 8; bytes += 8) {
+    hash ^= mixRound(0, load64(bytes));
+    hash = rotateLeft(hash, 27) * prime1 + prime4;
+  }
+  if (end - bytes >= 4) {
+    hash ^= (uint64_t)load32(bytes) * prime1;
+    hash = rotateLeft(hash, 23) * prime2 + prime3;
+    bytes += 4;
+  }
+  for (; bytes < end; bytes++) {
+    hash ^= *bytes * prime5;
+    hash = rotateLeft(hash, 11) * prime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+int openCache(DisasmCache *cache, const char *dir, uint64_t capacity) {
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    return -1;
+  }
+  cache->dir = strdup(dir);
+  cache->capacity = capacity;
+  return cache->dir == NULL ? -1 : 0;
+}
+
+void closeCache(DisasmCache *cache) {
+  free(cache->dir);
+  cache->dir = NULL;
+}
+
+void cacheKey(char *key, const uint8_t *image, size_t length,
+              long startingOffset, const char *format) {
+  snprintf(key, CACHE_KEY_TEXT, "%016llx-%zx-%lx-%s-v%d",
+           (unsigned long long)xxHash64(image, length, 0), length,
+           startingOffset, format, CACHE_FORMAT_VERSION);
+}
+
+static int entryPath(const DisasmCache *cache, const char *name, char *path) {
+  int length = snprintf(path, CACHE_PATH_TEXT, "%s/%s", cache->dir, name);
+  if (length < 0 || length >= CACHE_PATH_TEXT) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+int copyFile(int fd, int outputFd) {
+  char *buffer = malloc(COPY_BUFFER_BYTES);
+  ssize_t got = 0;
+
+  if (buffer == NULL || lseek(fd, 0, SEEK_SET) < 0) {
+    free(buffer);
+    return -1;
+  }
+  while ((got = read(fd, buffer, COPY_BUFFER_BYTES)) != 0) {
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    ssize_t done = 0;
+    while (done < got) {
+      ssize_t res = write(outputFd, buffer + done, (size_t)(got - done));
+      if (res < 0 && errno != EINTR) {
+        free(buffer);
+        return -1;
+      }
+      done += res < 0 ? 0 : res;
+    }
+  }
+  free(buffer);
+  return got == 0 ? 0 : -1;
+}
+
+int fetchCacheEntry(DisasmCache *cache, const char *key, int outputFd) {
+  char name[CACHE_KEY_TEXT + sizeof(ENTRY_SUFFIX)];
+  char path[CACHE_PATH_TEXT];
+
+  snprintf(name, sizeof(name), "%s%s", key, ENTRY_SUFFIX);
+  if (entryPath(cache, name, path) != 0) {
+    return -1;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return errno == ENOENT ? 0 : -1;
+  }
+  // the new time only orders evictions, so failing to set it is harmless
+  utimensat(AT_FDCWD, path, NULL, 0);
+  int res = copyFile(fd, outputFd);
+  close(fd);
+  return res == 0 ? 1 : -1;
+}
+
+int createCacheEntry(DisasmCache *cache, char *tempPath) {
+  if (entryPath(cache, ".entry-XXXXXX", tempPath) != 0) {
+    return -1;
+  }
+  int fd = mkstemp(tempPath);
+  // mkstemp() makes the file private; entries are shared like any output
+  if (fd >= 0) {
+    fchmod(fd, 0644);
+  }
+  return fd;
+}
+
+typedef struct {
+  char *name;
+  uint64_t size;
+  struct timespec used;
+} Entry;
+
+static int compareUse(const void *a, const void *b) {
+  const Entry *x = a;
+  const Entry *y = b;
+  if (x->used.tv_sec != y->used.tv_sec) {
+    return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+  }
+  if (x->used.tv_nsec != y->used.tv_nsec) {
+    return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+static int isEntryName(const char *name) {
+  size_t length = strlen(name);
+  size_t suffix = strlen(ENTRY_SUFFIX);
+  return name[0] != '.' && length > suffix &&
+         strcmp(name + length - suffix, ENTRY_SUFFIX) == 0;
+}
+
+// remove the least recently used entries until the rest fit the capacity.
+// entries another run removes first are simply gone already.
+static void evict(DisasmCache *cache) {
+  DIR *dir = opendir(cache->dir);
+  Entry *entries = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  uint64_t total = 0;
+  struct dirent *dirent;
+  char path[CACHE_PATH_TEXT];
+  struct stat info;
+
+  if (dir == NULL) {
+    return;
+  }
+  while ((dirent = readdir(dir)) != NULL) {
+    if (!isEntryName(dirent->d_name) ||
+        entryPath(cache, dirent->d_name, path) != 0 ||
+        stat(path, &info) != 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      Entry *grown = realloc(entries, capacity * sizeof(Entry));
+      if (grown == NULL) {
+        break;
+      }
+      entries = grown;
+    }
+    entries[count].name = strdup(dirent->d_name);
+    if (entries[count].name == NULL) {
+      break;
+    }
+    entries[count].size = (uint64_t)info.st_size;
+    entries[count].used = info.st_mtim;
+    total += entries[count++].size;
+  }
+  closedir(dir);
+
+  qsort(entries, count, sizeof(Entry), compareUse);
+  for (size_t i = 0; i < count; i++) {
+    if (total > cache->capacity &&
+        entryPath(cache, entries[i].name, path) == 0 && unlink(path) == 0) {
+      total -= entries[i].size;
+    }
+    free(entries[i].name);
+  }
+  free(entries);
+}
+
+int commitCacheEntry(DisasmCache *cache, const char *tempPath,
+                     const char *key) {
+  char name[CACHE_KEY_TEXT + sizeof(ENTRY_SUFFIX)];
+  char path[CACHE_PATH_TEXT];
+
+  snprintf(name, sizeof(name), "%s%s", key, ENTRY_SUFFIX);
+  if (entryPath(cache, name, path) != 0 || rename(tempPath, path) != 0) {
+    int error = errno;
+    unlink(tempPath);
+    errno = error;
+    return -1;
+  }
+  evict(cache);
+  return 0;
+}
+
+int countCacheLookup(DisasmCache *cache, int hit, uint64_t *hits,
+                     uint64_t *misses) {
+  char path[CACHE_PATH_TEXT];
+  char text[64];
+  struct flock lock;
+  unsigned long long counts[2] = {0, 0};
+
+  if (entryPath(cache, COUNTERS_NAME, path) != 0) {
+    return -1;
+  }
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd < 0) {
+    return -1;
+  }
+  // runs sharing the cache take turns at the counters
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  if (fcntl(fd, F_SETLKW, &lock) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  ssize_t got = pread(fd, text, sizeof(text) - 1, 0);
+  text[got < 0 ? 0 : got] = '\0';
+  sscanf(text, "hits %llu misses %llu", &counts[0], &counts[1]);
+  counts[hit ? 0 : 1]++;
+  int length = snprintf(text, sizeof(text), "hits %llu misses %llu\n",
+                        counts[0], counts[1]);
+  int res = pwrite(fd, text, (size_t)length, 0) == length &&
+                    ftruncate(fd, length) == 0
+                ? 0
+                : -1;
+  close(fd); // releases the lock
+  *hits = counts[0];
+  *misses = counts[1];
+  return res;
+}
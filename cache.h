@@ -0,0 +1,66 @@
+/* This file contains the on-disk cache of finished listings defined in
+   cache.c (the --cache option), and the xxHash64 routine its keys are built
+   with.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_DEFAULT_CAPACITY (1ull << 30)
+
+// Room for a format name given to cacheKey(), with its terminating NUL;
+// for any key cacheKey() writes from one; and for the path of any file in
+// the cache.
+#define CACHE_NAME_TEXT 96
+#define CACHE_KEY_TEXT (CACHE_NAME_TEXT + 64)
+#define CACHE_PATH_TEXT 4096
+
+// Bumped whenever a listing for the same input can change, so entries
+// written by older builds are never served.
+#define CACHE_FORMAT_VERSION 2
+
+typedef struct {
+  char *dir;
+  uint64_t capacity; // total bytes of entries kept before evicting
+} DisasmCache;
+
+// Use (and create if need be) the cache directory dir. Returns 0, or -1
+// with errno set.
+int openCache(DisasmCache *cache, const char *dir, uint64_t capacity);
+void closeCache(DisasmCache *cache);
+
+// The XXH64 hash of length bytes at data.
+uint64_t xxHash64(const void *data, size_t length, uint64_t seed);
+
+// Write the key of the listing of image (length bytes) from startingOffset
+// in the given format (a short name with no '/') to key.
+void cacheKey(char *key, const uint8_t *image, size_t length,
+              long startingOffset, const char *format);
+
+// Copy the entry for key to outputFd and mark it as just used. Returns 1
+// on a hit, 0 on a miss and -1 if the entry could not be copied.
+int fetchCacheEntry(DisasmCache *cache, const char *key, int outputFd);
+
+// Create a temporary file in the cache for a new entry and write its path
+// to tempPath (CACHE_PATH_TEXT bytes). Returns its descriptor, or -1 with
+// errno set.
+int createCacheEntry(DisasmCache *cache, char *tempPath);
+// Move the finished temporary file into place as the entry for key, then
+// evict the least recently used entries until the cache fits its capacity.
+// Returns 0, or -1 with errno set (the temporary file is then removed).
+int commitCacheEntry(DisasmCache *cache, const char *tempPath,
+                     const char *key);
+
+// Copy everything in fd from its start to outputFd. Returns 0, or -1 with
+// errno set.
+int copyFile(int fd, int outputFd);
+
+// Add one hit (or one miss) to the counters kept in the cache and read back
+// the totals. Returns 0, or -1 if the counters could not be updated.
+int countCacheLookup(DisasmCache *cache, int hit, uint64_t *hits,
+                     uint64_t *misses);
+
+#endif /* CACHE */
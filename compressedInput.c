@@ -0,0 +1,465 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "compressedInput.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+  Compressed input.
+
+  An Inflater turns compressed bytes into image bytes a piece at a time,
+  whichever the format: gzip through zlib (several members one after the
+  other are read as one image, as gunzip does) and zstd through a zstd
+  stream, which handles several frames itself. Either way it tracks whether
+  it is part-way through a member, so input that stops short is reported
+  rather than taken as a shorter image.
+
+  A whole image is inflated into one growing buffer. A stream is inflated
+  by a thread of its own into a ring of INFLATE_BLOCKS blocks: it fills the
+  next free block while the reader decodes the ones before it, so the two
+  overlap and the reader only waits when it catches up. A block is handed
+  over when full, when the input ends, or when the next read of a pipe
+  would block, so a slow writer's bytes are not held back.
+*/
+
+#define INFLATE_BLOCKS 4
+#define INFLATE_BLOCK_BYTES (256 * 1024)
+#define INFLATE_INPUT_BYTES (64 * 1024)
+
+// zlib counts in unsigned int, so larger buffers are fed in pieces
+#define INFLATE_MAX_STEP ((size_t)1 << 30)
+
+typedef struct {
+  int format;
+  int inMember; // the last bytes taken left a member unfinished
+  z_stream zlib;
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zstd;
+#endif
+} Inflater;
+
+struct CompressedInput {
+  int fd;
+  Inflater inflater;
+  uint8_t *input; // compressed bytes read from fd
+  const uint8_t *pending;
+  size_t pendingLength; // of input not yet inflated
+
+  uint8_t *blocks;
+  size_t blockLength[INFLATE_BLOCKS];
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint64_t filled;    // blocks handed over by the thread
+  uint64_t taken;     // blocks the reader is done with
+  size_t takenOffset; // how far the reader is into block taken
+  int finished;       // no more blocks will be handed over
+  int error;          // the errno that finished it, or 0
+  int closing;
+};
+
+int compressedFormat(const uint8_t *bytes, size_t length) {
+  static const uint8_t gzipMagic[] = {0x1f, 0x8b};
+  static const uint8_t zstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+  if (length >= sizeof(gzipMagic) &&
+      memcmp(bytes, gzipMagic, sizeof(gzipMagic)) == 0) {
+    return COMPRESSED_GZIP;
+  }
+  if (length >= sizeof(zstdMagic) &&
+      memcmp(bytes, zstdMagic, sizeof(zstdMagic)) == 0) {
+    return COMPRESSED_ZSTD;
+  }
+  return COMPRESSED_NONE;
+}
+
+int isCompressedFile(const char *path) {
+  uint8_t magic[COMPRESSED_MAGIC_BYTES];
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  ssize_t got = read(fd, magic, sizeof(magic));
+  close(fd);
+  return got > 0 && compressedFormat(magic, (size_t)got) != COMPRESSED_NONE;
+}
+
+size_t compressedSuffixLength(const char *name, size_t length) {
+  if (length > 3 && strncmp(name + length - 3, ".gz", 3) == 0) {
+    return 3;
+  }
+  if (length > 4 && strncmp(name + length - 4, ".zst", 4) == 0) {
+    return 4;
+  }
+  return 0;
+}
+
+static int startInflater(Inflater *inflater, int format) {
+  memset(inflater, 0, sizeof(*inflater));
+  inflater->format = format;
+  if (format == COMPRESSED_GZIP) {
+    // 16 asks zlib for the gzip wrapper rather than the zlib one
+    int res = inflateInit2(&inflater->zlib, 15 + 16);
+    if (res != Z_OK) {
+      errno = res == Z_MEM_ERROR ? ENOMEM : EINVAL;
+      return -1;
+    }
+    return 0;
+  }
+#ifdef HAVE_ZSTD
+  inflater->zstd = ZSTD_createDStream();
+  if (inflater->zstd == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if (ZSTD_isError(ZSTD_initDStream(inflater->zstd))) {
+    ZSTD_freeDStream(inflater->zstd);
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+static void endInflater(Inflater *inflater) {
+  if (inflater->format == COMPRESSED_GZIP) {
+    inflateEnd(&inflater->zlib);
+  }
+#ifdef HAVE_ZSTD
+  if (inflater->format == COMPRESSED_ZSTD) {
+    ZSTD_freeDStream(inflater->zstd);
+  }
+#endif
+}
+
+// inflate one step from *in into out, moving *in past what was taken.
+// returns 0, or -1 with errno set.
+static int inflateStep(Inflater *inflater, const uint8_t **in,
+                       size_t *inLength, uint8_t *out, size_t outLength,
+                       size_t *produced) {
+  size_t inStep = *inLength < INFLATE_MAX_STEP ? *inLength : INFLATE_MAX_STEP;
+  size_t outStep = outLength < INFLATE_MAX_STEP ? outLength : INFLATE_MAX_STEP;
+  size_t consumed;
+
+  if (inflater->format == COMPRESSED_GZIP) {
+    z_stream *zlib = &inflater->zlib;
+    zlib->next_in = (Bytef *)*in;
+    zlib->avail_in = (uInt)inStep;
+    zlib->next_out = out;
+    zlib->avail_out = (uInt)outStep;
+    int res = inflate(zlib, Z_NO_FLUSH);
+    consumed = inStep - zlib->avail_in;
+    *produced = outStep - zlib->avail_out;
+    if (res == Z_STREAM_END) {
+      // another member may follow
+      inflateReset(zlib);
+      inflater->inMember = 0;
+    } else if (res == Z_OK || res == Z_BUF_ERROR) {
+      inflater->inMember = inflater->inMember || consumed > 0;
+    } else {
+      errno = res == Z_MEM_ERROR ? ENOMEM : EINVAL;
+      return -1;
+    }
+  } else {
+#ifdef HAVE_ZSTD
+    ZSTD_inBuffer input = {*in, inStep, 0};
+    ZSTD_outBuffer output = {out, outStep, 0};
+    size_t res = ZSTD_decompressStream(inflater->zstd, &output, &input);
+    if (ZSTD_isError(res)) {
+      errno = EINVAL;
+      return -1;
+    }
+    consumed = input.pos;
+    *produced = output.pos;
+    // 0 means a frame ended and everything in it was handed out
+    if (res == 0) {
+      inflater->inMember = 0;
+    } else if (consumed > 0) {
+      inflater->inMember = 1;
+    }
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+  }
+  *in += consumed;
+  *inLength -= consumed;
+  // with room left and nothing taken or given the input is unreadable
+  if (consumed == 0 && *produced == 0 && *inLength > 0 && outLength > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// inflate from *in into out until out is full, or *in is used up and the
+// inflater has nothing more to give. returns 0, or -1 with errno set.
+static int inflateSome(Inflater *inflater, const uint8_t **in,
+                       size_t *inLength, uint8_t *out, size_t outLength,
+                       size_t *produced) {
+  *produced = 0;
+  while (*produced < outLength) {
+    size_t before = *inLength;
+    size_t step;
+    if (inflateStep(inflater, in, inLength, out + *produced,
+                    outLength - *produced, &step) != 0) {
+      return -1;
+    }
+    *produced += step;
+    if (step == 0 && *inLength == before) {
+      break;
+    }
+  }
+  return 0;
+}
+
+int decompressBuffer(const uint8_t *bytes, size_t length, int format,
+                     uint8_t **image, size_t *imageLength) {
+  Inflater inflater;
+  if (startInflater(&inflater, format) != 0) {
+    return -1;
+  }
+
+  size_t capacity = length < (1 << 14) ? 1 << 16 : length * 4;
+  size_t used = 0;
+  uint8_t *buffer = malloc(capacity);
+  while (buffer != NULL) {
+    size_t produced;
+    if (inflateSome(&inflater, &bytes, &length, buffer + used,
+                    capacity - used, &produced) != 0) {
+      break;
+    }
+    used += produced;
+    if (used < capacity) {
+      // the input is used up; it has to end where a member does
+      if (inflater.inMember) {
+        errno = EINVAL;
+        break;
+      }
+      endInflater(&inflater);
+      *image = buffer;
+      *imageLength = used;
+      return 0;
+    }
+    uint8_t *grown = realloc(buffer, capacity * 2);
+    if (grown == NULL) {
+      errno = ENOMEM;
+      break;
+    }
+    buffer = grown;
+    capacity *= 2;
+  }
+
+  int savedErrno = buffer == NULL ? ENOMEM : errno;
+  free(buffer);
+  endInflater(&inflater);
+  errno = savedErrno;
+  return -1;
+}
+
+// read the next compressed bytes into input->input. returns the count, 0 at
+// the end of the input or -1 on error.
+static ssize_t readCompressed(CompressedInput *input) {
+  ssize_t got;
+  do {
+    got = read(input->fd, input->input, INFLATE_INPUT_BYTES);
+  } while (got < 0 && errno == EINTR);
+  if (got > 0) {
+    input->pending = input->input;
+    input->pendingLength = (size_t)got;
+  }
+  return got;
+}
+
+// whether a read of fd would have to wait for its writer
+static int wouldBlock(int fd) {
+  struct pollfd request = {fd, POLLIN, 0};
+  return poll(&request, 1, 0) == 0;
+}
+
+// hand block filled over to the reader, finishing the stream with error when
+// ended. returns whether the reader is closing it.
+static int handOver(CompressedInput *input, size_t length, int ended,
+                    int error) {
+  pthread_mutex_lock(&input->lock);
+  if (length > 0) {
+    input->blockLength[input->filled % INFLATE_BLOCKS] = length;
+    input->filled++;
+  }
+  input->finished = ended;
+  input->error = error;
+  pthread_cond_broadcast(&input->changed);
+  int closing = input->closing;
+  pthread_mutex_unlock(&input->lock);
+  return closing;
+}
+
+static void *inflateBlocks(void *arg) {
+  CompressedInput *input = arg;
+  int inputEnded = 0;
+
+  while (1) {
+    pthread_mutex_lock(&input->lock);
+    while (input->filled - input->taken == INFLATE_BLOCKS &&
+           !input->closing) {
+      pthread_cond_wait(&input->changed, &input->lock);
+    }
+    int closing = input->closing;
+    uint8_t *block = input->blocks +
+                     (input->filled % INFLATE_BLOCKS) * INFLATE_BLOCK_BYTES;
+    pthread_mutex_unlock(&input->lock);
+    if (closing) {
+      return NULL;
+    }
+
+    size_t length = 0;
+    int ended = 0;
+    int error = 0;
+    while (length < INFLATE_BLOCK_BYTES) {
+      if (input->pendingLength == 0 && !inputEnded) {
+        if (length > 0 && wouldBlock(input->fd)) {
+          break;
+        }
+        ssize_t got = readCompressed(input);
+        if (got < 0) {
+          error = errno;
+          ended = 1;
+          break;
+        }
+        inputEnded = got == 0;
+      }
+      size_t produced;
+      if (inflateSome(&input->inflater, &input->pending,
+                      &input->pendingLength, block + length,
+                      INFLATE_BLOCK_BYTES - length, &produced) != 0) {
+        error = errno;
+        ended = 1;
+        break;
+      }
+      length += produced;
+      if (length < INFLATE_BLOCK_BYTES && inputEnded) {
+        error = input->inflater.inMember ? EINVAL : 0;
+        ended = 1;
+        break;
+      }
+    }
+    if (handOver(input, length, ended, error) || ended) {
+      return NULL;
+    }
+  }
+}
+
+CompressedInput *openCompressedInput(int fd, int format,
+                                     const uint8_t *prefix,
+                                     size_t prefixLength) {
+  CompressedInput *input = calloc(1, sizeof(CompressedInput));
+  if (input == NULL) {
+    return NULL;
+  }
+  input->fd = fd;
+  input->input = malloc(INFLATE_INPUT_BYTES);
+  input->blocks = malloc((size_t)INFLATE_BLOCKS * INFLATE_BLOCK_BYTES);
+  if (input->input == NULL || input->blocks == NULL) {
+    free(input->input);
+    free(input->blocks);
+    free(input);
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (startInflater(&input->inflater, format) != 0) {
+    int savedErrno = errno;
+    free(input->input);
+    free(input->blocks);
+    free(input);
+    errno = savedErrno;
+    return NULL;
+  }
+  memcpy(input->input, prefix, prefixLength);
+  input->pending = input->input;
+  input->pendingLength = prefixLength;
+
+  pthread_mutex_init(&input->lock, NULL);
+  pthread_cond_init(&input->changed, NULL);
+  int res = pthread_create(&input->thread, NULL, inflateBlocks, input);
+  if (res != 0) {
+    pthread_mutex_destroy(&input->lock);
+    pthread_cond_destroy(&input->changed);
+    endInflater(&input->inflater);
+    free(input->input);
+    free(input->blocks);
+    free(input);
+    errno = res;
+    return NULL;
+  }
+  return input;
+}
+
+ssize_t readCompressedInput(CompressedInput *input, uint8_t *buffer,
+                            size_t length) {
+  size_t copied = 0;
+
+  pthread_mutex_lock(&input->lock);
+  while (copied < length) {
+    if (input->taken == input->filled) {
+      // hand back what there is rather than wait for more
+      if (copied > 0 || input->finished) {
+        break;
+      }
+      pthread_cond_wait(&input->changed, &input->lock);
+      continue;
+    }
+    size_t slot = input->taken % INFLATE_BLOCKS;
+    size_t left = input->blockLength[slot] - input->takenOffset;
+    size_t count = left < length - copied ? left : length - copied;
+    const uint8_t *from = input->blocks + slot * INFLATE_BLOCK_BYTES +
+                          input->takenOffset;
+    // the thread leaves a block alone until it is taken
+    pthread_mutex_unlock(&input->lock);
+    memcpy(buffer + copied, from, count);
+    pthread_mutex_lock(&input->lock);
+    copied += count;
+    input->takenOffset += count;
+    if (input->takenOffset == input->blockLength[slot]) {
+      input->taken++;
+      input->takenOffset = 0;
+      pthread_cond_broadcast(&input->changed);
+    }
+  }
+  int error = input->error;
+  int drained = input->finished && input->taken == input->filled;
+  pthread_mutex_unlock(&input->lock);
+
+  if (copied == 0 && drained && error != 0) {
+    errno = error;
+    return -1;
+  }
+  return (ssize_t)copied;
+}
+
+void closeCompressedInput(CompressedInput *input) {
+  pthread_mutex_lock(&input->lock);
+  input->closing = 1;
+  pthread_cond_broadcast(&input->changed);
+  pthread_mutex_unlock(&input->lock);
+  pthread_join(input->thread, NULL);
+
+  pthread_mutex_destroy(&input->lock);
+  pthread_cond_destroy(&input->changed);
+  endInflater(&input->inflater);
+  free(input->input);
+  free(input->blocks);
+  free(input);
+}
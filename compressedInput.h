@@ -0,0 +1,55 @@
+/* This file contains the gzip and zstd decompression of input images,
+   defined in compressedInput.c. zstd is only read by builds made with
+   HAVE_ZSTD (make HAVE_ZSTD=1), which link libzstd.
+*/
+
+#ifndef _COMPRESSEDINPUT_H_
+#define _COMPRESSEDINPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Compressed formats, told apart by their first bytes
+enum { COMPRESSED_NONE, COMPRESSED_GZIP, COMPRESSED_ZSTD };
+
+// Enough leading bytes to tell every format apart.
+#define COMPRESSED_MAGIC_BYTES 4
+
+// The format whose magic the first length bytes at bytes start with, or
+// COMPRESSED_NONE.
+int compressedFormat(const uint8_t *bytes, size_t length);
+
+// Whether the file at path starts with the magic of a compressed format.
+int isCompressedFile(const char *path);
+
+// The length of a .gz or .zst suffix ending the first length bytes of name,
+// or 0, so prog.mem.gz is named like prog.mem.
+size_t compressedSuffixLength(const char *name, size_t length);
+
+// Decompress the whole of (bytes, length), in format, into a heap buffer
+// for the caller to free. Returns 0, or -1 with errno set to EINVAL for
+// data that is corrupt or cut short, ENOTSUP for zstd in a build without
+// it, or ENOMEM.
+int decompressBuffer(const uint8_t *bytes, size_t length, int format,
+                     uint8_t **image, size_t *imageLength);
+
+typedef struct CompressedInput CompressedInput;
+
+// Start decompressing the rest of fd, in format, on a thread of its own.
+// The first prefixLength bytes of the input were already read from fd into
+// prefix. Returns NULL with errno set if it could not be started.
+CompressedInput *openCompressedInput(int fd, int format,
+                                     const uint8_t *prefix,
+                                     size_t prefixLength);
+
+// Copy up to length decompressed bytes into buffer, waiting for the thread
+// if it is behind. Returns the count, 0 at the end of the data, or -1 with
+// errno set as for decompressBuffer(), or as read() left it.
+ssize_t readCompressedInput(CompressedInput *input, uint8_t *buffer,
+                            size_t length);
+
+// Stop the thread and release everything; fd is left open.
+void closeCompressedInput(CompressedInput *input);
+
+#endif /* COMPRESSEDINPUT */
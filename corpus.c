@@ -0,0 +1,519 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "corpus.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "hashWords.h"
+#include "printRoutines.h"
+#include "zeroScan.h"
+
+/*
+  Corpus-wide segment sharing.
+
+  A run of at least SYNC_ZERO_RUN zero bytes always ends the sweep's current
+  segment: whatever instruction runs into it, a halt follows within the
+  run and the rest of it is a .pos gap opening the next segment at the
+  first non-zero byte. Those runs are found with the zero scanner alone,
+  so an image is split into segments without decoding it, and the records
+  of each segment depend only on its bytes, on where it starts modulo 8
+  (which decides .quad against .byte) and on whether it runs to the end of
+  the image (which cuts its last instruction short). Those three make up a
+  segment's key, with the bytes fingerprinted by a 128-bit MurmurHash3.
+
+  The first image to reach a key decodes the segment and formats it into
+  text, as if it were loaded at its address modulo 8. Its own .pos lines
+  are the only text that depends on where it really lies, so their places
+  in the text are kept and they are printed afresh for every copy. All
+  other images just count another copy. Listings are printed once every
+  image is scanned, when it is known which segments are shared.
+*/
+
+#define SYNC_ZERO_RUN 16
+#define SEGMENT_BATCH 1024
+#define SEGMENT_SINK_CAPACITY 4096
+#define INITIAL_BUCKETS 4096
+
+// a .pos line inside a segment's text
+typedef struct {
+  size_t textOffset; // where the line starts in the text
+  size_t textLength;
+  uint64_t target; // the address it opens, as the text was formatted
+} SegmentPos;
+
+typedef struct Segment {
+  struct Segment *next; // in its bucket
+  uint64_t hash[2];
+  uint64_t length; // bytes of image it covers
+  int alignment;   // its address modulo 8
+  int atEnd;       // it runs to the end of its image
+  uint64_t copies;
+  char name[33]; // its hash in hex, naming it in the listings
+  char *text;
+  size_t textLength;
+  SegmentPos *positions;
+  size_t positionCount;
+} Segment;
+
+struct SegmentTable {
+  pthread_mutex_t lock;
+  Segment **buckets;
+  size_t bucketCount;
+  uint64_t segments; // distinct segments in the table
+  uint64_t segmentBytes;
+  uint64_t copies; // segments found in all images
+  uint64_t copyBytes;
+};
+
+// one segment of a scanned image
+typedef struct {
+  Segment *segment;
+  uint64_t address;
+  uint64_t nextPos; // the address the .pos after it opens, 0 if none
+} SegmentCopy;
+
+struct CorpusImage {
+  uint64_t firstPos; // the address the image's leading .pos opens, 0 if none
+  SegmentCopy *copies;
+  size_t count;
+  size_t capacity;
+};
+
+static uint64_t finalMix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDull;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ull;
+  value ^= value >> 33;
+  return value;
+}
+
+// MurmurHash3_x64_128 of length bytes at data
+static void murmurHash128(const uint8_t *data, size_t length, uint64_t seed,
+                          uint64_t hash[2]) {
+  const uint64_t c1 = 0x87C37B91114253D5ull;
+  const uint64_t c2 = 0x4CF5AD432745937Full;
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  size_t blocks = length / 16;
+
+  for (size_t i = 0; i < blocks; i++) {
+    uint64_t k1 = load64(data + 16 * i);
+    uint64_t k2 = load64(data + 16 * i + 8);
+    h1 ^= rotateLeft(k1 * c1, 31) * c2;
+    h1 = (rotateLeft(h1, 27) + h2) * 5 + 0x52DCE729;
+    h2 ^= rotateLeft(k2 * c2, 33) * c1;
+    h2 = (rotateLeft(h2, 31) + h1) * 5 + 0x38495AB5;
+  }
+
+  // the last 1-15 bytes, little-endian, as two partial words
+  const uint8_t *tail = data + 16 * blocks;
+  size_t left = length % 16;
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  for (size_t i = left; i > 8; i--) {
+    k2 ^= (uint64_t)tail[i - 1] << 8 * (i - 9);
+  }
+  for (size_t i = left < 8 ? left : 8; i > 0; i--) {
+    k1 ^= (uint64_t)tail[i - 1] << 8 * (i - 1);
+  }
+  if (left > 8) {
+    h2 ^= rotateLeft(k2 * c2, 33) * c1;
+  }
+  if (left > 0) {
+    h1 ^= rotateLeft(k1 * c1, 31) * c2;
+  }
+
+  h1 ^= (uint64_t)length;
+  h2 ^= (uint64_t)length;
+  h1 += h2;
+  h2 += h1;
+  h1 = finalMix(h1);
+  h2 = finalMix(h2);
+  h1 += h2;
+  h2 += h1;
+  hash[0] = h1;
+  hash[1] = h2;
+}
+
+SegmentTable *createSegmentTable(void) {
+  SegmentTable *table = calloc(1, sizeof(SegmentTable));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->bucketCount = INITIAL_BUCKETS;
+  table->buckets = calloc(table->bucketCount, sizeof(Segment *));
+  if (table->buckets == NULL) {
+    free(table);
+    return NULL;
+  }
+  pthread_mutex_init(&table->lock, NULL);
+  return table;
+}
+
+void freeSegmentTable(SegmentTable *table) {
+  for (size_t i = 0; i < table->bucketCount; i++) {
+    Segment *segment = table->buckets[i];
+    while (segment != NULL) {
+      Segment *next = segment->next;
+      free(segment->text);
+      free(segment->positions);
+      free(segment);
+      segment = next;
+    }
+  }
+  pthread_mutex_destroy(&table->lock);
+  free(table->buckets);
+  free(table);
+}
+
+// double the buckets once the chains average two segments. called with the
+// lock held; a failed allocation just leaves the chains longer.
+static void growTable(SegmentTable *table) {
+  size_t bucketCount = table->bucketCount * 2;
+  Segment **buckets = calloc(bucketCount, sizeof(Segment *));
+  if (buckets == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < table->bucketCount; i++) {
+    Segment *segment = table->buckets[i];
+    while (segment != NULL) {
+      Segment *next = segment->next;
+      size_t bucket = segment->hash[0] & (bucketCount - 1);
+      segment->next = buckets[bucket];
+      buckets[bucket] = segment;
+      segment = next;
+    }
+  }
+  free(table->buckets);
+  table->buckets = buckets;
+  table->bucketCount = bucketCount;
+}
+
+// find the segment with key's hash, length, alignment and end, or add a
+// copy of key, counting one more copy either way. *added is set when the
+// caller has to fill in the new segment's text. returns NULL if a new
+// segment could not be allocated.
+static Segment *findSegment(SegmentTable *table, const Segment *key,
+                            int *added) {
+  pthread_mutex_lock(&table->lock);
+  size_t bucket = key->hash[0] & (table->bucketCount - 1);
+  Segment *segment = table->buckets[bucket];
+  while (segment != NULL &&
+         (segment->hash[0] != key->hash[0] ||
+          segment->hash[1] != key->hash[1] ||
+          segment->length != key->length ||
+          segment->alignment != key->alignment ||
+          segment->atEnd != key->atEnd)) {
+    segment = segment->next;
+  }
+  *added = segment == NULL;
+  if (segment == NULL) {
+    segment = malloc(sizeof(Segment));
+    if (segment == NULL) {
+      pthread_mutex_unlock(&table->lock);
+      return NULL;
+    }
+    *segment = *key;
+    segment->next = table->buckets[bucket];
+    table->buckets[bucket] = segment;
+    table->segments++;
+    table->segmentBytes += key->length;
+    if (table->segments > 2 * table->bucketCount) {
+      growTable(table);
+    }
+  }
+  segment->copies++;
+  table->copies++;
+  table->copyBytes += key->length;
+  pthread_mutex_unlock(&table->lock);
+  return segment;
+}
+
+/**
+ * Decode and format a new segment starting at bytes. Unless it runs to the
+ * end of the image the zero run after it is at least SYNC_ZERO_RUN bytes,
+ * and the first SYNC_ZERO_RUN of them are decoded too: whatever runs into
+ * the gap is part of the segment, and the .pos or skip record that reaches
+ * the end of them is the gap itself, which is left out.
+ **/
+static int formatSegment(Segment *segment, const uint8_t *bytes) {
+  Y86Instruction records[SEGMENT_BATCH];
+  Y86Cursor cursor;
+  OutputSink text;
+  size_t count;
+  size_t capacity = 0;
+  uint64_t base = (uint64_t)segment->alignment;
+  size_t length =
+      (size_t)segment->length + (segment->atEnd ? 0 : SYNC_ZERO_RUN);
+
+  sprintf(segment->name, "%016llx%016llx",
+          (unsigned long long)segment->hash[0],
+          (unsigned long long)segment->hash[1]);
+  if (openOutputSink(&text, -1, SEGMENT_SINK_CAPACITY) != 0) {
+    return -1;
+  }
+  y86StartCursor(&cursor, 0);
+  while ((count = y86Decode(bytes, length, base, &cursor, records,
+                            SEGMENT_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const Y86Instruction *insn = &records[i];
+      if (!segment->atEnd && insn->address + insn->length == base + length) {
+        continue;
+      }
+      if (insn->kind != Y86_POS) {
+        printRecord(&text, insn, 0);
+        continue;
+      }
+      if (segment->positionCount == capacity) {
+        capacity = capacity == 0 ? 16 : capacity * 2;
+        SegmentPos *grown =
+            realloc(segment->positions, capacity * sizeof(SegmentPos));
+        if (grown == NULL) {
+          closeOutputSink(&text);
+          return -1;
+        }
+        segment->positions = grown;
+      }
+      SegmentPos *pos = &segment->positions[segment->positionCount++];
+      pos->textOffset = text.used;
+      pos->target = insn->immediate;
+      printRecord(&text, insn, 0);
+      pos->textLength = text.used - pos->textOffset;
+    }
+  }
+
+  if (text.error != 0) {
+    closeOutputSink(&text);
+    return -1;
+  }
+  // the text is kept until the listings are printed, so it gives back what
+  // the sink had spare
+  char *shrunk = realloc(text.buffer, text.used == 0 ? 1 : text.used);
+  segment->text = shrunk == NULL ? text.buffer : shrunk;
+  segment->textLength = text.used;
+  return 0;
+}
+
+// find where the next run of at least SYNC_ZERO_RUN zero bytes in
+// image[from, length) starts, or length if there is none. *runEnd is set to
+// the first non-zero byte after it, or length. image[from] is not zero.
+static size_t findSyncRun(const uint8_t *image, size_t from, size_t length,
+                          size_t *runEnd) {
+  size_t offset = from;
+  while (offset < length) {
+    // any SYNC_ZERO_RUN zero bytes hold a whole 8-byte aligned word of
+    // zeros, so only those words are looked at until one is found
+    size_t word = (offset + 7) & ~(size_t)7;
+    while (word + 8 <= length && load64(image + word) != 0) {
+      word += 8;
+    }
+    if (word + 8 > length) {
+      break;
+    }
+    size_t start = word;
+    while (image[start - 1] == 0) {
+      start--;
+    }
+    size_t end = findNonZero(image, word + 8, length);
+    if (end - start >= SYNC_ZERO_RUN) {
+      *runEnd = end;
+      return start;
+    }
+    offset = end;
+  }
+  *runEnd = length;
+  return length;
+}
+
+static int addCopy(CorpusImage *image, Segment *segment, uint64_t address,
+                   uint64_t nextPos) {
+  if (image->count == image->capacity) {
+    size_t capacity = image->capacity == 0 ? 64 : image->capacity * 2;
+    SegmentCopy *grown =
+        realloc(image->copies, capacity * sizeof(SegmentCopy));
+    if (grown == NULL) {
+      return -1;
+    }
+    image->copies = grown;
+    image->capacity = capacity;
+  }
+  SegmentCopy *copy = &image->copies[image->count++];
+  copy->segment = segment;
+  copy->address = address;
+  copy->nextPos = nextPos;
+  return 0;
+}
+
+CorpusImage *scanCorpusImage(SegmentTable *table, const uint8_t *image,
+                             size_t length) {
+  CorpusImage *scanned = calloc(1, sizeof(CorpusImage));
+  if (scanned == NULL) {
+    return NULL;
+  }
+
+  // the sweep starts at a segment start, where any zeros are a .pos gap
+  size_t offset = length > 0 && image[0] == 0 ? findNonZero(image, 0, length)
+                                              : 0;
+  scanned->firstPos = offset < length ? offset : 0;
+
+  while (offset < length) {
+    size_t runEnd;
+    size_t runStart = findSyncRun(image, offset, length, &runEnd);
+    Segment key;
+    memset(&key, 0, sizeof(key));
+    key.length = runStart - offset;
+    key.alignment = (int)(offset % 8);
+    key.atEnd = runStart == length;
+    murmurHash128(image + offset, runStart - offset,
+                  (uint64_t)(key.alignment << 1 | key.atEnd), key.hash);
+
+    int added;
+    Segment *segment = findSegment(table, &key, &added);
+    int res = segment == NULL ? -1 : 0;
+    if (res == 0 && added) {
+      res = formatSegment(segment, image + offset);
+    }
+    if (res == 0) {
+      res = addCopy(scanned, segment, offset, runEnd < length ? runEnd : 0);
+    }
+    if (res != 0) {
+      freeCorpusImage(scanned);
+      errno = ENOMEM;
+      return NULL;
+    }
+    offset = runEnd;
+  }
+  return scanned;
+}
+
+void freeCorpusImage(CorpusImage *image) {
+  free(image->copies);
+  free(image);
+}
+
+// whether a segment is printed once in CORPUS_SEGMENTS and referred to
+static int isShared(const Segment *segment) {
+  return segment->copies > 1 &&
+         segment->textLength >= CORPUS_MIN_SHARED_TEXT;
+}
+
+// print the line that stands for a copy of a shared segment at address
+static void printReference(const Segment *segment, uint64_t address,
+                           OutputSink *out) {
+  static const char prefix[] = "# segment ";
+  static const char at[] = " at 0x";
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = start;
+  memcpy(dst, prefix, sizeof(prefix) - 1);
+  dst += sizeof(prefix) - 1;
+  memcpy(dst, segment->name, sizeof(segment->name) - 1);
+  dst += sizeof(segment->name) - 1;
+  memcpy(dst, at, sizeof(at) - 1);
+  dst += sizeof(at) - 1;
+  dst += formatHex(dst, address);
+  *dst++ = '\n';
+  commitOutput(out, dst);
+}
+
+// print the text of segment as it reads at address, .pos lines included
+static void printSegmentCopy(const Segment *segment, uint64_t address,
+                             OutputSink *out) {
+  // the text was formatted at address % 8
+  uint64_t shift = address - address % 8;
+  size_t done = 0;
+  for (size_t i = 0; i < segment->positionCount; i++) {
+    const SegmentPos *pos = &segment->positions[i];
+    appendOutput(out, segment->text + done, pos->textOffset - done);
+    printPos(out, (long)(shift + pos->target), 0);
+    done = pos->textOffset + pos->textLength;
+  }
+  appendOutput(out, segment->text + done, segment->textLength - done);
+}
+
+int printCorpusImage(const CorpusImage *image, int mode, OutputSink *out) {
+  // a segment is left without text if formatting it ran out of memory
+  for (size_t i = 0; i < image->count; i++) {
+    if (image->copies[i].segment->text == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if (image->firstPos != 0) {
+    printPos(out, (long)image->firstPos, 1);
+  }
+  for (size_t i = 0; i < image->count; i++) {
+    const SegmentCopy *copy = &image->copies[i];
+    if (mode == CORPUS_REFERENCES && isShared(copy->segment)) {
+      printReference(copy->segment, copy->address, out);
+    } else {
+      printSegmentCopy(copy->segment, copy->address, out);
+    }
+    if (copy->nextPos != 0) {
+      printPos(out, (long)copy->nextPos, 0);
+    }
+  }
+  return 0;
+}
+
+static int compareSegments(const void *a, const void *b) {
+  const Segment *first = *(const Segment *const *)a;
+  const Segment *second = *(const Segment *const *)b;
+  if (first->hash[0] != second->hash[0]) {
+    return first->hash[0] < second->hash[0] ? -1 : 1;
+  }
+  if (first->hash[1] != second->hash[1]) {
+    return first->hash[1] < second->hash[1] ? -1 : 1;
+  }
+  return 0;
+}
+
+long printSharedSegments(const SegmentTable *table, OutputSink *out) {
+  size_t count = 0;
+  Segment **shared = malloc((table->segments + 1) * sizeof(Segment *));
+  if (shared == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < table->bucketCount; i++) {
+    for (Segment *segment = table->buckets[i]; segment != NULL;
+         segment = segment->next) {
+      if (isShared(segment)) {
+        shared[count++] = segment;
+      }
+    }
+  }
+  // by name, so the file does not depend on which image was scanned first
+  qsort(shared, count, sizeof(Segment *), compareSegments);
+
+  for (size_t i = 0; i < count; i++) {
+    char *start = reserveOutput(out, MAX_RECORD_TEXT);
+    int length = sprintf(start, "%s# segment %s: %llu copies, from 0x%x\n",
+                         i == 0 ? "" : "\n", shared[i]->name,
+                         (unsigned long long)shared[i]->copies,
+                         shared[i]->alignment);
+    commitOutput(out, start + length);
+    appendOutput(out, shared[i]->text, shared[i]->textLength);
+  }
+  free(shared);
+  return (long)count;
+}
+
+void reportSegmentSharing(const SegmentTable *table) {
+  fprintf(stderr,
+          "Found %llu segments (%llu bytes), %llu distinct (%llu bytes): "
+          "%.2fx sharing\n",
+          (unsigned long long)table->copies,
+          (unsigned long long)table->copyBytes,
+          (unsigned long long)table->segments,
+          (unsigned long long)table->segmentBytes,
+          table->segmentBytes == 0
+              ? 1.0
+              : (double)table->copyBytes / (double)table->segmentBytes);
+}
@@ -0,0 +1,60 @@
+/* This file contains the segment sharing behind --batch --corpus, defined
+   in corpus.c: the segments of every image in a batch are fingerprinted,
+   and each distinct one is decoded and formatted only once.
+*/
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// How a batch shares segments
+enum {
+  CORPUS_OFF,        // every image is disassembled on its own
+  CORPUS_REFERENCES, // shared segments are listed once, in CORPUS_SEGMENTS
+  CORPUS_EXPANDED    // shared segments are copied into every listing
+};
+
+// The file in the output directory that lists the shared segments.
+#define CORPUS_SEGMENTS "segments.ys"
+
+// A segment is referred to rather than copied only when it is found more
+// than once and its text is at least this long.
+#define CORPUS_MIN_SHARED_TEXT 64
+
+typedef struct SegmentTable SegmentTable;
+typedef struct CorpusImage CorpusImage;
+
+// Returns NULL if it could not be allocated.
+SegmentTable *createSegmentTable(void);
+void freeSegmentTable(SegmentTable *table);
+
+// Split the image (length bytes, swept from 0) into segments, add them to
+// table and decode and format the ones it has not seen before. Safe to call
+// from several threads at once. Returns NULL with errno set to ENOMEM.
+CorpusImage *scanCorpusImage(SegmentTable *table, const uint8_t *image,
+                             size_t length);
+void freeCorpusImage(CorpusImage *image);
+
+// Print the listing of a scanned image, the same as disassemble() prints.
+// With CORPUS_REFERENCES a shared segment is a line naming it instead:
+//
+//   # segment 7f0c2d81a55e9b3e0c1d4f6a2b8e9d01 at 0x1400
+//
+// Call only once every image has been scanned. Returns 0, or -1 with errno
+// set to ENOMEM if one of its segments could not be formatted.
+int printCorpusImage(const CorpusImage *image, int mode, OutputSink *out);
+
+// Print every shared segment under a line naming it. Its internal .pos
+// lines are given as if it started at its address modulo 8. Returns the
+// number printed, or -1 with errno set to ENOMEM.
+long printSharedSegments(const SegmentTable *table, OutputSink *out);
+
+// Print how many segments and bytes the images had, and how many were
+// distinct, to stderr.
+void reportSegmentSharing(const SegmentTable *table);
+
+#endif /* CORPUS */
@@ -0,0 +1,189 @@
+#include "decoder.h"
+
+#include <string.h>
+
+#include "opcodeTable.h"
+#include "zeroScan.h"
+
+/*
+  libdisasm: a linear sweep over a buffer of Y86-64 machine code producing
+  Y86Instruction records. All state lives in the caller's Y86Cursor.
+*/
+
+// read the 8-byte little-endian value at offset. bytes beyond the end of the
+// buffer count as -1 and are summed byte by byte, which is the value the
+// disassembler has always printed for an instruction cut short by the end
+// of the image.
+static uint64_t loadQuad(const uint8_t *buf, size_t len, size_t offset) {
+  if (offset + 8 <= len) {
+    uint64_t value;
+    memcpy(&value, buf + offset, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+  }
+
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t byte = offset + i < len ? buf[offset + i] : UINT64_MAX;
+    value += byte << 8 * i;
+  }
+  return value;
+}
+
+// forwards through the buffer until it sees the first non-zero byte and
+// describes the skipped run in *out: a .pos record when a segment follows,
+// or a skip record when the zeros run to the end of the buffer. returns 0
+// without touching *out when the cursor is already on a non-zero byte.
+// unless final is set the buffer may continue: a run reaching its end is
+// reported without its last byte, so the next call still sees the run and
+// can tell whether a segment follows.
+static int getFirstNonZero(const uint8_t *buf, size_t len, uint64_t base,
+                           Y86Cursor *cursor, Y86Instruction *out,
+                           int final) {
+  size_t start = cursor->offset;
+  // a single record can describe at most UINT32_MAX zero bytes; a longer
+  // run is reported in pieces and stays at the segment start.
+  size_t limit = len - start > UINT32_MAX ? start + UINT32_MAX : len;
+  if (!final && limit == len) {
+    limit--;
+  }
+
+  size_t offset = findNonZero(buf, start, limit);
+  cursor->atSegmentStart = offset < len && buf[offset] == 0;
+  if (offset == start) {
+    return 0;
+  }
+
+  memset(out, 0, sizeof(*out));
+  out->address = base + start;
+  out->length = (uint32_t)(offset - start);
+  out->kind = offset < len && buf[offset] != 0 ? Y86_POS : Y86_SKIP;
+  out->immediate = base + offset;
+  cursor->offset = offset;
+  return 1;
+}
+
+/**
+ * In validateInstr() we look the current instruction byte up in opcodeTable.
+ * Its descriptor says whether a register byte and an 8-byte value follow the
+ * icode, and which flags registerTable must report for the rA:rB byte, so an
+ * instruction is validated with one lookup and a compare.
+ *
+ * Invalid encodings consume 8 bytes and become a .quad when they start on an
+ * 8-byte boundary and all 8 bytes are present, or a .byte otherwise. iCodes
+ * 0xC-0xF are skipped without output.
+ **/
+static void validateInstr(const uint8_t *buf, size_t len, uint64_t base,
+                          Y86Cursor *cursor, Y86Instruction *out) {
+  size_t offset = cursor->offset;
+  size_t remaining = len - offset;
+  int instr = buf[offset];
+  const OpcodeDescriptor *op = &opcodeTable[instr];
+
+  // a register byte missing at the end of the buffer reads as 0xFF, which no
+  // register requirement accepts.
+  int registerByte = 0xFF;
+  if ((op->flags & OP_REGISTER_BYTE) && remaining > 1) {
+    registerByte = buf[offset + 1];
+  }
+  const RegisterByte *registers = &registerTable[registerByte];
+
+  out->address = base + offset;
+  out->immediate = 0;
+  out->icode = instr >> 4;
+  out->ifun = instr & 0x0F;
+  out->rA = registerByte >> 4;
+  out->rB = registerByte & 0x0F;
+
+  size_t consumed;
+  if ((op->flags & OP_VALID) &&
+      (registers->flags & op->registerRequirements) ==
+          op->registerRequirements) {
+    out->kind = Y86_CODE;
+    consumed = op->length;
+    if (op->flags & OP_IMMEDIATE) {
+      out->immediate = loadQuad(buf, len, offset + consumed - 8);
+    }
+    // halt swallows the byte after it, and only counts as an instruction if
+    // that byte exists.
+    if (op->flags & OP_SEGMENT_END) {
+      consumed = 2;
+      if (remaining < 2) {
+        out->kind = Y86_SKIP;
+      }
+    }
+  } else if (op->flags & OP_UNKNOWN) {
+    out->kind = Y86_SKIP;
+    consumed = 1;
+  } else {
+    consumed = INVALID_INSTR_BYTES;
+    if (out->address % 8 != 0) {
+      out->kind = Y86_BYTE;
+    } else if (remaining >= INVALID_INSTR_BYTES) {
+      out->kind = Y86_QUAD;
+      out->immediate = loadQuad(buf, len, offset);
+    } else {
+      out->kind = Y86_SKIP;
+    }
+  }
+
+  if (consumed > remaining) {
+    consumed = remaining;
+  }
+  out->length = (uint32_t)consumed;
+  cursor->offset = offset + consumed;
+  cursor->atSegmentStart = (op->flags & OP_SEGMENT_END) != 0;
+}
+
+void y86StartCursor(Y86Cursor *cursor, size_t offset) {
+  cursor->offset = offset;
+  cursor->atSegmentStart = 1;
+}
+
+void y86CursorAfter(const Y86Instruction *insn, uint64_t base,
+                    Y86Cursor *cursor) {
+  cursor->offset = (size_t)(insn->address + insn->length - base);
+  // every record that starts with an icode 0 byte ends a segment; .pos
+  // records start one.
+  cursor->atSegmentStart = insn->kind != Y86_POS && insn->icode == 0;
+}
+
+int y86CursorsAgree(const uint8_t *buf, size_t len, const Y86Cursor *a,
+                    const Y86Cursor *b) {
+  return a->offset == b->offset &&
+         (a->atSegmentStart == b->atSegmentStart ||
+          (a->offset < len && buf[a->offset] != 0));
+}
+
+static size_t decode(const uint8_t *buf, size_t len, uint64_t base,
+                     Y86Cursor *cursor, Y86Instruction *out, size_t cap,
+                     int final) {
+  size_t count = 0;
+  while (count < cap && cursor->offset < len) {
+    // after an iCode 0 byte a run of zero bytes is a new .pos segment rather
+    // than a string of halts.
+    if (cursor->atSegmentStart &&
+        getFirstNonZero(buf, len, base, cursor, &out[count], final)) {
+      count++;
+      continue;
+    }
+    // an instruction near the end of a partial buffer may not be complete
+    if (!final && len - cursor->offset < Y86_MAX_RECORD_BYTES) {
+      break;
+    }
+    validateInstr(buf, len, base, cursor, &out[count++]);
+  }
+  return count;
+}
+
+size_t y86Decode(const uint8_t *buf, size_t len, uint64_t base,
+                 Y86Cursor *cursor, Y86Instruction *out, size_t cap) {
+  return decode(buf, len, base, cursor, out, cap, 1);
+}
+
+size_t y86DecodePartial(const uint8_t *buf, size_t len, uint64_t base,
+                        Y86Cursor *cursor, Y86Instruction *out, size_t cap) {
+  return decode(buf, len, base, cursor, out, cap, 0);
+}
@@ -0,0 +1,90 @@
+/* This file contains the public interface of libdisasm, the Y86-64 decoder
+   defined in decoder.c. It turns a buffer of machine code into an array of
+   fixed-size records without printing anything, keeping no global state and
+   allocating no memory, so it can be embedded in other tools.
+*/
+
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Record kinds
+enum {
+  Y86_CODE, // a valid instruction
+  Y86_QUAD, // an invalid encoding at an 8-byte aligned address, shown as .quad
+  Y86_BYTE, // an invalid encoding at an unaligned address, shown as .byte
+  Y86_POS,  // a run of zero bytes that starts a new .pos segment
+  Y86_SKIP  // bytes consumed without output (icodes 0xC-0xF, trailing zeros,
+            // data cut short by the end of the image)
+};
+
+#define Y86_NO_REGISTER 0xF
+
+// No record other than a run of zero bytes is longer than this.
+#define Y86_MAX_RECORD_BYTES 10
+
+// One decoded record. Records tile the bytes they were decoded from:
+// address + length is always the address of the next record.
+//
+//   Y86_CODE  icode/ifun/rA/rB as encoded; immediate is valC (jump/call
+//             destination, displacement or irmovq value). A halt also
+//             consumes the byte after it, so its length is 2.
+//   Y86_QUAD  immediate holds the 8 raw bytes, little-endian.
+//   Y86_BYTE  icode/ifun of the first byte; the remaining bytes of the
+//             invalid encoding are consumed but not shown.
+//   Y86_POS   address/length cover the zero run; immediate is the address
+//             of the segment it opens.
+typedef struct {
+  uint64_t address;
+  uint64_t immediate;
+  uint32_t length;
+  uint8_t kind;
+  uint8_t icode;
+  uint8_t ifun;
+  uint8_t rA;
+  uint8_t rB;
+} Y86Instruction;
+
+// Position of a linear sweep through a buffer. atSegmentStart is set at the
+// start of a sweep and after every icode 0 byte: zero bytes found there are
+// a .pos gap rather than halt instructions.
+typedef struct {
+  size_t offset;
+  int atSegmentStart;
+} Y86Cursor;
+
+// Start a sweep at offset bytes into the buffer.
+void y86StartCursor(Y86Cursor *cursor, size_t offset);
+
+// Set cursor to where a sweep stands right after insn, which was decoded from
+// a buffer loaded at base. Lets a sweep be resumed from any record.
+void y86CursorAfter(const Y86Instruction *insn, uint64_t base,
+                    Y86Cursor *cursor);
+
+// Whether sweeps standing at a and b in buf (len bytes) produce the same
+// records from here on: they are at the same offset, and either in the same
+// state or on a non-zero byte, where the state makes no difference.
+int y86CursorsAgree(const uint8_t *buf, size_t len, const Y86Cursor *a,
+                    const Y86Cursor *b);
+
+// Decode up to cap records from buf, which holds len bytes of machine code
+// loaded at address base, continuing from cursor and advancing it. Returns
+// the number of records written; 0 means the end of the buffer was reached.
+size_t y86Decode(const uint8_t *buf, size_t len, uint64_t base,
+                 Y86Cursor *cursor, Y86Instruction *out, size_t cap);
+
+// Like y86Decode(), but buf holds only the part of a stream received so far,
+// so no record is decoded that more bytes could still change: decoding stops
+// once fewer than Y86_MAX_RECORD_BYTES bytes are left. A zero run that
+// reaches the end of buf is reported, all but its last byte, as a Y86_SKIP
+// record and the cursor stays at the segment start, so the .pos record that
+// follows covers only the rest of the run. Returns 0 when more bytes are
+// needed; the caller then keeps buf[cursor->offset .. len), appends to it
+// and calls again (with base and the cursor's offset adjusted), finishing
+// with y86Decode() once the stream has ended.
+size_t y86DecodePartial(const uint8_t *buf, size_t len, uint64_t base,
+                        Y86Cursor *cursor, Y86Instruction *out, size_t cap);
+
+#endif /* DECODER */
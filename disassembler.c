@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -5,598 +7,937 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include "batch.h"
+#include "cache.h"
+#include "compressedInput.h"
+#include "corpus.h"
+#include "decoder.h"
 #include "disassembler.h"
+#include "emulator.h"
+#include "hazards.h"
+#include "imageDiff.h"
+#include "machineImage.h"
+#include "objectListing.h"
+#include "parallelDisassemble.h"
+#include "peephole.h"
+#include "pipeModel.h"
 #include "printRoutines.h"
+#include "recursiveDescent.h"
+#include "segmentIndex.h"
+#include "serveMode.h"
+#include "stats.h"
+#include "streamDisassemble.h"
+#include "threadPool.h"
+#include "watchMode.h"
+#include "xrefIndex.h"
 
 #define ERROR_RETURN -1
 #define SUCCESS 0
+#define RECORD_BATCH 1024
+
+// Command line settings
+typedef struct {
+  const char *inputName;
+  const char *outputName; // NULL for standard output
+  long startingOffset;
+  int threads;            // 0 when not given
+  int stream;             // read the input as a stream, never as a whole
+  int recursive;          // follow control flow from the starting offset
+  int labels;             // label branch destinations (--xrefs)
+  int hazards;            // note where the pipeline will lose cycles
+  int optimise;           // print an optimised, re-assemblable listing
+  int exec;               // run the image instead of listing it
+  int pipe;               // run it and annotate the listing with PIPE timing
+  uint64_t maxSteps;      // instructions --exec runs at most
+  const char *xrefsTo;    // list the branches to this address instead
+  const char *batchDir;   // NULL unless in batch mode
+  int corpus;             // how batch mode shares segments (CORPUS_OFF...)
+  int watch;              // keep the output up to date with the input
+  const char *format;     // "text", "ndjson" or "bin"
+  RecordPrinter print;    // formats each record in that format
+  const char *cacheDir;   // NULL unless listings are cached
+  uint64_t cacheCapacity; // bytes of listings the cache keeps
+  const char *stats;      // NULL, or "text" or "json" to report on the run
+  const char *range;      // NULL, or the START-END to list
+  uint64_t rangeStart;
+  uint64_t rangeEnd;      // exclusive
+  const char *indexPath;  // the index sidecar --range starts from
+  const char *diff;       // NULL, or the old image to diff the input with
+  const char *serve;      // NULL, or the socket to serve listings on
+  const char *client;     // NULL, or the socket of the server to ask
+  char **positional;      // the arguments that are not options
+  int positionalCount;
+} Options;
+
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-j threads] [--stream | --recursive] [--xrefs] "
+          "[--format=text|ndjson|bin]\n"
+          "       [--cache DIR [--cache-size SIZE]] [--stats[=json]] "
+          "InputFilename|- [OutputFilename] [startingOffset]\n"
+          "       %s --range START-END [--index IndexFile] "
+          "[--format=text|ndjson|bin]\n"
+          "       [--cache DIR [--cache-size SIZE]] InputFilename "
+          "[OutputFilename] [startingOffset]\n"
+          "       %s --diff OldFilename InputFilename [OutputFilename] "
+          "[startingOffset]\n"
+          "       %s --xrefs-to address InputFilename [OutputFilename] "
+          "[startingOffset]\n"
+          "       %s --annotate-hazards | --optimise InputFilename "
+          "[OutputFilename] [startingOffset]\n"
+          "       %s --exec | --pipe [--max-steps N] InputFilename "
+          "[OutputFilename] "
+          "[entry]\n"
+          "       %s [-j threads] --batch OutputDirectory "
+          "[--corpus[=expand]]\n"
+          "       [InputFile | InputDirectory | -]...\n"
+          "       %s --watch InputFilename OutputFilename [startingOffset]\n"
+          "       %s --serve SOCKET [-j threads] [--cache-size SIZE]\n"
+          "       %s --client SOCKET [--range START-END] "
+          "[--format=text|ndjson|bin]\n"
+          "       InputFilename|- [OutputFilename] [startingOffset]\n",
+          program, program, program, program, program, program, program,
+          program, program, program);
+}
 
-int main(int argc, char **argv) {
+// the value of an option given either as "-jN" or as "-j N"
+static const char *optionValue(int argc, char **argv, int *i) {
+  const char *arg = argv[*i];
+  if (arg[2] != '\0') {
+    return arg + 2;
+  }
+  if (*i + 1 < argc) {
+    return argv[++*i];
+  }
+  return NULL;
+}
 
-  FILE *machineCode, *outputFile;
-  long currAddr = 0;
-  int currInstr = -1;
-  int *nextBytes = (int *)malloc(9 * sizeof(int));
+// the value of a long option given either as "--name=value" or as
+// "--name value", or NULL if argv[*i] is not that option.
+static const char *longOptionValue(int argc, char **argv, int *i,
+                                   const char *name) {
+  const char *arg = argv[*i];
+  size_t length = strlen(name);
+  if (strncmp(arg, name, length) != 0) {
+    return NULL;
+  }
+  if (arg[length] == '=') {
+    return arg + length + 1;
+  }
+  if (arg[length] == '\0' && *i + 1 < argc) {
+    return argv[++*i];
+  }
+  return NULL;
+}
 
-  // Verify that the command line has an appropriate number
-  // of arguments.
+// a byte count with an optional K, M or G suffix, or 0 if it is not one
+static uint64_t parseSize(const char *text) {
+  char *end;
+  uint64_t size = strtoull(text, &end, 0);
+  switch (*end) {
+  case 'G':
+    size <<= 10;
+    /* fall through */
+  case 'M':
+    size <<= 10;
+    /* fall through */
+  case 'K':
+    size <<= 10;
+    end++;
+    break;
+  }
+  return *end == '\0' ? size : 0;
+}
 
-  if (argc < 2 || argc > 4) {
-    fprintf(stderr,
-            "Usage: %s InputFilename [OutputFilename] [startingOffset]\n",
-            argv[0]);
-    return ERROR_RETURN;
+// Parse the command line into options. Returns 0, or -1 after printing
+// what was wrong.
+static int parseOptions(int argc, char **argv, Options *options) {
+  const char *value;
+
+  memset(options, 0, sizeof(*options));
+  options->format = "text";
+  options->print = printRecord;
+  options->cacheCapacity = CACHE_DEFAULT_CAPACITY;
+  options->maxSteps = EXEC_DEFAULT_STEPS;
+  options->positional = malloc((size_t)argc * sizeof(char *));
+  if (options->positional == NULL) {
+    fprintf(stderr, "Failed to allocate the argument list\n");
+    return -1;
   }
 
-  // First argument is the file to read, attempt to open it
-  // for reading and verify that the open did occur.
-  machineCode = fopen(argv[1], "rb");
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "-j", 2) == 0) {
+      value = optionValue(argc, argv, &i);
+      options->threads = value == NULL ? 0 : atoi(value);
+      if (options->threads < 1) {
+        fprintf(stderr, "-j needs a thread count of at least 1\n");
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      options->stream = 1;
+    } else if (strcmp(argv[i], "--recursive") == 0) {
+      options->recursive = 1;
+    } else if (strncmp(argv[i], "--cache-size", 12) == 0) {
+      value = longOptionValue(argc, argv, &i, "--cache-size");
+      options->cacheCapacity = value == NULL ? 0 : parseSize(value);
+      if (options->cacheCapacity == 0) {
+        fprintf(stderr, "--cache-size needs a size such as 512M\n");
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--cache", 7) == 0) {
+      options->cacheDir = longOptionValue(argc, argv, &i, "--cache");
+      if (options->cacheDir == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--format", 8) == 0) {
+      options->format = longOptionValue(argc, argv, &i, "--format");
+      options->print = recordPrinter(options->format);
+      if (options->print == NULL) {
+        fprintf(stderr, "--format must be text, ndjson or bin\n");
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--range", 7) == 0) {
+      options->range = longOptionValue(argc, argv, &i, "--range");
+      if (options->range == NULL ||
+          parseRange(options->range, &options->rangeStart,
+                     &options->rangeEnd) != 0) {
+        fprintf(stderr, "--range needs START-END, such as 0x100-0x200\n");
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--index", 7) == 0) {
+      options->indexPath = longOptionValue(argc, argv, &i, "--index");
+      if (options->indexPath == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--serve", 7) == 0) {
+      options->serve = longOptionValue(argc, argv, &i, "--serve");
+      if (options->serve == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--client", 8) == 0) {
+      options->client = longOptionValue(argc, argv, &i, "--client");
+      if (options->client == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--diff", 6) == 0) {
+      options->diff = longOptionValue(argc, argv, &i, "--diff");
+      if (options->diff == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options->stats = "text";
+    } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+      options->stats = argv[i] + 8;
+      if (strcmp(options->stats, "text") != 0 &&
+          strcmp(options->stats, "json") != 0) {
+        fprintf(stderr, "--stats must be text or json\n");
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--corpus") == 0) {
+      options->corpus = CORPUS_REFERENCES;
+    } else if (strcmp(argv[i], "--corpus=expand") == 0) {
+      options->corpus = CORPUS_EXPANDED;
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      options->watch = 1;
+    } else if (strcmp(argv[i], "--exec") == 0) {
+      options->exec = 1;
+    } else if (strcmp(argv[i], "--pipe") == 0) {
+      options->pipe = 1;
+    } else if (strncmp(argv[i], "--max-steps", 11) == 0) {
+      value = longOptionValue(argc, argv, &i, "--max-steps");
+      options->maxSteps = value == NULL ? 0 : strtoull(value, NULL, 0);
+      if (options->maxSteps == 0) {
+        fprintf(stderr, "--max-steps needs a count of at least 1\n");
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--annotate-hazards") == 0) {
+      options->hazards = 1;
+    } else if (strcmp(argv[i], "--optimise") == 0) {
+      options->optimise = 1;
+    } else if (strcmp(argv[i], "--xrefs") == 0) {
+      options->labels = 1;
+    } else if (strncmp(argv[i], "--xrefs-to", 10) == 0) {
+      options->xrefsTo = longOptionValue(argc, argv, &i, "--xrefs-to");
+      if (options->xrefsTo == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else if (strncmp(argv[i], "--batch", 7) == 0) {
+      options->batchDir = longOptionValue(argc, argv, &i, "--batch");
+      if (options->batchDir == NULL) {
+        printUsage(argv[0]);
+        return -1;
+      }
+    } else {
+      options->positional[options->positionalCount++] = argv[i];
+    }
+  }
 
-  if (machineCode == NULL) {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
-    return ERROR_RETURN;
+  if (options->stats != NULL &&
+      (options->batchDir != NULL || options->watch || options->recursive ||
+       options->labels || options->xrefsTo != NULL || options->exec ||
+       options->pipe || options->hazards || options->optimise ||
+       options->threads > 1 || options->cacheDir != NULL ||
+       options->range != NULL || options->diff != NULL)) {
+    fprintf(stderr, "--stats reports on the single-threaded plain listing "
+                    "only\n");
+    return -1;
   }
 
-  // Second argument is the file to write, attempt to open it for
-  // writing and verify that the open did occur. Use standard output
-  // if not provided.
-  outputFile = argc <= 2 ? stdout : fopen(argv[2], "w");
+  // the server takes requests instead of arguments
+  if (options->serve != NULL) {
+    if (options->positionalCount != 0 || options->client != NULL ||
+        options->batchDir != NULL || options->watch || options->stream ||
+        options->recursive || options->labels || options->xrefsTo != NULL ||
+        options->exec || options->pipe || options->hazards ||
+        options->optimise || options->range != NULL ||
+        options->indexPath != NULL || options->diff != NULL ||
+        options->cacheDir != NULL || options->stats != NULL ||
+        options->print != printRecord) {
+      fprintf(stderr, "--serve takes only -j and --cache-size; the rest "
+                      "comes with each request\n");
+      return -1;
+    }
+    return 0;
+  }
+  if (options->client != NULL &&
+      (options->batchDir != NULL || options->watch || options->stream ||
+       options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->exec || options->pipe || options->hazards ||
+       options->optimise || options->indexPath != NULL ||
+       options->diff != NULL || options->cacheDir != NULL ||
+       options->stats != NULL || options->threads > 0)) {
+    fprintf(stderr, "--client asks for the plain listing, or a --range of "
+                    "it, and takes no other mode\n");
+    return -1;
+  }
+  if (options->diff != NULL &&
+      (options->batchDir != NULL || options->watch || options->stream ||
+       options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->exec || options->pipe || options->hazards ||
+       options->optimise || options->range != NULL || options->threads > 1 ||
+       options->cacheDir != NULL || options->print != printRecord ||
+       (options->positionalCount > 0 &&
+        strcmp(options->positional[0], "-") == 0))) {
+    fprintf(stderr, "--diff compares the plain listings of two image files "
+                    "and takes no other mode\n");
+    return -1;
+  }
 
-  if (outputFile == NULL) {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[2], strerror(errno));
-    fclose(machineCode);
-    return ERROR_RETURN;
+  if (options->corpus != CORPUS_OFF && options->batchDir == NULL) {
+    fprintf(stderr, "--corpus shares segments between the files of a "
+                    "--batch\n");
+    return -1;
+  }
+
+  // batch mode takes any number of inputs (even none: the manifest is then
+  // read from standard input)
+  if (options->batchDir != NULL) {
+    return 0;
+  }
+
+  // Verify that the command line has an appropriate number
+  // of arguments.
+  if (options->positionalCount < 1 || options->positionalCount > 3) {
+    printUsage(argv[0]);
+    return -1;
+  }
+  options->inputName = options->positional[0];
+  options->outputName =
+      options->positionalCount > 1 ? options->positional[1] : NULL;
+
+  if ((options->hazards || options->optimise) &&
+      (options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->exec || options->pipe ||
+       (options->hazards && options->optimise))) {
+    fprintf(stderr, "--annotate-hazards and --optimise take no other "
+                    "listing mode\n");
+    return -1;
+  }
+  if ((options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->exec || options->pipe || options->hazards ||
+       options->optimise || options->range != NULL) &&
+      options->stream) {
+    fprintf(stderr, "--recursive, --xrefs, --exec, --pipe, "
+                    "--annotate-hazards, --optimise and --range need the "
+                    "whole image and cannot stream\n");
+    return -1;
+  }
+  if (options->range != NULL &&
+      (options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->exec || options->pipe || options->hazards ||
+       options->optimise || options->watch)) {
+    fprintf(stderr, "--range lists part of the plain listing only\n");
+    return -1;
+  }
+  if (options->stream && isObjectListing(options->inputName)) {
+    fprintf(stderr, "--stream reads .mem images; a .yo listing is parsed "
+                    "whole\n");
+    return -1;
+  }
+  if (options->indexPath != NULL && options->range == NULL) {
+    fprintf(stderr, "--index is only used with --range\n");
+    return -1;
+  }
+  if (options->print != printRecord &&
+      (options->recursive || options->labels || options->xrefsTo != NULL ||
+       options->watch || options->exec || options->pipe ||
+       options->hazards || options->optimise)) {
+    fprintf(stderr, "--format=%s covers the plain listing only\n",
+            options->format);
+    return -1;
+  }
+  if (options->watch &&
+      (options->outputName == NULL || options->stream || options->recursive ||
+       options->labels || options->xrefsTo != NULL || options->exec ||
+       options->pipe || options->hazards || options->optimise ||
+       options->threads > 1 ||
+       strcmp(options->inputName, "-") == 0)) {
+    fprintf(stderr, "--watch needs an input and an output file and takes "
+                    "no other mode\n");
+    return -1;
   }
 
   // If there is a 3rd argument present it is an offset so convert it
   // to a numeric value.
-  if (4 == argc) {
+  if (options->positionalCount > 2) {
     errno = 0;
-    currAddr = strtol(argv[3], NULL, 0);
+    options->startingOffset = strtol(options->positional[2], NULL, 0);
     if (errno != 0) {
       perror("Invalid offset on command line");
-      fclose(machineCode);
-      fclose(outputFile);
-      return ERROR_RETURN;
+      return -1;
     }
   }
+  return 0;
+}
 
-  fprintf(stderr, "Opened %s, starting offset 0x%lX\n", argv[1], currAddr);
-  fprintf(stderr, "Saving output to %s\n",
-          argc <= 2 ? "standard output" : argv[2]);
+// whether the input has to be read as a stream: standard input, pipes and
+// devices cannot be mapped, and reading them whole would cost as much memory
+// as the input is long. A compressed file is streamed too, so it is inflated
+// while it is decoded, unless -j or --cache want the whole image.
+static int isStreamInput(const Options *options) {
+  struct stat info;
+  if (options->stream || strcmp(options->inputName, "-") == 0) {
+    return 1;
+  }
+  // a .yo listing is text, parsed whole into the image it describes
+  if (isObjectListing(options->inputName)) {
+    return 0;
+  }
+  if (stat(options->inputName, &info) != 0) {
+    return 0;
+  }
+  return !S_ISREG(info.st_mode) ||
+         (options->threads <= 1 && options->cacheDir == NULL &&
+          isCompressedFile(options->inputName));
+}
 
-  /**
-   * Set the address to the offset in the stream, then get the first byte of the
-   * stream. Call getFirstNonZero to jump ahead to the first real instruction.
-   **/
-  fseek(machineCode, currAddr, SEEK_SET);
-  currInstr = fgetc(machineCode);
-  int isFirstPosFlag = 1;
-  getFirstNonZero(machineCode, &currAddr, &currInstr, outputFile,
-                  isFirstPosFlag);
+// print every jXX and call that branches to target, one per line, from the
+// index of the sweep from startingOffset.
+static int listXrefsTo(const uint8_t *machineCode, size_t length,
+                       long startingOffset, uint64_t target,
+                       OutputSink *outputFile) {
+  XrefIndex index;
+  initXrefIndex(&index);
+  if (indexBranches(machineCode, length, startingOffset, &index, NULL) != 0) {
+    freeXrefIndex(&index);
+    return -1;
+  }
 
-  while (1) {
-    if (feof(machineCode)) {
-      break;
-    }
-    // continue to validate instructions until you hit the end of the file
-    // stream
-    validateInstr(machineCode, &currAddr, &currInstr, nextBytes, outputFile);
+  const XrefEntry *entry = findXrefs(&index, target);
+  fprintf(stderr, "%u branches to 0x%llx, %u of them calls\n",
+          entry == NULL ? 0 : entry->count, (unsigned long long)target,
+          entry == NULL ? 0 : entry->callCount);
+  for (uint32_t i = entry == NULL ? XREF_NONE : entry->firstSite;
+       i != XREF_NONE; i = index.sites[i].next) {
+    const XrefSite *site = &index.sites[i];
+    char *start = reserveOutput(outputFile, MAX_RECORD_TEXT);
+    char *dst = start;
+    *dst++ = '0';
+    *dst++ = 'x';
+    dst += formatHex(dst, site->address);
+    *dst++ = ' ';
+    const char *mnemonic = opcodeTable[site->icode << 4 | site->ifun].mnemonic;
+    memcpy(dst, mnemonic, strlen(mnemonic));
+    dst += strlen(mnemonic);
+    *dst++ = '\n';
+    commitOutput(outputFile, dst);
   }
+  freeXrefIndex(&index);
+  return 0;
+}
 
-  // free the memory allocated for nextBytes, close the read file, close the
-  // write file.
-  free(nextBytes);
-  fclose(machineCode);
-  fclose(outputFile);
+// print how the listing of image differs from that of the old image named
+// by --diff.
+static int diffImage(const Options *options, const MachineImage *image,
+                     OutputSink *outputFile) {
+  MachineImage oldImage;
+  if (openMachineImage(options->diff, &oldImage) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", options->diff,
+            strerror(errno));
+    return ERROR_RETURN;
+  }
+  long hunks = diffImages(oldImage.bytes, oldImage.length, image->bytes,
+                          image->length, options->startingOffset,
+                          options->diff, options->inputName, outputFile);
+  closeMachineImage(&oldImage);
+  if (hunks < 0) {
+    fprintf(stderr, "Diff failed: out of memory\n");
+    return ERROR_RETURN;
+  }
+  fprintf(stderr, "%ld hunks differ from %s\n", hunks, options->diff);
   return SUCCESS;
 }
 
-// forwards throught the byte stream until it sees the first non-zero
-// byte. Updates the currInstr with the new instruction and currAddr
-// with the address of the instruction.
-// Breaks if it hits the end of file.
-void getFirstNonZero(FILE *machineCode, long *currAddr, int *currInstr,
-                     FILE *outputFile, int isFirstPosFlag) {
-  if (*currInstr > 0) {
-    // *currAddr = ftell(machineCode);
-    return;
-  } else {
-    while (*currInstr == 0) {
-      if (feof(machineCode)) {
-        break;
-      }
-      *currAddr = ftell(machineCode);
-      *currInstr = fgetc(machineCode);
+// run whichever mode options ask for over the whole image. Returns 0, or
+// -1 after printing what went wrong.
+static int disassembleImage(const Options *options, const MachineImage *image,
+                            OutputSink *outputFile) {
+  if (options->print == printRecordBinary) {
+    printBinaryHeader(outputFile, (uint64_t)options->startingOffset);
+  }
+  if (options->pipe) {
+    // the starting offset is the entry point and where the listing starts
+    if (simulatePipeline(image->bytes, image->length, options->startingOffset,
+                         options->maxSteps, outputFile) != 0) {
+      fprintf(stderr, "Pipeline simulation failed: out of memory\n");
+      return ERROR_RETURN;
     }
-    if (*currInstr > 0) {
-      printPos(outputFile, *currAddr, isFirstPosFlag);
-      return;
+  } else if (options->exec) {
+    // the starting offset is the entry point
+    if (executeImage(image->bytes, image->length, options->startingOffset,
+                     options->maxSteps, outputFile) != 0) {
+      fprintf(stderr, "Execution failed: out of memory\n");
+      return ERROR_RETURN;
     }
+  } else if (options->xrefsTo != NULL) {
+    if (listXrefsTo(image->bytes, image->length, options->startingOffset,
+                    strtoull(options->xrefsTo, NULL, 0), outputFile) != 0) {
+      fprintf(stderr, "Cross-referencing failed: out of memory\n");
+      return ERROR_RETURN;
+    }
+  } else if (options->recursive) {
+    // the starting offset is the entry point
+    if (disassembleRecursive(image->bytes, image->length,
+                             options->startingOffset, options->labels,
+                             outputFile) != 0) {
+      fprintf(stderr, "Recursive disassembly failed: out of memory\n");
+      return ERROR_RETURN;
+    }
+  } else if (options->optimise) {
+    // the starting offset is the entry point
+    if (optimiseImage(image->bytes, image->length, options->startingOffset,
+                      outputFile) != 0) {
+      fprintf(stderr, "Optimisation failed: out of memory\n");
+      return ERROR_RETURN;
+    }
+  } else if (options->hazards) {
+    annotateHazards(image->bytes, image->length, options->startingOffset,
+                    outputFile);
+  } else if (options->diff != NULL) {
+    return diffImage(options, image, outputFile);
+  } else if (options->range != NULL) {
+    uint64_t sweptFrom;
+    if (disassembleRange(image->bytes, image->length, options->startingOffset,
+                         options->rangeStart, options->rangeEnd,
+                         options->inputName, options->indexPath,
+                         options->print, outputFile, &sweptFrom) != 0) {
+      fprintf(stderr, "Failed to use index %s: %s\n", options->indexPath,
+              strerror(errno));
+      return ERROR_RETURN;
+    }
+    fprintf(stderr, "Listing 0x%llx-0x%llx from 0x%llx\n",
+            (unsigned long long)options->rangeStart,
+            (unsigned long long)options->rangeEnd,
+            (unsigned long long)sweptFrom);
+  } else if (options->labels) {
+    if (disassembleLabelled(image->bytes, image->length,
+                            options->startingOffset, outputFile) != 0) {
+      fprintf(stderr, "Labelled disassembly failed: out of memory\n");
+      return ERROR_RETURN;
+    }
+  } else if (options->threads > 1) {
+    if (disassembleParallel(image->bytes, image->length,
+                            options->startingOffset, options->threads,
+                            options->print, outputFile) != 0) {
+      fprintf(stderr, "Parallel disassembly failed: out of memory\n");
+      return ERROR_RETURN;
+    }
+  } else {
+    disassemble(image->bytes, image->length, options->startingOffset,
+                options->print, outputFile, outputFile->stats);
   }
-  return;
-}
-
-// gets the necessary bytes for a given icode and stores them into nextBytes.
-void getNextBytes(FILE *machineCode, int bytes, long *currAddr,
-                  int *nextBytes) {
-  for (int i = 0; i < bytes; i++) {
-    nextBytes[i] = fgetc(machineCode);
-  }
-  return;
+  return SUCCESS;
 }
 
-/**
- * In validateInstr() we switch cases based on the bigNibble. This is the
- * most-significant half-byte of the current instruction, and corresponds to the
- * instruction iCode. From each case we call a corresponding iCode Handler to
- * further validate the instruction, checking the littleByte and additional
- * values.
- *
- * After the handlers return we call ftell() to update the current address, and
- * fgetc to advance to the next instruction.
- **/
-void validateInstr(FILE *machineCode, long *currAddr, int *currInstr,
-                   int *nextBytes, FILE *outputFile) {
-  int bigNibble = *currInstr & 0xF0;
-  int littleNibble = *currInstr & 0x0F;
-
-  switch (bigNibble) {
-  case 0x00:
-    haltHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    *currAddr = ftell(machineCode);
-    *currInstr = fgetc(machineCode);
-    getFirstNonZero(machineCode, currAddr, currInstr, outputFile, 0);
-    return;
-    // in 0x00 we return early because we do not want to call ftell and fgetc
-    // again. we update the address and instruction and hand off to
-    // getFirstNonZero() to get the next valid instruction/value.
-  case 0x10:
-    nopHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x20:
-    switch (littleNibble) {
-    case 0x0:
-      rrMovQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-      break;
-    default:
-      cMovHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-      break;
+// the name the cache files the listing options ask for under, at most
+// "recursive-xrefs-hazards-ndjson-range-START-END" with 16-digit addresses,
+// which fits CACHE_NAME_TEXT. -j gives the same listing as a single thread,
+// so it is not part of the name.
+static void formatName(const Options *options, char *name, size_t size) {
+  if (options->exec || options->pipe) {
+    snprintf(name, size, "%s-%llu", options->pipe ? "pipe" : "exec",
+             (unsigned long long)options->maxSteps);
+  } else if (options->optimise) {
+    snprintf(name, size, "optimise");
+  } else if (options->xrefsTo != NULL) {
+    snprintf(name, size, "xrefs-to-%llx",
+             (unsigned long long)strtoull(options->xrefsTo, NULL, 0));
+  } else {
+    char range[48] = "";
+    if (options->range != NULL) {
+      snprintf(range, sizeof(range), "-range-%llx-%llx",
+               (unsigned long long)options->rangeStart,
+               (unsigned long long)options->rangeEnd);
     }
-    break;
-  case 0x30:
-    irMovQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x40:
-    rmMovQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x50:
-    mrMovQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x60:
-    OpQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x70:
-    jmpHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x80:
-    callHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0x90:
-    retHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0xA0:
-    pushQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  case 0xB0:
-    popQHandler(machineCode, littleNibble, nextBytes, currAddr, outputFile);
-    break;
-  default:
-    break;
+    snprintf(name, size, "%s%s%s%s%s%s",
+             options->recursive ? "recursive" : "sweep",
+             options->labels ? "-xrefs" : "",
+             options->hazards ? "-hazards" : "",
+             options->print == printRecord ? "" : "-",
+             options->print == printRecord ? "" : options->format, range);
   }
-  /**
-   * update the address and get the next instruction from the
-   * byte stream. store both into their corresponding values.
-   * validateInstr() will be called again as long as it has not hit the
-   * end of the file.
-   **/
-  *currAddr = ftell(machineCode);
-  *currInstr = fgetc(machineCode);
-  return;
 }
 
 /**
- * iCode Handlers
- *
- * Each handler is responsible for validating the bytes and half-bytes
- * associated with each instruction. Each handler will fetch the necessary
- * number of new bytes for a given instruction (most often 1 byte for rA and
- * rB), and check that the littleNibble and next byte are valid for a given
- * iCode.
- *
- * If the next bytes are not valid for the given instruction, the handlers will
- * call getNextBytes to fetch enough bytes to try and read a quad and call
- * invalidInstr(), passing it the bigNibble and littleNibble, additional bytes,
- * etc.
- *
- * Typical scenario:
- *  1 byte (currInstr) is represented as bigNibble & littleNibble. These are the
- *  half-bytes of the current instruction. 1 byte = n1 and n2; the half-bytes of
- *  the next instruction. In the case of an invalid instruction we'll fetch
- *  enough bytes so that the total is 8.
+ * Serve the listing from the cache when it holds one for this image and
+ * these options. Otherwise disassemble into a new cache entry, copy that to
+ * the output and only then put the entry in place, so eviction can never
+ * take it away first.
  **/
-
-// IRMOVQ
-void irMovQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                   long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-
-  if (littleNibble != 0 || n1 != 0xF0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 3, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 8, address, nextBytes);
-    printIRMovQ(outputFile, registerTwo(n2), 3, littleNibble, nextBytes, 8);
+static int disassembleCached(const Options *options, const MachineImage *image,
+                             int outputFd) {
+  DisasmCache cache;
+  char format[CACHE_NAME_TEXT];
+  char key[CACHE_KEY_TEXT];
+  char tempPath[CACHE_PATH_TEXT];
+  uint64_t hits;
+  uint64_t misses;
+  OutputSink entry;
+
+  if (openCache(&cache, options->cacheDir, options->cacheCapacity) != 0) {
+    fprintf(stderr, "Failed to open cache %s: %s\n", options->cacheDir,
+            strerror(errno));
+    return ERROR_RETURN;
   }
-}
-
-// RMMOVQ
-void rmMovQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                   long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-
-  if (littleNibble != 0 || n1 > 0xE0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 4, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 8, address, nextBytes);
-    printRMMovQ(outputFile, registerOne(n1), registerTwo(n2), 4, littleNibble,
-                nextBytes, 8);
+  formatName(options, format, sizeof(format));
+  cacheKey(key, image->bytes, image->length, options->startingOffset, format);
+
+  int hit = fetchCacheEntry(&cache, key, outputFd);
+  if (hit < 0) {
+    fprintf(stderr, "Failed to copy cache entry %s: %s\n", key,
+            strerror(errno));
+    closeCache(&cache);
+    return ERROR_RETURN;
   }
-}
-
-// MROVQ
-void mrMovQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                   long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-
-  if (littleNibble != 0 || n1 > 0xE0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 5, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 8, address, nextBytes);
-    printMRMovQ(outputFile, registerTwo(n2), registerOne(n1), 5, littleNibble,
-                nextBytes, 8);
+  if (countCacheLookup(&cache, hit, &hits, &misses) == 0) {
+    fprintf(stderr, "Cache %s for %s (%llu hits, %llu misses)\n",
+            hit ? "hit" : "miss", key, (unsigned long long)hits,
+            (unsigned long long)misses);
   }
-}
-
-// OPQ (arithmatic instrs)
-void OpQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-
-  if (littleNibble > 0x6 || n1 > 0xE0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 6, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    printOpQ(outputFile, arithmInstruction(littleNibble), registerOne(n1),
-             registerTwo(n2), 6, littleNibble, nextBytes, 1);
+  if (hit) {
+    closeCache(&cache);
+    return SUCCESS;
   }
-}
 
-// JMPXX
-void jmpHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                long *address, FILE *outputFile) {
-  if (littleNibble > 0x6) {
-    getNextBytes(machineCode, 7, address, nextBytes);
-    invalidInstr(machineCode, 7, littleNibble, nextBytes, address, -1, -1,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 8, address, nextBytes);
-    printJXX(outputFile, jmpInstruction(littleNibble), 7, littleNibble,
-             nextBytes, 8);
+  int fd = createCacheEntry(&cache, tempPath);
+  if (fd < 0 || openOutputSink(&entry, fd, OUTPUT_SINK_CAPACITY) != 0) {
+    fprintf(stderr, "Failed to create cache entry in %s: %s\n",
+            options->cacheDir, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+      unlink(tempPath);
+    }
+    closeCache(&cache);
+    return ERROR_RETURN;
   }
-}
-
-// CMOVXX
-void cMovHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                 long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-  if (littleNibble > 0x6 || n1 > 0xE0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 2, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    printCMovXX(outputFile, cmovInstruction(littleNibble), registerOne(n1),
-                registerTwo(n2), 2, littleNibble, nextBytes, 1);
+  int res = disassembleImage(options, image, &entry);
+  if (closeOutputSink(&entry) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", tempPath, strerror(errno));
+    res = ERROR_RETURN;
   }
-}
-
-// RRMOVQ
-void rrMovQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                   long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-  if (littleNibble != 0x0 || n1 > 0xE0 || n2 > 0xE) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 2, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    printRRMovQ(outputFile, registerOne(n1), registerTwo(n2), 2, littleNibble,
-                nextBytes, 1);
+  if (res == SUCCESS && copyFile(fd, outputFd) != 0) {
+    fprintf(stderr, "Failed to write the listing: %s\n", strerror(errno));
+    res = ERROR_RETURN;
   }
-}
-
-// CALLXX
-void callHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                 long *address, FILE *outputFile) {
-  if (littleNibble != 0x0) {
-    getNextBytes(machineCode, 7, address, nextBytes);
-    invalidInstr(machineCode, 8, littleNibble, nextBytes, address, -1, -1,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 8, address, nextBytes);
-    printCall(outputFile, 8, littleNibble, nextBytes, 8);
+  close(fd);
+  if (res != SUCCESS) {
+    unlink(tempPath);
+  } else if (commitCacheEntry(&cache, tempPath, key) != 0) {
+    // the listing is out; only the next run misses out
+    fprintf(stderr, "Failed to store cache entry %s: %s\n", key,
+            strerror(errno));
   }
+  closeCache(&cache);
+  return res;
 }
 
-// PUSHQ
-void pushQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                  long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-  if (littleNibble != 0x0 || n1 > 0xE0 || n2 != 0x0F) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 0xa, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    printPushQ(outputFile, registerOne(n1), 0xA, littleNibble, nextBytes, 1);
+// have the server at options->client list the input to the output file
+static int askServer(const Options *options) {
+  int outputFd = options->outputName == NULL
+                     ? STDOUT_FILENO
+                     : open(options->outputName, O_WRONLY | O_CREAT | O_TRUNC,
+                            0666);
+  if (outputFd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", options->outputName,
+            strerror(errno));
+    return ERROR_RETURN;
   }
+  int res = requestListing(options->client, options->inputName,
+                           options->startingOffset, options->format,
+                           options->range, outputFd);
+  if (outputFd != STDOUT_FILENO) {
+    close(outputFd);
+  }
+  return res == 0 ? SUCCESS : ERROR_RETURN;
 }
 
-// POPQ
-void popQHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                 long *address, FILE *outputFile) {
-  getNextBytes(machineCode, 1, address, nextBytes);
-  int n1 = nextBytes[0] & 0xF0;
-  int n2 = nextBytes[0] & 0x0F;
-  if (littleNibble != 0x0 || n1 > 0xE0 || n2 != 0x0F) {
-    getNextBytes(machineCode, 6, address, nextBytes);
-    invalidInstr(machineCode, 0xb, littleNibble, nextBytes, address, n1, n2,
-                 outputFile);
-    return;
-  } else {
-    printPopQ(outputFile, registerOne(n1), 0xB, littleNibble, nextBytes, 1);
+// release whichever input main() opened
+static void closeInput(MachineImage *image, int inputFd) {
+  closeMachineImage(image);
+  if (inputFd >= 0 && inputFd != STDIN_FILENO) {
+    close(inputFd);
   }
 }
 
-// RET
-void retHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                long *address, FILE *outputFile) {
-  if (littleNibble != 0x0) {
-    getNextBytes(machineCode, 7, address, nextBytes);
-    invalidInstr(machineCode, 9, littleNibble, nextBytes, address, -1, -1,
-                 outputFile);
-    return;
-  } else {
-    printRet(outputFile);
+int main(int argc, char **argv) {
+
+  Options options;
+  MachineImage image;
+  OutputSink outputFile;
+  RunStats stats;
+  RunStats *runStats = NULL; // set with --stats
+  int inputFd = -1;
+  int outputFd;
+
+  if (parseOptions(argc, argv, &options) != 0) {
+    free(options.positional);
+    return ERROR_RETURN;
+  }
+  if (options.batchDir != NULL) {
+    // by default batch mode keeps every processor busy
+    int threads = options.threads > 0 ? options.threads : processorCount();
+    int res = disassembleBatch(options.batchDir, options.positional,
+                               options.positionalCount, threads,
+                               options.corpus);
+    free(options.positional);
+    return res == 0 ? SUCCESS : ERROR_RETURN;
+  }
+  free(options.positional);
+  if (options.serve != NULL) {
+    // by default the server keeps every processor busy
+    int threads = options.threads > 0 ? options.threads : processorCount();
+    return serveListings(options.serve, threads, options.cacheCapacity) == 0
+               ? SUCCESS
+               : ERROR_RETURN;
+  }
+  if (options.client != NULL) {
+    return askServer(&options);
+  }
+  if (options.watch) {
+    return watchAndDisassemble(options.inputName, options.outputName,
+                               options.startingOffset) == 0
+               ? SUCCESS
+               : ERROR_RETURN;
+  }
+  const char *outputName =
+      options.outputName == NULL ? "standard output" : options.outputName;
+  if (options.stats != NULL) {
+    startStats(&stats);
+    runStats = &stats;
   }
-}
 
-// HALT
-void haltHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                 long *address, FILE *outputFile) {
-  if (littleNibble != 0x0) {
-    getNextBytes(machineCode, 7, address, nextBytes);
-    invalidInstr(machineCode, 0, littleNibble, nextBytes, address, -1, -1,
-                 outputFile);
-    return;
-  } else {
-    getNextBytes(machineCode, 1, address, nextBytes);
-    printHalt(outputFile, nextBytes, address);
+  // First argument is the file to read, attempt to map it into memory
+  // (or open it as a stream) and verify that the load did occur.
+  if (isStreamInput(&options) && !options.recursive && !options.labels &&
+      options.xrefsTo == NULL && !options.exec && !options.pipe &&
+      !options.hazards && !options.optimise && options.range == NULL &&
+      options.diff == NULL) {
+    memset(&image, 0, sizeof(image));
+    inputFd = strcmp(options.inputName, "-") == 0
+                  ? STDIN_FILENO
+                  : open(options.inputName, O_RDONLY);
+    if (inputFd < 0) {
+      fprintf(stderr, "Failed to open %s: %s\n", options.inputName,
+              strerror(errno));
+      return ERROR_RETURN;
+    }
+  } else if (openMachineImage(options.inputName, &image) != 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", options.inputName,
+            strerror(errno));
+    return ERROR_RETURN;
+  }
+  if (runStats != NULL) {
+    // a stream counts its bytes as they arrive
+    if (inputFd < 0 && (size_t)options.startingOffset < image.length) {
+      stats.bytesIn = image.length - (size_t)options.startingOffset;
+    }
+    chargeStats(runStats, PHASE_READ);
   }
-}
 
-// NOP
-void nopHandler(FILE *machineCode, int littleNibble, int *nextBytes,
-                long *address, FILE *outputFile) {
-  if (littleNibble != 0x0) {
-    getNextBytes(machineCode, 7, address, nextBytes);
-    invalidInstr(machineCode, 1, littleNibble, nextBytes, address, -1, -1,
-                 outputFile);
-    return;
-  } else {
-    printNop(outputFile);
+  // Second argument is the file to write, attempt to open it for
+  // writing and verify that the open did occur. Use standard output
+  // if not provided.
+  outputFd = options.outputName == NULL
+                 ? STDOUT_FILENO
+                 : open(options.outputName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  if (outputFd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", outputName, strerror(errno));
+    closeInput(&image, inputFd);
+    return ERROR_RETURN;
+  }
+  if (openOutputSink(&outputFile, outputFd, OUTPUT_SINK_CAPACITY) != 0) {
+    fprintf(stderr, "Failed to allocate output buffer\n");
+    closeInput(&image, inputFd);
+    close(outputFd);
+    return ERROR_RETURN;
+  }
+  if (runStats != NULL) {
+    outputFile.stats = runStats;
+    chargeStats(runStats, PHASE_WRITE);
   }
-}
 
-// check if the starting address % 8 is zero. If it is, try and read a quad
-// otherwise print a byte, then read the next instruction.
-void invalidInstr(FILE *machineCode, int bigNibble, int littleNibble,
-                  int *nextBytes, long *address, int n1, int n2,
-                  FILE *outputFile) {
-  int quad = 0;
-  if (*address % 8 == 0) {
-    if (feof(machineCode)) {
-      quad = 0;
-    } else {
-      quad = 1;
+  fprintf(stderr, "Opened %s, starting offset 0x%lX\n", options.inputName,
+          options.startingOffset);
+  fprintf(stderr, "Saving output to %s\n", outputName);
+
+  int res = SUCCESS;
+  if (inputFd >= 0) {
+    if (options.cacheDir != NULL) {
+      fprintf(stderr, "Not caching %s: a stream is read only once\n",
+              options.inputName);
+    }
+    // a stream is always swept on this thread: -j needs the whole image
+    if (options.print == printRecordBinary) {
+      printBinaryHeader(&outputFile, (uint64_t)options.startingOffset);
     }
-    if (quad) {
-      printQuad(outputFile, bigNibble, littleNibble, n1, n2, nextBytes);
+    if (disassembleStream(inputFd, options.startingOffset, options.print,
+                          &outputFile, runStats) != 0) {
+      fprintf(stderr, "Failed to read %s: %s\n", options.inputName,
+              strerror(errno));
+      res = ERROR_RETURN;
     }
+  } else if (options.cacheDir != NULL) {
+    res = disassembleCached(&options, &image, outputFd);
   } else {
-    printByte(outputFile, bigNibble, littleNibble);
+    res = disassembleImage(&options, &image, &outputFile);
   }
-}
 
-// return the corresponding arithmatic operator
-char *arithmInstruction(int instruction) {
-  switch (instruction) {
-  case 0:
-    return "addq";
-  case 1:
-    return "subq";
-  case 2:
-    return "andq";
-  case 3:
-    return "xorq";
-  case 4:
-    return "mulq";
-  case 5:
-    return "divq";
-  case 6:
-    return "modq";
-  default:
-    return "";
+  // release the image, flush and close the write file.
+  closeInput(&image, inputFd);
+  if (closeOutputSink(&outputFile) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", outputName, strerror(errno));
+    res = ERROR_RETURN;
   }
+  if (outputFd != STDOUT_FILENO) {
+    close(outputFd);
+  }
+  if (runStats != NULL) {
+    stats.bytesOut = outputFile.bytesWritten;
+    reportStats(runStats, strcmp(options.stats, "json") == 0);
+  }
+  return res;
 }
 
-// return corresponding conditional jump instruction
-char *jmpInstruction(int instruction) {
-  switch (instruction) {
-  case 0:
-    return "jmp";
-  case 1:
-    return "jle";
-  case 2:
-    return "jl";
-  case 3:
-    return "je";
-  case 4:
-    return "jne";
-  case 5:
-    return "jge";
-  case 6:
-    return "jg";
-  default:
-    return "";
+/**
+ * Sweep the image from startingOffset to its end, printing each decoded
+ * record as it comes back from the decoder. Records are decoded in batches
+ * so the decoder runs in a tight loop over the image.
+ **/
+void disassemble(const uint8_t *machineCode, size_t length,
+                 long startingOffset, RecordPrinter print,
+                 OutputSink *outputFile, RunStats *stats) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  size_t count;
+  int isFirstPosFlag = 1;
+
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    if (stats != NULL) {
+      countRecords(stats, records, count);
+      chargeStats(stats, PHASE_DECODE);
+    }
+    for (size_t i = 0; i < count; i++) {
+      print(outputFile, &records[i], isFirstPosFlag);
+      isFirstPosFlag = 0;
+    }
+    if (stats != NULL) {
+      chargeStats(stats, PHASE_FORMAT);
+    }
   }
 }
 
-// return the corresponding conditional move instruction
-char *cmovInstruction(int instruction) {
-  switch (instruction) {
-  case 1:
-    return "cmovle";
-  case 2:
-    return "cmovl";
-  case 3:
-    return "cmove";
-  case 4:
-    return "cmovne";
-  case 5:
-    return "cmovge";
-  case 6:
-    return "cmovg";
-  default:
-    return "";
-  }
+static int isMarked(const uint8_t *bitmap, uint64_t address, size_t length) {
+  return address < length && (bitmap[address / 8] >> address % 8) & 1;
 }
 
-// return the corresponding register for r1
-// (we can simplify this by bitshifting r1, but not a priority right now)
-char *registerOne(int registerNumber) {
-  switch (registerNumber) {
-  case 0x0:
-    return "%rax";
-  case 0x10:
-    return "%rcx";
-  case 0x20:
-    return "%rdx";
-  case 0x30:
-    return "%rbx";
-  case 0x40:
-    return "%rsp";
-  case 0x50:
-    return "%rbp";
-  case 0x60:
-    return "%rsi";
-  case 0x70:
-    return "%rdi";
-  case 0x80:
-    return "%r8";
-  case 0x90:
-    return "%r9";
-  case 0xA0:
-    return "%r10";
-  case 0xB0:
-    return "%r11";
-  case 0xC0:
-    return "%r12";
-  case 0xD0:
-    return "%r13";
-  case 0xE0:
-    return "%r14";
-  default:
-    return "";
+/**
+ * The labelled listing takes two sweeps. The first builds the
+ * cross-reference index and notes where each line starts; the second prints
+ * the listing, putting a label line before every line something branches
+ * to and naming such destinations by their label. A bitmap of the
+ * destinations inside the image saves the second sweep a hash lookup for
+ * every line.
+ **/
+int disassembleLabelled(const uint8_t *machineCode, size_t length,
+                        long startingOffset, OutputSink *outputFile) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  XrefIndex index;
+  size_t count;
+  int isFirstPosFlag = 1;
+
+  uint8_t *lineStarts = calloc(length / 8 + 1, 1);
+  uint8_t *targets = calloc(length / 8 + 1, 1);
+  initXrefIndex(&index);
+  if (lineStarts == NULL || targets == NULL ||
+      indexBranches(machineCode, length, startingOffset, &index,
+                    lineStarts) != 0) {
+    free(lineStarts);
+    free(targets);
+    freeXrefIndex(&index);
+    return -1;
+  }
+  for (size_t i = 0; i < index.capacity; i++) {
+    uint64_t target = index.entries[i].target;
+    if (index.entries[i].count != 0 && target < length) {
+      targets[target / 8] |= (uint8_t)(1 << target % 8);
+    }
   }
-}
 
-// return the corresponding register for r2
-// (again the bitshifting comment. can be simplified - not a priority)
-char *registerTwo(int registerNumber) {
-  switch (registerNumber) {
-  case 0x0:
-    return "%rax";
-  case 0x1:
-    return "%rcx";
-  case 0x2:
-    return "%rdx";
-  case 0x3:
-    return "%rbx";
-  case 0x4:
-    return "%rsp";
-  case 0x5:
-    return "%rbp";
-  case 0x6:
-    return "%rsi";
-  case 0x7:
-    return "%rdi";
-  case 0x8:
-    return "%r8";
-  case 0x9:
-    return "%r9";
-  case 0xA:
-    return "%r10";
-  case 0xB:
-    return "%r11";
-  case 0xC:
-    return "%r12";
-  case 0xD:
-    return "%r13";
-  case 0xE:
-    return "%r14";
-  default:
-    return "";
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const Y86Instruction *insn = &records[i];
+      if (isMarked(targets, insn->address, length) &&
+          isMarked(lineStarts, insn->address, length)) {
+        printLabel(outputFile, &index, findXrefs(&index, insn->address));
+      }
+      if (insn->kind == Y86_CODE && (insn->icode == 7 || insn->icode == 8) &&
+          isMarked(lineStarts, insn->immediate, length)) {
+        printBranchToLabel(outputFile, insn);
+      } else {
+        printRecord(outputFile, insn, isFirstPosFlag);
+      }
+      isFirstPosFlag = 0;
+    }
   }
+  free(lineStarts);
+  free(targets);
+  freeXrefIndex(&index);
+  return 0;
 }
@@ -0,0 +1,591 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "emulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decoder.h"
+#include "opcodeTable.h"
+#include "zeroScan.h"
+
+/*
+  Y86-64 emulator.
+
+  Every instruction is decoded once, by the decoder's own validateInstr(),
+  the first time the PC reaches it. The result is kept as an ExecOp holding
+  the address of the code that runs it, its operands and the address of the
+  next instruction, and a table indexed by address finds the op for a PC.
+  The run loop then jumps straight from one op's code to the next op's code
+  (computed goto, a GNU C extension) without decoding or switching on the
+  icode again.
+
+  A store into bytes that a predecoded instruction was read from drops
+  every op that could overlap them, so self-modifying code is decoded again
+  the next time it runs. A bitmap of the bytes ops were decoded from keeps
+  that check to a load on ordinary stores.
+*/
+
+enum { STAT_AOK = 1, STAT_HLT, STAT_ADR, STAT_INS };
+
+static const char *const statusNames[] = {"", "AOK", "HLT", "ADR", "INS"};
+
+#define RSP 4
+
+typedef struct {
+  const void *handler; // where the run loop executes this instruction
+  uint64_t valC;       // immediate, displacement or destination; the next
+                       // free op while the op is unused
+  uint64_t valP;       // address of the following instruction
+  uint8_t instr;       // icode << 4 | ifun
+  uint8_t rA;
+  uint8_t rB;
+} ExecOp;
+
+typedef struct {
+  uint8_t *memory;
+  size_t size;
+  uint32_t *slots;   // per address, 1 + the index of its op, or 0
+  uint8_t *codeBits; // per byte, whether an op was decoded from it
+  ExecOp *ops;
+  size_t opCount;
+  size_t opCapacity;
+  uint32_t freeOps; // 1 + the index of the first unused op, or 0
+
+  uint64_t registers[16];
+  uint64_t pc;
+  int zf;
+  int sf;
+  int of;
+  int status;
+  uint64_t steps;
+  uint64_t predecoded;
+  uint64_t invalidated;
+
+  StepObserver observer; // NULL unless the run is traced
+  void *context;
+} Machine;
+
+static uint64_t loadWord(const uint8_t *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static int readWord(const Machine *m, uint64_t address, uint64_t *value) {
+  if (address > m->size - 8) {
+    return -1;
+  }
+  *value = loadWord(m->memory + address);
+  return 0;
+}
+
+// drop every op that could include a byte of [address, address + 8): an
+// instruction is at most 10 bytes, so those starting up to 9 bytes before.
+static void invalidate(Machine *m, uint64_t address) {
+  uint64_t from = address < 9 ? 0 : address - 9;
+  for (uint64_t a = from; a < address + 8; a++) {
+    uint32_t slot = m->slots[a];
+    if (slot != 0) {
+      m->ops[slot - 1].valC = m->freeOps;
+      m->freeOps = slot;
+      m->slots[a] = 0;
+      m->invalidated++;
+    }
+  }
+}
+
+static int writeWord(Machine *m, uint64_t address, uint64_t value) {
+  if (address > m->size - 8) {
+    return -1;
+  }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  memcpy(m->memory + address, &value, sizeof(value));
+  // the 8 bytes span at most two bitmap bytes
+  if (m->codeBits[address / 8] | m->codeBits[(address + 7) / 8]) {
+    invalidate(m, address);
+  }
+  return 0;
+}
+
+/**
+ * Decode the instruction at the PC into an op for the run loop, whose code
+ * for each first byte is in handlers. Returns 1 + the op's index, or 0 with
+ * the status set when the PC is outside memory, the instruction runs off
+ * the end of memory or the decoder finds it invalid.
+ **/
+static uint32_t predecode(Machine *m, const void *const *handlers) {
+  uint64_t pc = m->pc;
+  if (pc >= m->size) {
+    m->status = STAT_ADR;
+    return 0;
+  }
+  uint8_t byte = m->memory[pc];
+  const OpcodeDescriptor *op = &opcodeTable[byte];
+  if ((op->flags & OP_VALID) && op->length > m->size - pc) {
+    m->status = STAT_ADR;
+    return 0;
+  }
+
+  Y86Instruction insn;
+  memset(&insn, 0, sizeof(insn));
+  // the decoder wants the byte after a halt, which a program never needs
+  if (byte != 0x00) {
+    Y86Cursor cursor = {pc, 0};
+    y86Decode(m->memory, m->size, 0, &cursor, &insn, 1);
+    if (insn.kind != Y86_CODE) {
+      m->status = STAT_INS;
+      return 0;
+    }
+  }
+
+  uint32_t slot = m->freeOps;
+  if (slot != 0) {
+    m->freeOps = (uint32_t)m->ops[slot - 1].valC;
+  } else {
+    if (m->opCount == m->opCapacity) {
+      size_t capacity = m->opCapacity == 0 ? 1024 : m->opCapacity * 2;
+      ExecOp *grown = capacity < UINT32_MAX
+                          ? realloc(m->ops, capacity * sizeof(ExecOp))
+                          : NULL;
+      if (grown == NULL) {
+        m->status = 0;
+        return 0;
+      }
+      m->ops = grown;
+      m->opCapacity = capacity;
+    }
+    slot = (uint32_t)++m->opCount;
+  }
+
+  ExecOp *exec = &m->ops[slot - 1];
+  exec->handler = handlers[byte];
+  exec->valC = insn.immediate;
+  exec->valP = pc + op->length;
+  exec->instr = byte;
+  exec->rA = insn.rA;
+  exec->rB = insn.rB;
+  m->slots[pc] = slot;
+  for (uint64_t a = pc; a < exec->valP; a++) {
+    m->codeBits[a / 8] |= (uint8_t)(1 << a % 8);
+  }
+  m->predecoded++;
+  return slot;
+}
+
+// GNU C label addresses are what make the dispatch threaded
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+/**
+ * Run until the program halts or faults, or maxSteps instructions have run.
+ * The PC, condition codes and step count live in locals while it runs and
+ * are stored back into m at the end. A faulting instruction leaves the PC
+ * on itself, as yis does. Returns -1 if memory for ops ran out.
+ **/
+static int run(Machine *m, uint64_t maxSteps) {
+  const void *handlers[256];
+  for (int b = 0; b < 256; b++) {
+    handlers[b] = &&invalid;
+  }
+  handlers[0x00] = &&halt;
+  handlers[0x10] = &&nop;
+  handlers[0x20] = &&rrmovq;
+  handlers[0x21] = &&cmovle;
+  handlers[0x22] = &&cmovl;
+  handlers[0x23] = &&cmove;
+  handlers[0x24] = &&cmovne;
+  handlers[0x25] = &&cmovge;
+  handlers[0x26] = &&cmovg;
+  handlers[0x30] = &&irmovq;
+  handlers[0x40] = &&rmmovq;
+  handlers[0x50] = &&mrmovq;
+  handlers[0x60] = &&addq;
+  handlers[0x61] = &&subq;
+  handlers[0x62] = &&andq;
+  handlers[0x63] = &&xorq;
+  handlers[0x64] = &&mulq;
+  handlers[0x65] = &&divq;
+  handlers[0x66] = &&modq;
+  handlers[0x70] = &&jmp;
+  handlers[0x71] = &&jle;
+  handlers[0x72] = &&jl;
+  handlers[0x73] = &&je;
+  handlers[0x74] = &&jne;
+  handlers[0x75] = &&jge;
+  handlers[0x76] = &&jg;
+  handlers[0x80] = &&call;
+  handlers[0x90] = &&ret;
+  handlers[0xA0] = &&pushq;
+  handlers[0xB0] = &&popq;
+  // a traced run enters every op through observe, which reports the
+  // instruction and then goes on to its real handler
+  const void *observed[256];
+  for (int b = 0; b < 256; b++) {
+    observed[b] = &&observe;
+  }
+  ExecStep step;
+
+  uint64_t *r = m->registers;
+  uint64_t pc = m->pc;
+  uint64_t steps = m->steps;
+  int zf = m->zf;
+  int sf = m->sf;
+  int of = m->of;
+  const ExecOp *op;
+  uint64_t a;
+  uint64_t b;
+  uint64_t e;
+  uint32_t slot;
+
+#define NEXT(target)                                                           \
+  do {                                                                         \
+    pc = (target);                                                             \
+    if (steps == maxSteps) {                                                   \
+      goto stop;                                                               \
+    }                                                                          \
+    slot = pc < m->size ? m->slots[pc] : 0;                                    \
+    if (slot == 0) {                                                           \
+      goto miss;                                                               \
+    }                                                                          \
+    op = &m->ops[slot - 1];                                                    \
+    steps++;                                                                   \
+    goto *op->handler;                                                         \
+  } while (0)
+#define FAULT(code)                                                            \
+  do {                                                                         \
+    m->status = (code);                                                        \
+    goto stop;                                                                 \
+  } while (0)
+#define SET_CC(value)                                                          \
+  do {                                                                         \
+    zf = (value) == 0;                                                         \
+    sf = (int64_t)(value) < 0;                                                 \
+  } while (0)
+
+  NEXT(pc);
+
+miss:
+  m->pc = pc;
+  slot = predecode(m, m->observer != NULL ? observed : handlers);
+  if (slot == 0) {
+    goto stop;
+  }
+  op = &m->ops[slot - 1];
+  steps++;
+  goto *op->handler;
+
+observe:
+  step.pc = pc;
+  step.valC = op->valC;
+  step.valP = op->valP;
+  step.instr = op->instr;
+  step.rA = op->rA;
+  step.rB = op->rB;
+  m->observer(m->context, &step);
+  goto *handlers[op->instr];
+
+halt:
+  FAULT(STAT_HLT);
+invalid:
+  FAULT(STAT_INS);
+nop:
+  NEXT(op->valP);
+
+rrmovq:
+  r[op->rB] = r[op->rA];
+  NEXT(op->valP);
+cmovle:
+  if ((sf ^ of) | zf) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+cmovl:
+  if (sf ^ of) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+cmove:
+  if (zf) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+cmovne:
+  if (!zf) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+cmovge:
+  if (!(sf ^ of)) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+cmovg:
+  if (!(sf ^ of) && !zf) {
+    r[op->rB] = r[op->rA];
+  }
+  NEXT(op->valP);
+
+irmovq:
+  r[op->rB] = op->valC;
+  NEXT(op->valP);
+rmmovq:
+  // a store can drop the op it is running, so read it first
+  e = op->valP;
+  if (writeWord(m, r[op->rB] + op->valC, r[op->rA]) != 0) {
+    FAULT(STAT_ADR);
+  }
+  NEXT(e);
+mrmovq:
+  if (readWord(m, r[op->rB] + op->valC, &e) != 0) {
+    FAULT(STAT_ADR);
+  }
+  r[op->rA] = e;
+  NEXT(op->valP);
+
+addq:
+  a = r[op->rA];
+  b = r[op->rB];
+  e = b + a;
+  of = ((int64_t)a < 0) == ((int64_t)b < 0) &&
+       ((int64_t)e < 0) != ((int64_t)a < 0);
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+subq:
+  a = r[op->rA];
+  b = r[op->rB];
+  e = b - a;
+  of = ((int64_t)a < 0) != ((int64_t)b < 0) &&
+       ((int64_t)e < 0) != ((int64_t)b < 0);
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+andq:
+  e = r[op->rB] & r[op->rA];
+  of = 0;
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+xorq:
+  e = r[op->rB] ^ r[op->rA];
+  of = 0;
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+mulq:
+  of = __builtin_mul_overflow((int64_t)r[op->rB], (int64_t)r[op->rA],
+                              (int64_t *)&e);
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+  // signed, rounding towards zero. there is no status for a division by
+  // zero, so it stops the program as an instruction that cannot run, and
+  // the one quotient that overflows wraps and sets OF.
+divq:
+  a = r[op->rA];
+  if (a == 0) {
+    FAULT(STAT_INS);
+  }
+  of = (int64_t)a == -1 && r[op->rB] == (uint64_t)INT64_MIN;
+  e = of ? r[op->rB] : (uint64_t)((int64_t)r[op->rB] / (int64_t)a);
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+modq:
+  a = r[op->rA];
+  if (a == 0) {
+    FAULT(STAT_INS);
+  }
+  of = 0;
+  e = (int64_t)a == -1 ? 0 : (uint64_t)((int64_t)r[op->rB] % (int64_t)a);
+  SET_CC(e);
+  r[op->rB] = e;
+  NEXT(op->valP);
+
+jmp:
+  NEXT(op->valC);
+jle:
+  NEXT((sf ^ of) | zf ? op->valC : op->valP);
+jl:
+  NEXT(sf ^ of ? op->valC : op->valP);
+je:
+  NEXT(zf ? op->valC : op->valP);
+jne:
+  NEXT(!zf ? op->valC : op->valP);
+jge:
+  NEXT(!(sf ^ of) ? op->valC : op->valP);
+jg:
+  NEXT(!(sf ^ of) && !zf ? op->valC : op->valP);
+
+call:
+  a = op->valC;
+  if (writeWord(m, r[RSP] - 8, op->valP) != 0) {
+    FAULT(STAT_ADR);
+  }
+  r[RSP] -= 8;
+  NEXT(a);
+ret:
+  if (readWord(m, r[RSP], &e) != 0) {
+    FAULT(STAT_ADR);
+  }
+  r[RSP] += 8;
+  NEXT(e);
+pushq:
+  // pushq %rsp pushes the old value
+  e = op->valP;
+  if (writeWord(m, r[RSP] - 8, r[op->rA]) != 0) {
+    FAULT(STAT_ADR);
+  }
+  r[RSP] -= 8;
+  NEXT(e);
+popq:
+  if (readWord(m, r[RSP], &e) != 0) {
+    FAULT(STAT_ADR);
+  }
+  // popq %rsp ends up with the value popped
+  r[RSP] += 8;
+  r[op->rA] = e;
+  NEXT(op->valP);
+
+#undef NEXT
+#undef FAULT
+#undef SET_CC
+
+stop:
+  m->pc = pc;
+  m->steps = steps;
+  m->zf = zf;
+  m->sf = sf;
+  m->of = of;
+  return m->status == 0 ? -1 : 0;
+}
+
+#pragma GCC diagnostic pop
+
+static void appendLine(OutputSink *out, const char *line) {
+  appendOutput(out, line, strlen(line));
+}
+
+// the yis report: where the program stopped, then every register and
+// 8-byte memory word whose value is not what it started with.
+static void printFinalState(const Machine *m, const uint8_t *image,
+                            size_t length, OutputSink *out) {
+  char line[128];
+  snprintf(line, sizeof(line),
+           "Stopped in %llu steps at PC = 0x%llx.  Status '%s', "
+           "CC Z=%d S=%d O=%d\n",
+           (unsigned long long)m->steps, (unsigned long long)m->pc,
+           statusNames[m->status], m->zf, m->sf, m->of);
+  appendLine(out, line);
+
+  appendLine(out, "Changes to registers:\n");
+  for (int i = 0; i < 15; i++) {
+    if (m->registers[i] != 0) {
+      snprintf(line, sizeof(line), "%s:\t0x%016llx\t0x%016llx\n",
+               registerTable[i << 4 | Y86_NO_REGISTER].rA, 0ull,
+               (unsigned long long)m->registers[i]);
+      appendLine(out, line);
+    }
+  }
+
+  appendLine(out, "\nChanges to memory:\n");
+  for (size_t address = 0; address < m->size; address += 8) {
+    uint8_t before[8] = {0};
+    if (address < length) {
+      memcpy(before, image + address,
+             length - address < 8 ? length - address : 8);
+    }
+    uint64_t old = loadWord(before);
+    uint64_t now = loadWord(m->memory + address);
+    if (old != now) {
+      snprintf(line, sizeof(line), "0x%04llx:\t0x%016llx\t0x%016llx\n",
+               (unsigned long long)address, (unsigned long long)old,
+               (unsigned long long)now);
+      appendLine(out, line);
+    }
+  }
+}
+
+static void freeMachine(Machine *m) {
+  free(m->memory);
+  free(m->slots);
+  free(m->codeBits);
+  free(m->ops);
+}
+
+// load the image into a new machine about to run from entry. returns -1 if
+// memory ran out.
+static int startMachine(Machine *m, const uint8_t *image, size_t length,
+                        long entry) {
+  memset(m, 0, sizeof(*m));
+  // whole words, so the last word of memory can be read and compared
+  m->size = (length < EXEC_MIN_MEMORY ? EXEC_MIN_MEMORY : length + 7) & ~7ull;
+  m->memory = calloc(m->size, 1);
+  m->slots = calloc(m->size, sizeof(uint32_t));
+  m->codeBits = calloc(m->size / 8 + 1, 1);
+  if (m->memory == NULL || m->slots == NULL || m->codeBits == NULL) {
+    freeMachine(m);
+    return -1;
+  }
+  memcpy(m->memory, image, length);
+
+  size_t start = (size_t)entry;
+  m->pc = start < length ? findNonZero(image, start, length) : start;
+  m->zf = 1;
+  m->status = STAT_AOK;
+  return 0;
+}
+
+int executeImage(const uint8_t *image, size_t length, long entry,
+                 uint64_t maxSteps, OutputSink *outputFile) {
+  Machine m;
+  if (startMachine(&m, image, length, entry) != 0) {
+    return -1;
+  }
+
+  struct timespec begin;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  int res = run(&m, maxSteps);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - begin.tv_sec) +
+                   (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+
+  if (res == 0) {
+    printFinalState(&m, image, length, outputFile);
+    fprintf(stderr,
+            "Executed %llu instructions in %.3f s (%.1f M/s); decoded %llu, "
+            "dropped %llu after stores into code\n",
+            (unsigned long long)m.steps, seconds,
+            seconds > 0 ? (double)m.steps / seconds / 1e6 : 0.0,
+            (unsigned long long)m.predecoded,
+            (unsigned long long)m.invalidated);
+  }
+  freeMachine(&m);
+  return res;
+}
+
+int traceImage(const uint8_t *image, size_t length, long entry,
+               uint64_t maxSteps, StepObserver observer, void *context,
+               ExecSummary *summary) {
+  Machine m;
+  if (startMachine(&m, image, length, entry) != 0) {
+    return -1;
+  }
+  m.observer = observer;
+  m.context = context;
+  int res = run(&m, maxSteps);
+  summary->steps = m.steps;
+  summary->pc = m.pc;
+  summary->status = statusNames[m.status];
+  freeMachine(&m);
+  return res;
+}
@@ -0,0 +1,56 @@
+/* This file contains the prototype for the Y86-64 emulator defined in
+   emulator.c (the --exec option).
+*/
+
+#ifndef _EMULATOR_H_
+#define _EMULATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// Memory given to a program: the image, grown to at least this many bytes
+// so a small image still has room for its stack.
+#define EXEC_MIN_MEMORY (1 << 13)
+
+// Instructions run before the emulator gives up on a program that does not
+// halt, unless --max-steps says otherwise.
+#define EXEC_DEFAULT_STEPS 10000000000ull
+
+// Run the image as a Y86-64 program, starting at the first non-zero byte at
+// or after entry with every register zero and the condition codes Z=1 S=0
+// O=0, until it halts, faults or has run maxSteps instructions. The final
+// PC, status, condition codes and the registers and memory words that
+// changed are then printed the way the CS:APP yis simulator prints them.
+// Returns 0, or -1 if memory ran out.
+int executeImage(const uint8_t *image, size_t length, long entry,
+                 uint64_t maxSteps, OutputSink *outputFile);
+
+// One instruction of a traced run, as it is about to execute.
+typedef struct {
+  uint64_t pc;
+  uint64_t valC;  // immediate, displacement or destination
+  uint64_t valP;  // address of the following instruction
+  uint8_t instr;  // icode << 4 | ifun
+  uint8_t rA;
+  uint8_t rB;
+} ExecStep;
+
+typedef void (*StepObserver)(void *context, const ExecStep *step);
+
+// How a traced run ended.
+typedef struct {
+  uint64_t steps;
+  uint64_t pc;
+  const char *status; // "AOK" (out of steps), "HLT", "ADR" or "INS"
+} ExecSummary;
+
+// Run the image as executeImage() does, calling observer with context
+// before every instruction, and describe how the run ended in summary
+// instead of printing anything. Returns 0, or -1 if memory ran out.
+int traceImage(const uint8_t *image, size_t length, long entry,
+               uint64_t maxSteps, StepObserver observer, void *context,
+               ExecSummary *summary);
+
+#endif /* EMULATOR */
@@ -0,0 +1,254 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodeTable.h"
+
+/*
+  genImage writes a large Y86-64 image for the benchmarks (make bench). The
+  same seed, size and mix always give the same bytes.
+
+  The image is a random sequence of items, chosen by weight:
+
+    code     a valid encoding of any icode/ifun in opcodeTable, with a
+             register byte that meets its requirements and a random value
+    invalid  an invalid icode/ifun or register byte followed by filler, or
+             an icode 0xC-0xF byte, all of which the decoder turns into
+             .byte output or skips
+    quad     8 bytes of data on an 8-byte boundary, shown as .quad
+    gap      a halt followed by a run of zero bytes, i.e. a new .pos
+*/
+
+enum { MIX_CODE, MIX_INVALID, MIX_QUAD, MIX_GAP, MIX_KINDS };
+
+static const char *mixNames[MIX_KINDS] = {"code", "invalid", "quad", "gap"};
+
+#define DEFAULT_SEED 1
+#define MAX_GAP_BYTES 256
+
+typedef struct {
+  uint8_t *bytes;
+  size_t length;
+  size_t used;
+  uint64_t state;
+} Image;
+
+// the first bytes of every valid and every invalid (but not skipped)
+// encoding, taken from opcodeTable
+static uint8_t validOpcodes[256];
+static int validCount;
+static uint8_t invalidOpcodes[256];
+static int invalidCount;
+
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-s seed] [-m code=N,invalid=N,quad=N,gap=N] "
+          "size[K|M|G] OutputFilename\n",
+          program);
+}
+
+// splitmix64
+static uint64_t nextRandom(Image *image) {
+  uint64_t z = (image->state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static unsigned randomBelow(Image *image, unsigned bound) {
+  return (unsigned)(nextRandom(image) % bound);
+}
+
+static void putByte(Image *image, uint8_t byte) {
+  if (image->used < image->length) {
+    image->bytes[image->used++] = byte;
+  }
+}
+
+static void putRandomBytes(Image *image, int count) {
+  for (int i = 0; i < count; i++) {
+    putByte(image, (uint8_t)nextRandom(image));
+  }
+}
+
+// a register byte meeting requirements. a register is %rax..%r14 when it
+// must be valid, 0xF when it must be absent.
+static uint8_t registerByteFor(Image *image, uint8_t requirements) {
+  unsigned rA = requirements & REG_A_NONE ? 0xF : randomBelow(image, 15);
+  unsigned rB = requirements & REG_B_NONE ? 0xF : randomBelow(image, 15);
+  return (uint8_t)(rA << 4 | rB);
+}
+
+static void putCode(Image *image) {
+  uint8_t instr = validOpcodes[randomBelow(image, (unsigned)validCount)];
+  const OpcodeDescriptor *op = &opcodeTable[instr];
+  int length = 1;
+
+  putByte(image, instr);
+  if (op->flags & OP_REGISTER_BYTE) {
+    putByte(image, registerByteFor(image, op->registerRequirements));
+    length++;
+  }
+  // the immediate, or the byte a halt swallows
+  putRandomBytes(image, (op->flags & OP_SEGMENT_END) ? 1 : op->length - length);
+}
+
+static void putInvalid(Image *image) {
+  switch (randomBelow(image, 3)) {
+  case 0:
+    putByte(image, invalidOpcodes[randomBelow(image, (unsigned)invalidCount)]);
+    putRandomBytes(image, INVALID_INSTR_BYTES - 1);
+    break;
+  case 1:
+    // rrmovq with no rA
+    putByte(image, 0x20);
+    putByte(image, 0xF0 | randomBelow(image, 15));
+    putRandomBytes(image, INVALID_INSTR_BYTES - 2);
+    break;
+  default:
+    putByte(image, (uint8_t)(0xC0 + randomBelow(image, 0x40)));
+    break;
+  }
+}
+
+static void putQuad(Image *image) {
+  // nops up to the next 8-byte boundary, then data whose first byte is not
+  // an instruction
+  while (image->used % 8 != 0) {
+    putByte(image, 0x10);
+  }
+  putByte(image, invalidOpcodes[randomBelow(image, (unsigned)invalidCount)]);
+  putRandomBytes(image, 7);
+}
+
+static void putGap(Image *image) {
+  int zeros = 2 + 16 + (int)randomBelow(image, MAX_GAP_BYTES);
+  for (int i = 0; i < zeros; i++) {
+    putByte(image, 0);
+  }
+}
+
+static void generate(Image *image, const unsigned *mix) {
+  unsigned total = 0;
+  for (int i = 0; i < MIX_KINDS; i++) {
+    total += mix[i];
+  }
+
+  while (image->used < image->length) {
+    unsigned pick = randomBelow(image, total);
+    int kind = 0;
+    while (pick >= mix[kind]) {
+      pick -= mix[kind++];
+    }
+    switch (kind) {
+    case MIX_CODE:
+      putCode(image);
+      break;
+    case MIX_INVALID:
+      putInvalid(image);
+      break;
+    case MIX_QUAD:
+      putQuad(image);
+      break;
+    default:
+      putGap(image);
+      break;
+    }
+  }
+}
+
+// "name=weight,..." into mix. returns -1 on anything it does not know.
+static int parseMix(char *text, unsigned *mix) {
+  memset(mix, 0, MIX_KINDS * sizeof(unsigned));
+  for (char *item = strtok(text, ","); item != NULL;
+       item = strtok(NULL, ",")) {
+    char *equals = strchr(item, '=');
+    int kind = 0;
+    if (equals == NULL) {
+      return -1;
+    }
+    *equals = '\0';
+    while (kind < MIX_KINDS && strcmp(item, mixNames[kind]) != 0) {
+      kind++;
+    }
+    if (kind == MIX_KINDS) {
+      return -1;
+    }
+    mix[kind] = (unsigned)strtoul(equals + 1, NULL, 10);
+  }
+  return mix[MIX_CODE] + mix[MIX_INVALID] + mix[MIX_QUAD] + mix[MIX_GAP] > 0
+             ? 0
+             : -1;
+}
+
+static size_t parseSize(const char *text) {
+  char *end;
+  size_t size = (size_t)strtoull(text, &end, 0);
+  switch (*end) {
+  case 'G':
+    size <<= 10;
+    /* fall through */
+  case 'M':
+    size <<= 10;
+    /* fall through */
+  case 'K':
+    size <<= 10;
+    break;
+  }
+  return size;
+}
+
+int main(int argc, char **argv) {
+  unsigned mix[MIX_KINDS] = {80, 4, 12, 4};
+  Image image = {NULL, 0, 0, DEFAULT_SEED};
+  int i = 1;
+
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (strcmp(argv[i], "-s") == 0) {
+      image.state = strtoull(argv[i + 1], NULL, 0);
+    } else if (strcmp(argv[i], "-m") != 0 || parseMix(argv[i + 1], mix) != 0) {
+      printUsage(argv[0]);
+      return -1;
+    }
+  }
+  if (argc - i != 2) {
+    printUsage(argv[0]);
+    return -1;
+  }
+
+  for (int b = 0; b < 256; b++) {
+    if (opcodeTable[b].flags & OP_VALID) {
+      validOpcodes[validCount++] = (uint8_t)b;
+    } else if (!(opcodeTable[b].flags & OP_UNKNOWN)) {
+      invalidOpcodes[invalidCount++] = (uint8_t)b;
+    }
+  }
+
+  image.length = parseSize(argv[i]);
+  image.bytes = malloc(image.length);
+  if (image.bytes == NULL) {
+    fprintf(stderr, "Failed to allocate %zu bytes\n", image.length);
+    return -1;
+  }
+  generate(&image, mix);
+
+  FILE *outputFile = fopen(argv[i + 1], "wb");
+  int res = outputFile == NULL ? -1 : 0;
+  if (res == 0 &&
+      fwrite(image.bytes, 1, image.length, outputFile) != image.length) {
+    res = -1;
+  }
+  if (outputFile != NULL && fclose(outputFile) != 0) {
+    res = -1;
+  }
+  if (res != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", argv[i + 1], strerror(errno));
+    free(image.bytes);
+    return -1;
+  }
+  free(image.bytes);
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* This file contains the word loads and rotation that the hashes in cache.c
+   (xxHash64) and corpus.c (MurmurHash3) are built from. They are static
+   inline, so each includer gets its own copy to inline.
+*/
+
+#ifndef _HASHWORDS_H_
+#define _HASHWORDS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+  return value << bits | value >> (64 - bits);
+}
+
+// the little-endian word at bytes, which need not be aligned
+static inline uint64_t load64(const uint8_t *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static inline uint32_t load32(const uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap32(value);
+#endif
+  return value;
+}
+
+#endif /* HASHWORDS */
@@ -0,0 +1,142 @@
+#include "hazards.h"
+
+#include <stdio.h>
+
+#include "decoder.h"
+#include "printRoutines.h"
+
+/*
+  Static hazard annotations.
+
+  The sweep is printed one record behind the decoder: whether an mrmovq or
+  popq stalls depends on the instruction after it, so each record is held
+  until the next one is known and then printed with its note. Branches are
+  judged by direction alone. A backward jXX closes a loop and falls through
+  (mispredicting) once, on the way out; a forward one mispredicts every time
+  it is not taken. Each segment's summary counts every hazard in it once,
+  which is what one pass through its code costs at most.
+*/
+
+#define RECORD_BATCH 1024
+
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  uint64_t loadUse;
+  uint64_t mispredict;
+  uint64_t ret;
+} Segment;
+
+int readsRegister(int icode, int rA, int rB, int reg) {
+  switch (icode) {
+  case I_RRMOVQ:
+    return rA == reg;
+  case I_RMMOVQ:
+  case I_OPQ:
+    return rA == reg || rB == reg;
+  case I_MRMOVQ:
+    return rB == reg;
+  case I_PUSHQ:
+    return rA == reg || reg == RSP;
+  case I_POPQ:
+  case I_CALL:
+  case I_RET:
+    return reg == RSP;
+  default:
+    return 0;
+  }
+}
+
+// the note for insn given the record after it (NULL at the end of the
+// sweep), counting the bubbles in segment. Returns NULL when insn costs
+// nothing.
+static const char *noteFor(const Y86Instruction *insn,
+                           const Y86Instruction *next, Segment *segment) {
+  if (insn->kind != Y86_CODE) {
+    return NULL;
+  }
+  if (LOADS_REGISTER(insn->icode) && next != NULL &&
+      next->kind == Y86_CODE &&
+      readsRegister(next->icode, next->rA, next->rB, insn->rA)) {
+    segment->loadUse += LOAD_USE_BUBBLES;
+    return "# load/use: 1 bubble";
+  }
+  if (insn->icode == I_JXX && insn->ifun != 0) {
+    segment->mispredict += MISPREDICT_BUBBLES;
+    return insn->immediate <= insn->address
+               ? "# mispredicted on loop exit: 2 bubbles"
+               : "# mispredicted when not taken: 2 bubbles";
+  }
+  if (insn->icode == I_RET) {
+    segment->ret += RET_BUBBLES;
+    return "# ret: 3 bubbles";
+  }
+  return NULL;
+}
+
+// a segment that loses nothing gets no summary
+static void printSummary(OutputSink *outputFile, const Segment *segment) {
+  uint64_t bubbles = segment->loadUse + segment->mispredict + segment->ret;
+  if (bubbles == 0) {
+    return;
+  }
+  char text[256];
+  int written = snprintf(
+      text, sizeof(text),
+      "# segment 0x%llx-0x%llx: up to %llu bubbles a pass (load/use %llu, "
+      "jXX %llu, ret %llu)\n",
+      (unsigned long long)segment->start, (unsigned long long)segment->end,
+      (unsigned long long)bubbles, (unsigned long long)segment->loadUse,
+      (unsigned long long)segment->mispredict,
+      (unsigned long long)segment->ret);
+  appendOutput(outputFile, text, (size_t)written);
+}
+
+// print held, the record before next, closing its segment first when it
+// opens a new one
+static void printHeld(OutputSink *outputFile, const Y86Instruction *held,
+                      const Y86Instruction *next, Segment *segment,
+                      int isFirstPosFlag) {
+  if (held->kind == Y86_POS) {
+    printSummary(outputFile, segment);
+    segment->start = segment->end = held->immediate;
+    segment->loadUse = segment->mispredict = segment->ret = 0;
+  } else if (held->kind != Y86_SKIP) {
+    segment->end = held->address + held->length;
+  }
+  const char *note = noteFor(held, next, segment);
+  if (note == NULL) {
+    printRecord(outputFile, held, isFirstPosFlag);
+  } else {
+    printRecordNoted(outputFile, held, isFirstPosFlag, note);
+  }
+}
+
+void annotateHazards(const uint8_t *machineCode, size_t length,
+                     long startingOffset, OutputSink *outputFile) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Instruction held;
+  Y86Cursor cursor;
+  Segment segment = {0};
+  size_t count;
+  int holding = 0;
+  int isFirstPosFlag = 1;
+
+  segment.start = segment.end = (uint64_t)startingOffset;
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (holding) {
+        printHeld(outputFile, &held, &records[i], &segment, isFirstPosFlag);
+        isFirstPosFlag = 0;
+      }
+      held = records[i];
+      holding = 1;
+    }
+  }
+  if (holding) {
+    printHeld(outputFile, &held, NULL, &segment, isFirstPosFlag);
+  }
+  printSummary(outputFile, &segment);
+}
@@ -0,0 +1,54 @@
+/* This file contains the pipeline hazard rules shared by the PIPE timing
+   model and the static hazard annotations (--annotate-hazards), defined in
+   hazards.c.
+*/
+
+#ifndef _HAZARDS_H_
+#define _HAZARDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// icodes, as HCL names them
+enum {
+  I_HALT,
+  I_NOP,
+  I_RRMOVQ, // and cmovXX
+  I_IRMOVQ,
+  I_RMMOVQ,
+  I_MRMOVQ,
+  I_OPQ,
+  I_JXX,
+  I_CALL,
+  I_RET,
+  I_PUSHQ,
+  I_POPQ
+};
+
+// register number of %rsp
+#define RSP 4
+
+// Bubbles each hazard costs on the five-stage PIPE processor of CS:APP,
+// which forwards every result and predicts every branch taken.
+#define LOAD_USE_BUBBLES 1   // a loaded register read by the next instruction
+#define MISPREDICT_BUBBLES 2 // a conditional jXX that falls through
+#define RET_BUBBLES 3        // fetch waits for every return address
+
+// Whether an instruction loads a register that a following instruction may
+// have to wait for: mrmovq and popq load rA.
+#define LOADS_REGISTER(icode) ((icode) == I_MRMOVQ || (icode) == I_POPQ)
+
+// Whether the instruction icode/rA/rB reads reg in its decode stage, where
+// it would have to wait for a load into reg just before it.
+int readsRegister(int icode, int rA, int rB, int reg);
+
+// Print the sweep from startingOffset with a comment on every instruction
+// that will cost the pipeline cycles wherever it runs. Each .pos segment
+// with such instructions is followed by a line summing up the cycles it
+// loses at most each time it runs through.
+void annotateHazards(const uint8_t *machineCode, size_t length,
+                     long startingOffset, OutputSink *outputFile);
+
+#endif /* HAZARDS */
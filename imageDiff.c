@@ -0,0 +1,564 @@
+#include "imageDiff.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "printRoutines.h"
+#include "recordList.h"
+
+/*
+  Image diff.
+
+  The two images are compared a 64-bit word at a time to find the next byte
+  that differs. Every record of the sweep before that byte, and not touching
+  it, is the same in both listings, and so are the records after any point
+  where the two sweeps come back to the same offset in the same state and
+  the bytes are the same again. So only the stretch between those points is
+  decoded twice, one record at a time from whichever sweep is behind, and
+  diffed line by line.
+
+  Reaching a difference needs the sweep's state just before it. The run of
+  unchanged bytes before it is searched backwards for a long run of zero
+  bytes, which every sweep leaves as a new .pos segment at the next non-zero
+  byte (see parallelDisassemble.c), and decoding starts there. Only when the
+  unchanged bytes have no such run does the decode start where the last hunk
+  ended, or where the sweep does, so for images with .pos gaps between their
+  segments the cost follows the size of the change, not of the image.
+
+  The lines of a stretch are matched up with Myers' linear-space diff: the
+  middle snake of the shortest edit script is found by searching forwards
+  from one end and backwards from the other until the two meet, and each
+  half is diffed the same way. This takes O((n + m) * d) time for n and m
+  lines with d of them changed, and O(n + m) space. As in GNU diff, a search
+  that runs past a cost of about the square root of n + m gives up on the
+  shortest script and splits at the furthest it reached, so stretches that
+  changed throughout still take close to linear time.
+*/
+
+// an instruction can overlap at most 9 bytes of a zero run and a halt 2
+// more, so a run this long always ends in a .pos at the next non-zero byte
+#define SYNC_ZERO_RUN 16
+#define RECORD_BATCH 1024
+// the least search cost at which a middle snake search gives up
+#define MIN_DIFF_COST 256
+
+typedef struct {
+  const uint8_t *oldCode;
+  size_t oldLength;
+  const uint8_t *newCode;
+  size_t newLength;
+  size_t common; // bytes both images have
+  size_t longest;
+  const char *oldName;
+  const char *newName;
+  OutputSink *out;
+  long hunks; // printed so far
+} ImageDiff;
+
+typedef struct {
+  const Y86Instruction *o; // old lines
+  const Y86Instruction *w; // new lines
+  uint8_t *oldChanged;     // the lines not in the common subsequence
+  uint8_t *newChanged;
+  long *forward;  // furthest old line reached on each diagonal, by x - y
+  long *backward; // nearest old line reached backwards on each diagonal
+  long tooExpensive;
+} LineDiff;
+
+typedef struct {
+  uint64_t address; // of its first line, the same in both listings
+  Y86Instruction before[DIFF_CONTEXT];
+  size_t beforeCount;
+  RecordList oldLines;
+  RecordList newLines;
+  Y86Instruction after[2 * DIFF_CONTEXT];
+  size_t afterCount;
+} Hunk;
+
+// the first offset in [from, common) where the images differ, or common;
+// and from itself when that is past common, where only one image has bytes
+static size_t nextDifference(const ImageDiff *diff, size_t from) {
+  size_t i = from;
+  if (i >= diff->common) {
+    return i;
+  }
+  for (; i + 8 <= diff->common; i += 8) {
+    uint64_t a;
+    uint64_t b;
+    memcpy(&a, diff->oldCode + i, sizeof(a));
+    memcpy(&b, diff->newCode + i, sizeof(b));
+    if (a != b) {
+      break;
+    }
+  }
+  while (i < diff->common && diff->oldCode[i] == diff->newCode[i]) {
+    i++;
+  }
+  return i;
+}
+
+// the last non-zero byte in [from, limit) after a zero run of at least
+// SYNC_ZERO_RUN bytes that also lies in [from, limit), or from if none.
+static size_t findSyncPoint(const uint8_t *bytes, size_t from, size_t limit) {
+  size_t run = 0;
+  size_t next = limit; // the non-zero byte above the zeros counted in run
+  for (size_t i = limit; i-- > from;) {
+    if (bytes[i] == 0) {
+      run++;
+      continue;
+    }
+    if (run >= SYNC_ZERO_RUN && next < limit) {
+      return next;
+    }
+    next = i;
+    run = 0;
+  }
+  return run >= SYNC_ZERO_RUN && next < limit ? next : from;
+}
+
+// whether two records print the same line
+static int sameLine(const Y86Instruction *a, const Y86Instruction *b) {
+  if (a->kind != b->kind) {
+    return 0;
+  }
+  switch (a->kind) {
+  case Y86_CODE:
+    return a->icode == b->icode && a->ifun == b->ifun && a->rA == b->rA &&
+           a->rB == b->rB && a->immediate == b->immediate;
+  case Y86_BYTE:
+    return a->icode == b->icode && a->ifun == b->ifun;
+  default:
+    return a->immediate == b->immediate;
+  }
+}
+
+/**
+ * Find where a shortest edit script of the old lines [xoff, xlim) into the
+ * new lines [yoff, ylim) crosses its middle, or, once the search costs more
+ * than tooExpensive, the furthest point the search reached from either end.
+ * Neither range may be empty, and their first lines and their last lines
+ * must differ. Returns the point in *xmid and *ymid.
+ **/
+static void findMiddle(const LineDiff *lines, long xoff, long xlim, long yoff,
+                       long ylim, long *xmid, long *ymid) {
+  long *fd = lines->forward;
+  long *bd = lines->backward;
+  const long dmin = xoff - ylim; // the diagonals of the range
+  const long dmax = xlim - yoff;
+  const long fmid = xoff - yoff; // where each search starts
+  const long bmid = xlim - ylim;
+  long fmin = fmid;
+  long fmax = fmid;
+  long bmin = bmid;
+  long bmax = bmid;
+  // with an odd difference the searches meet on a forward step
+  const int odd = (fmid - bmid) & 1;
+
+  fd[fmid] = xoff;
+  bd[bmid] = xlim;
+  for (long cost = 1;; cost++) {
+    if (fmin > dmin) {
+      fd[--fmin - 1] = -1;
+    } else {
+      ++fmin;
+    }
+    if (fmax < dmax) {
+      fd[++fmax + 1] = -1;
+    } else {
+      --fmax;
+    }
+    for (long d = fmax; d >= fmin; d -= 2) {
+      long x = fd[d - 1] >= fd[d + 1] ? fd[d - 1] + 1 : fd[d + 1];
+      long y = x - d;
+      while (x < xlim && y < ylim && sameLine(&lines->o[x], &lines->w[y])) {
+        x++;
+        y++;
+      }
+      fd[d] = x;
+      if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+        *xmid = x;
+        *ymid = y;
+        return;
+      }
+    }
+
+    if (bmin > dmin) {
+      bd[--bmin - 1] = LONG_MAX;
+    } else {
+      ++bmin;
+    }
+    if (bmax < dmax) {
+      bd[++bmax + 1] = LONG_MAX;
+    } else {
+      --bmax;
+    }
+    for (long d = bmax; d >= bmin; d -= 2) {
+      long x = bd[d - 1] < bd[d + 1] ? bd[d - 1] : bd[d + 1] - 1;
+      long y = x - d;
+      while (x > xoff && y > yoff &&
+             sameLine(&lines->o[x - 1], &lines->w[y - 1])) {
+        x--;
+        y--;
+      }
+      bd[d] = x;
+      if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+        *xmid = x;
+        *ymid = y;
+        return;
+      }
+    }
+
+    if (cost >= lines->tooExpensive) {
+      // split where one of the searches got furthest along its diagonal
+      long fxybest = -1;
+      long fxbest = xoff;
+      for (long d = fmax; d >= fmin; d -= 2) {
+        long x = fd[d] < xlim ? fd[d] : xlim;
+        long y = x - d;
+        if (y > ylim) {
+          x = ylim + d;
+          y = ylim;
+        }
+        if (x + y > fxybest) {
+          fxybest = x + y;
+          fxbest = x;
+        }
+      }
+      long bxybest = LONG_MAX;
+      long bxbest = xlim;
+      for (long d = bmax; d >= bmin; d -= 2) {
+        long x = bd[d] > xoff ? bd[d] : xoff;
+        long y = x - d;
+        if (y < yoff) {
+          x = yoff + d;
+          y = yoff;
+        }
+        if (x + y < bxybest) {
+          bxybest = x + y;
+          bxbest = x;
+        }
+      }
+      if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+        *xmid = fxbest;
+        *ymid = fxybest - fxbest;
+      } else {
+        *xmid = bxbest;
+        *ymid = bxybest - bxbest;
+      }
+      return;
+    }
+  }
+}
+
+// mark the old lines [xoff, xlim) and new lines [yoff, ylim) that are not
+// in a common subsequence of them, as short as findMiddle() finds
+static void compareLines(const LineDiff *lines, long xoff, long xlim,
+                         long yoff, long ylim) {
+  while (xoff < xlim && yoff < ylim &&
+         sameLine(&lines->o[xoff], &lines->w[yoff])) {
+    xoff++;
+    yoff++;
+  }
+  while (xlim > xoff && ylim > yoff &&
+         sameLine(&lines->o[xlim - 1], &lines->w[ylim - 1])) {
+    xlim--;
+    ylim--;
+  }
+  if (xoff == xlim) {
+    memset(lines->newChanged + yoff, 1, (size_t)(ylim - yoff));
+  } else if (yoff == ylim) {
+    memset(lines->oldChanged + xoff, 1, (size_t)(xlim - xoff));
+  } else {
+    long xmid;
+    long ymid;
+    findMiddle(lines, xoff, xlim, yoff, ylim, &xmid, &ymid);
+    compareLines(lines, xoff, xmid, yoff, ymid);
+    compareLines(lines, xmid, xlim, ymid, ylim);
+  }
+}
+
+// mark the lines of n old and m new that differ. Returns 0, or -1 if there
+// was no memory.
+static int diffLines(LineDiff *lines, const Y86Instruction *o, size_t n,
+                     const Y86Instruction *w, size_t m) {
+  size_t diagonals = n + m + 3;
+  lines->o = o;
+  lines->w = w;
+  lines->oldChanged = calloc(n + m + 1, 1);
+  lines->forward = malloc(2 * diagonals * sizeof(long));
+  if (lines->oldChanged == NULL || lines->forward == NULL) {
+    free(lines->oldChanged);
+    free(lines->forward);
+    return -1;
+  }
+  lines->newChanged = lines->oldChanged + n;
+  // both are indexed by diagonal, from -(m + 1) to n + 1
+  lines->forward += m + 1;
+  lines->backward = lines->forward + diagonals;
+  lines->tooExpensive = 1;
+  for (; diagonals != 0; diagonals >>= 2) {
+    lines->tooExpensive <<= 1;
+  }
+  if (lines->tooExpensive < MIN_DIFF_COST) {
+    lines->tooExpensive = MIN_DIFF_COST;
+  }
+  compareLines(lines, 0, (long)n, 0, (long)m);
+  free(lines->forward - (m + 1));
+  return 0;
+}
+
+static int addLine(RecordList *list, const Y86Instruction *insn) {
+  if (insn->kind == Y86_SKIP) {
+    return 0;
+  }
+  Y86Instruction *slot = reserveRecords(list, 1);
+  if (slot == NULL) {
+    return -1;
+  }
+  *slot = *insn;
+  list->count++;
+  return 0;
+}
+
+static void printLine(OutputSink *out, char mark, const Y86Instruction *insn) {
+  char *dst = reserveOutput(out, 1);
+  *dst++ = mark;
+  commitOutput(out, dst);
+  // lines are never preceded by the blank line of a .pos
+  printRecord(out, insn, 1);
+}
+
+/**
+ * Print one hunk: the context before it, the old and new lines of the
+ * changed stretch with the lines they have in common found by diffLines(),
+ * and the context after it. The first hunk is preceded by the names of the
+ * images. Prints nothing if the old and new lines are the same, which
+ * happens when only bytes that print nothing changed. Returns 0, or -1 if
+ * there was no memory to diff the lines.
+ **/
+static int printHunk(ImageDiff *diff, const Hunk *hunk) {
+  const Y86Instruction *o = hunk->oldLines.records;
+  const Y86Instruction *w = hunk->newLines.records;
+  size_t n = hunk->oldLines.count;
+  size_t m = hunk->newLines.count;
+  LineDiff lines;
+  OutputSink *out = diff->out;
+
+  if (n == m) {
+    size_t i = 0;
+    while (i < n && sameLine(&o[i], &w[i])) {
+      i++;
+    }
+    if (i == n) {
+      return 0;
+    }
+  }
+  if (diffLines(&lines, o, n, w, m) != 0) {
+    return -1;
+  }
+
+  char text[96];
+  int written;
+  if (diff->hunks++ == 0) {
+    written = snprintf(text, sizeof(text), "--- %s\n", diff->oldName);
+    appendOutput(out, text, (size_t)written);
+    written = snprintf(text, sizeof(text), "+++ %s\n", diff->newName);
+    appendOutput(out, text, (size_t)written);
+  }
+  written = snprintf(text, sizeof(text), "@@ -0x%llx,%zu +0x%llx,%zu @@\n",
+                     (unsigned long long)hunk->address,
+                     hunk->beforeCount + n + hunk->afterCount,
+                     (unsigned long long)hunk->address,
+                     hunk->beforeCount + m + hunk->afterCount);
+  appendOutput(out, text, (size_t)written);
+  for (size_t i = 0; i < hunk->beforeCount; i++) {
+    printLine(out, ' ', &hunk->before[i]);
+  }
+  size_t i = 0;
+  size_t j = 0;
+  while (i < n || j < m) {
+    if (i < n && lines.oldChanged[i]) {
+      printLine(out, '-', &o[i++]);
+    } else if (j < m && lines.newChanged[j]) {
+      printLine(out, '+', &w[j++]);
+    } else {
+      printLine(out, ' ', &w[j]);
+      i++;
+      j++;
+    }
+  }
+  for (size_t k = 0; k < hunk->afterCount; k++) {
+    printLine(out, ' ', &hunk->after[k]);
+  }
+  free(lines.oldChanged);
+  return 0;
+}
+
+// decode the new image from cursor up to the record that touches limit,
+// keeping the last DIFF_CONTEXT lines as the hunk's context and leaving
+// cursor after the last record that does not touch it. Such records are the
+// same in both images.
+static void findContextBefore(const ImageDiff *diff, size_t limit,
+                              Y86Cursor *cursor, Hunk *hunk) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor decoding = *cursor;
+  size_t count;
+
+  hunk->beforeCount = 0;
+  while ((count = y86Decode(diff->newCode, diff->newLength, 0, &decoding,
+                            records, RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      // a record ending right at limit may end there because of the byte
+      // at limit (a zero run, or a record cut short by the end)
+      if (records[i].address + records[i].length >= limit) {
+        return;
+      }
+      if (records[i].kind != Y86_SKIP) {
+        if (hunk->beforeCount == DIFF_CONTEXT) {
+          memmove(hunk->before, hunk->before + 1,
+                  (DIFF_CONTEXT - 1) * sizeof(Y86Instruction));
+          hunk->beforeCount--;
+        }
+        hunk->before[hunk->beforeCount++] = records[i];
+      }
+      y86CursorAfter(&records[i], 0, cursor);
+    }
+  }
+}
+
+// decode up to 2 * DIFF_CONTEXT lines from cursor, where both sweeps agree,
+// that end before limit, the next difference. Returns whether the hunk can
+// end at cursor: there are that many, so the next hunk's context cannot
+// meet this one's, or there are no more differences. If it can, the first
+// DIFF_CONTEXT of them are its context after and cursor is left after them.
+static int findContextAfter(const ImageDiff *diff, size_t limit,
+                            Y86Cursor *cursor, Hunk *hunk) {
+  Y86Instruction insn;
+  Y86Cursor decoding = *cursor;
+  Y86Cursor kept = *cursor;
+  size_t lines = 0;
+  int isLast = limit >= diff->longest;
+
+  while (lines < 2 * DIFF_CONTEXT &&
+         y86Decode(diff->newCode, diff->newLength, 0, &decoding, &insn, 1) >
+             0) {
+    if (!isLast && insn.address + insn.length >= limit) {
+      return 0;
+    }
+    if (insn.kind != Y86_SKIP) {
+      hunk->after[lines++] = insn;
+    }
+    if (lines <= DIFF_CONTEXT) {
+      kept = decoding;
+    }
+  }
+  if (lines < 2 * DIFF_CONTEXT && !isLast) {
+    return 0;
+  }
+  hunk->afterCount = lines < DIFF_CONTEXT ? lines : DIFF_CONTEXT;
+  *cursor = kept;
+  return 1;
+}
+
+// step the sweep of one image a record, adding its line to lines
+static int stepSweep(const uint8_t *bytes, size_t length, Y86Cursor *cursor,
+                     RecordList *lines) {
+  Y86Instruction insn;
+  if (y86Decode(bytes, length, 0, cursor, &insn, 1) == 0) {
+    return 0;
+  }
+  return addLine(lines, &insn);
+}
+
+// follow both sweeps from cursor, record by record, until they meet again
+// where the bytes agree and the hunk can end. Sets *resume to where the
+// hunk's context ends and returns the next difference after it, or the
+// length of the longer image if there is none; -1 if out of memory.
+static long long followSweeps(const ImageDiff *diff, const Y86Cursor *cursor,
+                              Hunk *hunk, Y86Cursor *resume) {
+  Y86Cursor oldCursor = *cursor;
+  Y86Cursor newCursor = *cursor;
+
+  hunk->oldLines.count = 0;
+  hunk->newLines.count = 0;
+  hunk->afterCount = 0;
+  for (;;) {
+    int oldEnded = oldCursor.offset >= diff->oldLength;
+    int newEnded = newCursor.offset >= diff->newLength;
+    if (oldEnded && newEnded) {
+      *resume = newCursor;
+      return (long long)diff->longest;
+    }
+    // step whichever sweep is behind, or both
+    if (!oldEnded && (newEnded || oldCursor.offset <= newCursor.offset) &&
+        stepSweep(diff->oldCode, diff->oldLength, &oldCursor,
+                  &hunk->oldLines) != 0) {
+      return -1;
+    }
+    if (!newEnded && (oldEnded || newCursor.offset <= oldCursor.offset) &&
+        stepSweep(diff->newCode, diff->newLength, &newCursor,
+                  &hunk->newLines) != 0) {
+      return -1;
+    }
+    if (oldCursor.offset == newCursor.offset &&
+        oldCursor.offset < diff->common &&
+        y86CursorsAgree(diff->newCode, diff->newLength, &oldCursor,
+                        &newCursor)) {
+      size_t next = nextDifference(diff, newCursor.offset);
+      *resume = newCursor;
+      if (next > newCursor.offset &&
+          findContextAfter(diff, next, resume, hunk)) {
+        return (long long)next;
+      }
+    }
+  }
+}
+
+long diffImages(const uint8_t *oldCode, size_t oldLength,
+                const uint8_t *newCode, size_t newLength, long startingOffset,
+                const char *oldName, const char *newName,
+                OutputSink *outputFile) {
+  ImageDiff diff = {oldCode,
+                    oldLength,
+                    newCode,
+                    newLength,
+                    oldLength < newLength ? oldLength : newLength,
+                    oldLength < newLength ? newLength : oldLength,
+                    oldName,
+                    newName,
+                    outputFile,
+                    0};
+  Hunk hunk;
+  Y86Cursor resume; // where the last hunk's context ended
+  int res = 0;
+
+  initRecordList(&hunk.oldLines);
+  initRecordList(&hunk.newLines);
+  y86StartCursor(&resume, (size_t)startingOffset);
+  long long next = (long long)nextDifference(&diff, resume.offset);
+  while (res == 0 && (size_t)next < diff.longest) {
+    Y86Cursor cursor = resume;
+    size_t sync = findSyncPoint(newCode, resume.offset, (size_t)next);
+    if (sync != resume.offset) {
+      y86StartCursor(&cursor, sync);
+    }
+    findContextBefore(&diff, (size_t)next, &cursor, &hunk);
+    hunk.address =
+        hunk.beforeCount > 0 ? hunk.before[0].address : cursor.offset;
+    next = followSweeps(&diff, &cursor, &hunk, &resume);
+    if (next < 0 || printHunk(&diff, &hunk) != 0) {
+      res = -1;
+    }
+  }
+  freeRecordList(&hunk.oldLines);
+  freeRecordList(&hunk.newLines);
+  if (res != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return diff.hunks;
+}
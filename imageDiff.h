@@ -0,0 +1,34 @@
+/* This file contains the instruction-level diff of two images (the --diff
+   option), defined in imageDiff.c.
+*/
+
+#ifndef _IMAGEDIFF_H_
+#define _IMAGEDIFF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// Lines of unchanged listing kept around each change.
+#define DIFF_CONTEXT 3
+
+// Print a unified diff of the listings of the sweeps from startingOffset of
+// the images oldCode and newCode, covering only the parts of the images
+// whose bytes differ. Hunk headers give the address of the hunk's first line
+// in place of a line number, as the same for both listings:
+//
+//   --- oldName
+//   +++ newName
+//   @@ -0x100,5 +0x100,6 @@
+//
+// so the diff cannot be applied with patch.
+//
+// Nothing is printed when the listings are the same. Returns the number of
+// hunks printed, or -1 with errno set to ENOMEM.
+long diffImages(const uint8_t *oldCode, size_t oldLength,
+                const uint8_t *newCode, size_t newLength, long startingOffset,
+                const char *oldName, const char *newName,
+                OutputSink *outputFile);
+
+#endif /* IMAGEDIFF */
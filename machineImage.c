@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "machineImage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compressedInput.h"
+#include "objectListing.h"
+
+/*
+  Input layer: the whole image is made addressable up front so the decoder
+  can walk it with a plain pointer instead of one stdio call per byte. A
+  gzip or zstd file is inflated whole into a heap buffer first.
+*/
+
+// read everything from fd into a heap buffer. used when mmap is not possible.
+static int readWholeFile(int fd, MachineImage *image) {
+  size_t capacity = 1 << 16;
+  size_t used = 0;
+  uint8_t *buffer = malloc(capacity);
+  if (buffer == NULL) {
+    return -1;
+  }
+
+  while (1) {
+    if (used == capacity) {
+      uint8_t *grown = realloc(buffer, capacity * 2);
+      if (grown == NULL) {
+        free(buffer);
+        return -1;
+      }
+      buffer = grown;
+      capacity *= 2;
+    }
+    ssize_t got = read(fd, buffer + used, capacity - used);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      free(buffer);
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    used += (size_t)got;
+  }
+
+  image->buffer = buffer;
+  image->bytes = buffer;
+  image->length = used;
+  return 0;
+}
+
+// map the file read-only when it is a regular, non-empty file, and fall back
+// to reading it whole otherwise.
+static int loadFile(const char *path, MachineImage *image) {
+  memset(image, 0, sizeof(*image));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void *mapping =
+        mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+      image->mapping = mapping;
+      image->mappingLength = (size_t)info.st_size;
+      image->bytes = mapping;
+      image->length = (size_t)info.st_size;
+      close(fd);
+      return 0;
+    }
+  }
+
+  int res = readWholeFile(fd, image);
+  int savedErrno = errno;
+  close(fd);
+  errno = savedErrno;
+  return res;
+}
+
+void closeMachineImage(MachineImage *image) {
+  if (image->mapping != NULL) {
+    munmap(image->mapping, image->mappingLength);
+  }
+  free(image->buffer);
+  memset(image, 0, sizeof(*image));
+}
+
+// replace the text of the .yo listing loaded into image with the bytes it
+// describes
+static int loadObjectListing(MachineImage *image) {
+  uint8_t *bytes;
+  size_t length;
+  int res = parseObjectListing((const char *)image->bytes, image->length,
+                               &bytes, &length);
+  int savedErrno = errno;
+  closeMachineImage(image);
+  if (res != 0) {
+    errno = savedErrno;
+    return -1;
+  }
+  image->buffer = bytes;
+  image->bytes = bytes;
+  image->length = length;
+  return 0;
+}
+
+// replace the compressed bytes loaded into image with what they inflate to
+static int loadCompressed(MachineImage *image, int format) {
+  uint8_t *bytes;
+  size_t length;
+  int res =
+      decompressBuffer(image->bytes, image->length, format, &bytes, &length);
+  int savedErrno = errno;
+  closeMachineImage(image);
+  if (res != 0) {
+    errno = savedErrno;
+    return -1;
+  }
+  image->buffer = bytes;
+  image->bytes = bytes;
+  image->length = length;
+  return 0;
+}
+
+int openMachineImage(const char *path, MachineImage *image) {
+  if (loadFile(path, image) != 0) {
+    return -1;
+  }
+  int format = compressedFormat(image->bytes, image->length);
+  if (format != COMPRESSED_NONE && loadCompressed(image, format) != 0) {
+    return -1;
+  }
+  return isObjectListing(path) ? loadObjectListing(image) : 0;
+}
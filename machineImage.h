@@ -0,0 +1,28 @@
+/* This file contains the prototypes and types needed to load a .mem image
+   into memory using the routines defined in machineImage.c
+*/
+
+#ifndef _MACHINEIMAGE_H_
+#define _MACHINEIMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A whole .mem image held in memory. bytes points either into a read-only
+// mapping of the file or into a heap buffer when the file could not be
+// mapped (pipes, character devices, empty files).
+typedef struct {
+  const uint8_t *bytes;
+  size_t length;
+  void *mapping;
+  size_t mappingLength;
+  uint8_t *buffer;
+} MachineImage;
+
+// Map (or read) the file at path. A gzip or zstd file is read as what it
+// inflates to, and a .yo listing (prog.yo, or prog.yo.gz) as the image its
+// lines describe. Returns 0 on success, -1 with errno set.
+int openMachineImage(const char *path, MachineImage *image);
+void closeMachineImage(MachineImage *image);
+
+#endif /* MACHINEIMAGE */
@@ -0,0 +1,223 @@
+#include "objectListing.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compressedInput.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_HEX 1
+#include <immintrin.h>
+#endif
+
+/*
+  .yo parser.
+
+  Lines are found with memchr(), which the C library already runs a vector
+  at a time, and only the address and the byte field at the front of each
+  line are looked at; the source text after the '|' is skipped unread. The
+  byte field is turned into bytes 16 hex digits at a time, written straight
+  into the image at the line's address. An SSE2 kernel checks and converts a
+  whole block of digits with a handful of compares and shifts; the portable
+  one converts digit by digit. yas writes at most 20 digits a line, so the
+  block kernel does the first 16 and the last few go one pair at a time.
+
+  As with the zero scanner the vector kernel is compiled with a target
+  attribute and picked at run time.
+*/
+
+#define HEX_BLOCK_DIGITS 16
+
+// Decode HEX_BLOCK_DIGITS characters at text into half as many bytes at
+// out. Returns 0 without writing if any of them is not a hex digit.
+typedef int (*HexFunction)(const char *text, uint8_t *out);
+
+// what c is worth as a hex digit, 0xFF if it is not one
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : 0xFF;
+}
+
+static int hexBlockDigits(const char *text, uint8_t *out) {
+  uint8_t bytes[HEX_BLOCK_DIGITS / 2];
+  for (int i = 0; i < HEX_BLOCK_DIGITS / 2; i++) {
+    int high = hexValue(text[2 * i]);
+    int low = hexValue(text[2 * i + 1]);
+    if ((high | low) > 0xF) {
+      return 0;
+    }
+    bytes[i] = (uint8_t)(high << 4 | low);
+  }
+  memcpy(out, bytes, sizeof(bytes));
+  return 1;
+}
+
+#ifdef HAVE_X86_HEX
+__attribute__((target("sse2"))) static int hexBlockSse2(const char *text,
+                                                        uint8_t *out) {
+  __m128i chars = _mm_loadu_si128((const __m128i *)text);
+  // a digit is 0-9 after subtracting '0', a letter 0-5 after folding it to
+  // lower case and subtracting 'a'
+  __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)),
+                                _mm_set1_epi8('a'));
+  __m128i isDigit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  __m128i isLetter =
+      _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF) {
+    return 0;
+  }
+  __m128i nibbles =
+      _mm_or_si128(_mm_and_si128(isDigit, digit),
+                   _mm_andnot_si128(isDigit, _mm_add_epi8(
+                                                 letter, _mm_set1_epi8(10))));
+  // each 16-bit lane holds a byte's high nibble in its low half
+  __m128i pairs = _mm_or_si128(
+      _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4),
+      _mm_srli_epi16(nibbles, 8));
+  _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(pairs, pairs));
+  return 1;
+}
+#endif
+
+static HexFunction chooseHexBlock(void) {
+#ifdef HAVE_X86_HEX
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    return hexBlockSse2;
+  }
+#endif
+  return hexBlockDigits;
+}
+
+// chosen on first use. threads racing to choose all store the same value.
+static HexFunction hexBlock;
+
+int isObjectListing(const char *path) {
+  size_t length = strlen(path);
+  length -= compressedSuffixLength(path, length);
+  return length > 3 && strncmp(path + length - 3, ".yo", 3) == 0;
+}
+
+typedef struct {
+  uint8_t *bytes;
+  size_t length; // up to the last byte given
+  size_t capacity;
+} ImageBuffer;
+
+// make room for bytes up to end, zero-filling what is new
+static int reserveImage(ImageBuffer *image, size_t end) {
+  if (end <= image->capacity) {
+    return 0;
+  }
+  size_t capacity = image->capacity < 4096 ? 4096 : image->capacity;
+  while (capacity < end) {
+    capacity *= 2;
+  }
+  uint8_t *grown = realloc(image->bytes, capacity);
+  if (grown == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(grown + image->capacity, 0, capacity - image->capacity);
+  image->bytes = grown;
+  image->capacity = capacity;
+  return 0;
+}
+
+static int isFieldEnd(char c) {
+  return c == ' ' || c == '\t' || c == '|' || c == '\r';
+}
+
+static int isHexPair(const char *text) {
+  return (hexValue(text[0]) | hexValue(text[1])) <= 0xF;
+}
+
+// put the bytes of the line [text, end) into image. Returns 0, or -1 with
+// errno set.
+static int parseLine(const char *text, const char *end, ImageBuffer *image,
+                     HexFunction block) {
+  while (text < end && (*text == ' ' || *text == '\t')) {
+    text++;
+  }
+  // blank lines and lines with no address carry only comments
+  if (end - text < 2 || text[0] != '0' ||
+      (text[1] != 'x' && text[1] != 'X')) {
+    return 0;
+  }
+  text += 2;
+  uint64_t address = 0;
+  int digits = 0;
+  while (text < end && hexValue(*text) <= 0xF) {
+    address = address << 4 | (uint64_t)hexValue(*text++);
+    digits++;
+  }
+  if (digits == 0 || digits > 16 || text == end || *text != ':') {
+    errno = EINVAL;
+    return -1;
+  }
+  text++;
+  while (text < end && (*text == ' ' || *text == '\t')) {
+    text++;
+  }
+
+  // the field cannot hold more bytes than half the rest of the line
+  size_t most = (size_t)(end - text) / 2;
+  uint8_t *out = NULL;
+  if (end - text >= 2 && isHexPair(text)) {
+    if (address > SIZE_MAX / 2 || reserveImage(image, address + most) != 0) {
+      errno = address > SIZE_MAX / 2 ? EINVAL : ENOMEM;
+      return -1;
+    }
+    out = image->bytes + address;
+    while (end - text >= HEX_BLOCK_DIGITS && block(text, out)) {
+      text += HEX_BLOCK_DIGITS;
+      out += HEX_BLOCK_DIGITS / 2;
+    }
+    while (end - text >= 2 && isHexPair(text)) {
+      *out++ = (uint8_t)(hexValue(text[0]) << 4 | hexValue(text[1]));
+      text += 2;
+    }
+  }
+  if (text < end && !isFieldEnd(*text)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (out != NULL && (size_t)(out - image->bytes) > image->length) {
+    image->length = (size_t)(out - image->bytes);
+  }
+  return 0;
+}
+
+int parseObjectListing(const char *text, size_t length, uint8_t **bytes,
+                       size_t *imageLength) {
+  ImageBuffer image = {NULL, 0, 0};
+  const char *end = text + length;
+
+  // even a listing with no bytes makes an image, an empty one
+  if (reserveImage(&image, 1) != 0) {
+    return -1;
+  }
+  HexFunction block = __atomic_load_n(&hexBlock, __ATOMIC_RELAXED);
+  if (block == NULL) {
+    block = chooseHexBlock();
+    __atomic_store_n(&hexBlock, block, __ATOMIC_RELAXED);
+  }
+  while (text < end) {
+    const char *newline = memchr(text, '\n', (size_t)(end - text));
+    const char *lineEnd = newline == NULL ? end : newline;
+    if (parseLine(text, lineEnd, &image, block) != 0) {
+      free(image.bytes);
+      return -1;
+    }
+    text = lineEnd + 1;
+  }
+  *bytes = image.bytes;
+  *imageLength = image.length;
+  return 0;
+}
@@ -0,0 +1,30 @@
+/* This file contains the parser for .yo object listings, the text yas
+   writes alongside (or instead of) a .mem image, defined in
+   objectListing.c.
+*/
+
+#ifndef _OBJECTLISTING_H_
+#define _OBJECTLISTING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Whether path names a .yo listing rather than a .mem image, compressed
+// (prog.yo.gz, prog.yo.zst) or not.
+int isObjectListing(const char *path);
+
+// Build the image a .yo listing describes from its text (length bytes).
+// Each line of the form
+//
+//   0x100: 30f24001000000000000 | irmovq $0x140, %rdx
+//
+// puts its bytes at its address; lines without bytes (.pos, labels,
+// comments) put none, and every byte no line gives is zero. The image ends
+// after the last byte given. On success *bytes is a heap buffer of
+// *imageLength bytes for the caller to free, and 0 is returned; otherwise -1
+// with errno set to EINVAL for a line whose byte field is not whole hex
+// bytes, or to ENOMEM.
+int parseObjectListing(const char *text, size_t length, uint8_t **bytes,
+                       size_t *imageLength);
+
+#endif /* OBJECTLISTING */
@@ -0,0 +1,125 @@
+#include "opcodeTable.h"
+
+#include <stddef.h>
+
+/*
+  Compile-time descriptor tables for the Y86-64 instruction set. Each row of
+  opcodeTable covers one icode (the bigNibble) and its 16 ifuns (the
+  littleNibble), so decoding an instruction is a single lookup on its first
+  byte.
+*/
+
+#define REQUIRE_REGS (REG_A_VALID | REG_B_VALID)
+
+// the padded mnemonic is the name followed by enough spaces that its first 8
+// characters are the name left-justified in an 8-character column.
+#define OP(name, len, shape, flags, regs)                                      \
+  { name, name "        ", len, shape, (flags) | OP_VALID, regs }
+#define BAD(flags) { NULL, NULL, 0, SHAPE_NONE, flags, 0 }
+
+#define REPEAT9(m, a) m(a), m(a), m(a), m(a), m(a), m(a), m(a), m(a), m(a)
+#define REPEAT15(m, a) REPEAT9(m, a), m(a), m(a), m(a), m(a), m(a), m(a)
+#define REPEAT16(m, a) REPEAT15(m, a), m(a)
+
+#define REG_OP(name, shape, flags)                                             \
+  OP(name, 2, shape, OP_REGISTER_BYTE | (flags), REQUIRE_REGS)
+#define DEST_OP(name) OP(name, 9, SHAPE_DEST, OP_IMMEDIATE, 0)
+
+const OpcodeDescriptor opcodeTable[256] = {
+    // 0x00 halt
+    OP("halt", 1, SHAPE_NONE, OP_SEGMENT_END, 0),
+    REPEAT15(BAD, OP_SEGMENT_END),
+    // 0x10 nop
+    OP("nop", 1, SHAPE_NONE, 0, 0),
+    REPEAT15(BAD, 0),
+    // 0x20 rrmovq and cmovXX
+    REG_OP("rrmovq", SHAPE_REG_REG, 0),
+    REG_OP("cmovle", SHAPE_REG_REG, 0),
+    REG_OP("cmovl", SHAPE_REG_REG, 0),
+    REG_OP("cmove", SHAPE_REG_REG, 0),
+    REG_OP("cmovne", SHAPE_REG_REG, 0),
+    REG_OP("cmovge", SHAPE_REG_REG, 0),
+    REG_OP("cmovg", SHAPE_REG_REG, 0),
+    REPEAT9(BAD, OP_REGISTER_BYTE),
+    // 0x30 irmovq
+    OP("irmovq", 10, SHAPE_IMM_REG, OP_REGISTER_BYTE | OP_IMMEDIATE,
+       REG_A_NONE | REG_B_VALID),
+    REPEAT15(BAD, OP_REGISTER_BYTE),
+    // 0x40 rmmovq
+    OP("rmmovq", 10, SHAPE_REG_MEM, OP_REGISTER_BYTE | OP_IMMEDIATE,
+       REQUIRE_REGS),
+    REPEAT15(BAD, OP_REGISTER_BYTE),
+    // 0x50 mrmovq
+    OP("mrmovq", 10, SHAPE_MEM_REG, OP_REGISTER_BYTE | OP_IMMEDIATE,
+       REQUIRE_REGS),
+    REPEAT15(BAD, OP_REGISTER_BYTE),
+    // 0x60 OPq
+    REG_OP("addq", SHAPE_REG_REG, 0),
+    REG_OP("subq", SHAPE_REG_REG, 0),
+    REG_OP("andq", SHAPE_REG_REG, 0),
+    REG_OP("xorq", SHAPE_REG_REG, 0),
+    REG_OP("mulq", SHAPE_REG_REG, 0),
+    REG_OP("divq", SHAPE_REG_REG, 0),
+    REG_OP("modq", SHAPE_REG_REG, 0),
+    REPEAT9(BAD, OP_REGISTER_BYTE),
+    // 0x70 jXX
+    DEST_OP("jmp"),
+    DEST_OP("jle"),
+    DEST_OP("jl"),
+    DEST_OP("je"),
+    DEST_OP("jne"),
+    DEST_OP("jge"),
+    DEST_OP("jg"),
+    REPEAT9(BAD, 0),
+    // 0x80 call
+    DEST_OP("call"),
+    REPEAT15(BAD, 0),
+    // 0x90 ret
+    OP("ret", 1, SHAPE_NONE, 0, 0),
+    REPEAT15(BAD, 0),
+    // 0xA0 pushq
+    OP("pushq", 2, SHAPE_REG, OP_REGISTER_BYTE, REG_A_VALID | REG_B_NONE),
+    REPEAT15(BAD, OP_REGISTER_BYTE),
+    // 0xB0 popq
+    OP("popq", 2, SHAPE_REG, OP_REGISTER_BYTE, REG_A_VALID | REG_B_NONE),
+    REPEAT15(BAD, OP_REGISTER_BYTE),
+    // 0xC0 - 0xF0 are not instructions
+    REPEAT16(BAD, OP_UNKNOWN),
+    REPEAT16(BAD, OP_UNKNOWN),
+    REPEAT16(BAD, OP_UNKNOWN),
+    REPEAT16(BAD, OP_UNKNOWN),
+};
+
+#define NAME_0 "%rax"
+#define NAME_1 "%rcx"
+#define NAME_2 "%rdx"
+#define NAME_3 "%rbx"
+#define NAME_4 "%rsp"
+#define NAME_5 "%rbp"
+#define NAME_6 "%rsi"
+#define NAME_7 "%rdi"
+#define NAME_8 "%r8"
+#define NAME_9 "%r9"
+#define NAME_A "%r10"
+#define NAME_B "%r11"
+#define NAME_C "%r12"
+#define NAME_D "%r13"
+#define NAME_E "%r14"
+#define NAME_F ""
+
+#define REG(hi, lo)                                                            \
+  {                                                                            \
+    NAME_##hi, NAME_##lo, sizeof(NAME_##hi) - 1, sizeof(NAME_##lo) - 1,        \
+        (0x##hi == 0xF ? REG_A_NONE : REG_A_VALID) |                           \
+            (0x##lo == 0xF ? REG_B_NONE : REG_B_VALID)                         \
+  }
+#define REG_ROW(hi)                                                            \
+  REG(hi, 0), REG(hi, 1), REG(hi, 2), REG(hi, 3), REG(hi, 4), REG(hi, 5),      \
+      REG(hi, 6), REG(hi, 7), REG(hi, 8), REG(hi, 9), REG(hi, A), REG(hi, B),  \
+      REG(hi, C), REG(hi, D), REG(hi, E), REG(hi, F)
+
+const RegisterByte registerTable[256] = {
+    REG_ROW(0), REG_ROW(1), REG_ROW(2), REG_ROW(3), REG_ROW(4), REG_ROW(5),
+    REG_ROW(6), REG_ROW(7), REG_ROW(8), REG_ROW(9), REG_ROW(A), REG_ROW(B),
+    REG_ROW(C), REG_ROW(D), REG_ROW(E), REG_ROW(F),
+};
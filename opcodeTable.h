@@ -0,0 +1,65 @@
+/* This file contains the instruction descriptor tables defined in
+   opcodeTable.c. They are the single description of the Y86-64 encoding:
+   the decoder uses them to validate bytes and the print routines use them
+   for mnemonics, register names and operand layout.
+*/
+
+#ifndef _OPCODETABLE_H_
+#define _OPCODETABLE_H_
+
+#include <stdint.h>
+
+// Operand shapes, i.e. how the operands of an instruction are laid out in
+// the listing.
+enum {
+  SHAPE_NONE,      // halt, nop, ret
+  SHAPE_REG_REG,   // rrmovq, cmovXX, OPq:  rA, rB
+  SHAPE_IMM_REG,   // irmovq:               $V, rB
+  SHAPE_REG_MEM,   // rmmovq:               rA, D(rB)
+  SHAPE_MEM_REG,   // mrmovq:               D(rB), rA
+  SHAPE_DEST,      // jXX, call:            Dest
+  SHAPE_REG        // pushq, popq:          rA
+};
+
+// Opcode flags
+#define OP_VALID 0x01         // the icode/ifun pair is a real instruction
+#define OP_REGISTER_BYTE 0x02 // the icode is followed by an rA:rB byte
+#define OP_IMMEDIATE 0x04     // the icode carries an 8-byte value
+#define OP_SEGMENT_END 0x08   // zero bytes after this icode are a .pos gap
+#define OP_UNKNOWN 0x10       // icode 0xC-0xF, skipped without output
+
+// Register byte flags. An opcode lists the flags its register byte must
+// have in registerRequirements.
+#define REG_A_VALID 0x01 // rA is %rax..%r14
+#define REG_A_NONE 0x02  // rA is 0xF
+#define REG_B_VALID 0x04 // rB is %rax..%r14
+#define REG_B_NONE 0x08  // rB is 0xF
+
+typedef struct {
+  const char *mnemonic;       // NULL when the encoding is invalid
+  const char *paddedMnemonic; // first 8 characters are the mnemonic padded
+                              // with spaces, ready to copy into a listing
+  uint8_t length;             // length of the valid encoding in bytes
+  uint8_t shape;
+  uint8_t flags;
+  uint8_t registerRequirements;
+} OpcodeDescriptor;
+
+typedef struct {
+  const char *rA;
+  const char *rB;
+  uint8_t rALength;
+  uint8_t rBLength;
+  uint8_t flags;
+} RegisterByte;
+
+// Indexed by the full first byte of an instruction.
+extern const OpcodeDescriptor opcodeTable[256];
+
+// Indexed by the full rA:rB byte.
+extern const RegisterByte registerTable[256];
+
+// Bytes consumed by an invalid encoding before it is printed as data.
+#define INVALID_INSTR_BYTES 8
+
+#endif /* OPCODETABLE */
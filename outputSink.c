@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "outputSink.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+int openOutputSink(OutputSink *sink, int fd, size_t capacity) {
+  memset(sink, 0, sizeof(*sink));
+  sink->fd = fd;
+  sink->capacity = capacity < MAX_RECORD_TEXT ? MAX_RECORD_TEXT : capacity;
+  sink->buffer = malloc(sink->capacity);
+  return sink->buffer == NULL ? -1 : 0;
+}
+
+// write length bytes from data to the sink's fd, recording the first error.
+static int writeAll(OutputSink *sink, const char *data, size_t length) {
+  size_t done = 0;
+  int res = 0;
+  if (sink->stats != NULL) {
+    chargeStats(sink->stats, PHASE_FORMAT);
+  }
+  while (done < length) {
+    ssize_t written = write(sink->fd, data + done, length - done);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (sink->error == 0) {
+        sink->error = errno;
+      }
+      res = -1;
+      break;
+    }
+    done += (size_t)written;
+  }
+  sink->bytesWritten += done;
+  if (sink->stats != NULL) {
+    chargeStats(sink->stats, PHASE_WRITE);
+  }
+  return res;
+}
+
+int flushOutputSink(OutputSink *sink) {
+  if (sink->fd < 0) {
+    return 0;
+  }
+  int res = writeAll(sink, sink->buffer, sink->used);
+  sink->used = 0;
+  return res;
+}
+
+int closeOutputSink(OutputSink *sink) {
+  flushOutputSink(sink);
+  free(sink->buffer);
+  sink->buffer = NULL;
+  sink->capacity = 0;
+  if (sink->error != 0) {
+    errno = sink->error;
+    return -1;
+  }
+  return 0;
+}
+
+char *reserveOutput(OutputSink *sink, size_t bytes) {
+  if (sink->fd < 0 && sink->error != 0) {
+    // a failed in-memory sink formats every record over the last one
+    sink->used = 0;
+    return sink->buffer;
+  }
+  if (sink->capacity - sink->used >= bytes) {
+    return sink->buffer + sink->used;
+  }
+  if (sink->fd >= 0 && bytes <= sink->capacity) {
+    flushOutputSink(sink);
+    return sink->buffer + sink->used;
+  }
+
+  // in-memory sinks (and oversized requests) grow the buffer instead
+  size_t capacity = sink->capacity;
+  while (capacity - sink->used < bytes) {
+    capacity *= 2;
+  }
+  char *grown = realloc(sink->buffer, capacity);
+  if (grown == NULL) {
+    if (sink->error == 0) {
+      sink->error = ENOMEM;
+    }
+    sink->used = 0;
+    return sink->buffer;
+  }
+  sink->buffer = grown;
+  sink->capacity = capacity;
+  return sink->buffer + sink->used;
+}
+
+void commitOutput(OutputSink *sink, char *end) {
+  sink->used = (size_t)(end - sink->buffer);
+}
+
+void appendOutput(OutputSink *sink, const char *text, size_t length) {
+  // blocks too big for the buffer are written straight through instead of
+  // being copied into it
+  if (sink->fd >= 0 && length >= sink->capacity) {
+    flushOutputSink(sink);
+    writeAll(sink, text, length);
+    return;
+  }
+  char *dst = reserveOutput(sink, length);
+  if (sink->fd < 0 && sink->error != 0) {
+    return;
+  }
+  memcpy(dst, text, length);
+  sink->used += length;
+}
+
+// the digit count comes straight from the position of the highest set bit,
+// so the only loop is over the digits themselves.
+static size_t formatHexDigits(char *dst, uint64_t value, const char *digits) {
+  int bits = 64 - __builtin_clzll(value | 1);
+  size_t count = (size_t)(bits + 3) / 4;
+  for (size_t i = count; i > 0; i--) {
+    dst[i - 1] = digits[value & 0xF];
+    value >>= 4;
+  }
+  return count;
+}
+
+size_t formatHex(char *dst, uint64_t value) {
+  return formatHexDigits(dst, value, "0123456789abcdef");
+}
+
+size_t formatHexUpper(char *dst, uint64_t value) {
+  return formatHexDigits(dst, value, "0123456789ABCDEF");
+}
+
+size_t formatDecimal(char *dst, uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = digits[count - 1 - i];
+  }
+  return count;
+}
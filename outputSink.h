@@ -0,0 +1,56 @@
+/* This file contains the output buffer used by the print routines, defined
+   in outputSink.c. Text is formatted straight into one large buffer which is
+   handed to write(2) only when it fills up, instead of going through stdio.
+*/
+
+#ifndef _OUTPUTSINK_H_
+#define _OUTPUTSINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTPUT_SINK_CAPACITY (1 << 20)
+
+// Longest text any single print routine produces; callers reserve this much
+// before formatting a record.
+#define MAX_RECORD_TEXT 128
+
+// An output buffer draining into fd. With fd < 0 nothing is written and the
+// buffer grows instead, which collects the whole output in memory; if it
+// cannot grow, error is set to ENOMEM and from then on the text is dropped,
+// so the caller must check error before using it.
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t used;
+  size_t capacity;
+  uint64_t bytesWritten;
+  int error; // errno of the first failed write or growth, 0 if none
+  // when set, the time before each write is charged to formatting and the
+  // write itself to writing (--stats)
+  struct RunStats *stats;
+} OutputSink;
+
+// Returns 0 on success, -1 if the buffer could not be allocated.
+int openOutputSink(OutputSink *sink, int fd, size_t capacity);
+// Write out everything buffered so far. Returns 0, or -1 with errno set.
+int flushOutputSink(OutputSink *sink);
+// Flush and release the buffer (the fd is left open). Returns -1 if any
+// write failed along the way.
+int closeOutputSink(OutputSink *sink);
+
+// Make room for at least bytes more characters and return where they go.
+// Format into the returned pointer, then pass the end to commitOutput().
+char *reserveOutput(OutputSink *sink, size_t bytes);
+void commitOutput(OutputSink *sink, char *end);
+
+void appendOutput(OutputSink *sink, const char *text, size_t length);
+
+// Write value in hex without leading zeros (like %lx / %lX) to dst and
+// return the number of characters written.
+size_t formatHex(char *dst, uint64_t value);
+size_t formatHexUpper(char *dst, uint64_t value);
+// Likewise in decimal (like %lu).
+size_t formatDecimal(char *dst, uint64_t value);
+
+#endif /* OUTPUTSINK */
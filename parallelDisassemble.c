@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallelDisassemble.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "decoder.h"
+#include "printRoutines.h"
+#include "recordList.h"
+
+/*
+  Multi-threaded linear sweep.
+
+  The image is cut into one chunk per thread and every chunk is decoded at
+  the same time. Only the first chunk starts where the real sweep does; the
+  others guess that an instruction starts at their first byte. Once all
+  chunks are decoded, the real sweep is followed across each boundary: it is
+  re-decoded record by record from where the previous chunk really ended
+  until it lands on a record boundary the speculative decode also produced,
+  in the same state. From there both decodes are identical, so the rest of
+  the chunk is kept as it is. Finally the chunks are formatted in parallel
+  and written out in address order, so the listing is byte-identical to the
+  single-threaded one.
+
+  Cuts are placed just after a long run of zero bytes wherever possible.
+  Whatever state the sweep enters such a run in, it leaves it as a new .pos
+  segment at the first non-zero byte, so the guess is always right there.
+*/
+
+// chunks smaller than this are not worth a thread
+#define MIN_CHUNK_BYTES (64 * 1024)
+// an instruction can overlap at most 9 bytes of a zero run and a halt 2
+// more, so a run this long always ends in a .pos at the next non-zero byte
+#define SYNC_ZERO_RUN 16
+// how far past a nominal chunk boundary to look for such a run
+#define CUT_SEARCH_BYTES (1 << 20)
+
+typedef struct {
+  const uint8_t *bytes;
+  size_t length;
+  size_t start;
+  size_t end;
+  int isFirstChunk;
+  RecordList speculative; // decoded by the worker from start
+  RecordList bridge;      // the real sweep, up to where it meets speculative
+  size_t firstAdopted;    // first speculative record the real sweep reaches
+  RecordPrinter print;
+  OutputSink text;
+  int failed;
+} Chunk;
+
+// return the first non-zero byte after a zero run of at least SYNC_ZERO_RUN
+// bytes in [from, limit), or from itself if there is none.
+static size_t findCut(const uint8_t *bytes, size_t from, size_t limit) {
+  size_t run = 0;
+  for (size_t i = from; i < limit; i++) {
+    if (bytes[i] == 0) {
+      run++;
+    } else if (run >= SYNC_ZERO_RUN) {
+      return i;
+    } else {
+      run = 0;
+    }
+  }
+  return from;
+}
+
+static void *decodeChunk(void *arg) {
+  Chunk *chunk = arg;
+  Y86Cursor cursor;
+  y86StartCursor(&cursor, chunk->start);
+  cursor.atSegmentStart = chunk->isFirstChunk;
+  if (decodeIntoList(chunk->bytes, chunk->length, &cursor, chunk->end,
+                     &chunk->speculative) != 0) {
+    chunk->failed = 1;
+  }
+  return NULL;
+}
+
+static void *formatChunk(void *arg) {
+  Chunk *chunk = arg;
+  size_t count = chunk->bridge.count + chunk->speculative.count;
+  if (openOutputSink(&chunk->text, -1, count * 32 + MAX_RECORD_TEXT) != 0) {
+    chunk->failed = 1;
+    return NULL;
+  }
+  int isFirstPosFlag = chunk->isFirstChunk;
+  for (size_t i = 0; i < chunk->bridge.count; i++) {
+    chunk->print(&chunk->text, &chunk->bridge.records[i], isFirstPosFlag);
+    isFirstPosFlag = 0;
+  }
+  for (size_t i = chunk->firstAdopted; i < chunk->speculative.count; i++) {
+    chunk->print(&chunk->text, &chunk->speculative.records[i],
+                 isFirstPosFlag);
+    isFirstPosFlag = 0;
+  }
+  if (chunk->text.error != 0) {
+    chunk->failed = 1;
+  }
+  return NULL;
+}
+
+// run work on every chunk, one thread each. a chunk whose thread cannot be
+// started is handled on this thread instead.
+static void runOnChunks(Chunk *chunks, int count, void *(*work)(void *)) {
+  pthread_t *workers = calloc((size_t)count, sizeof(pthread_t));
+  int *started = calloc((size_t)count, sizeof(int));
+
+  for (int i = 0; i < count; i++) {
+    if (workers != NULL && started != NULL &&
+        pthread_create(&workers[i], NULL, work, &chunks[i]) == 0) {
+      started[i] = 1;
+    } else {
+      work(&chunks[i]);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (started != NULL && started[i]) {
+      pthread_join(workers[i], NULL);
+    }
+  }
+  free(workers);
+  free(started);
+}
+
+// follow the real sweep across every chunk boundary, filling in each chunk's
+// bridge and firstAdopted. returns -1 if a bridge could not grow.
+static int resynchronise(Chunk *chunks, int count) {
+  Y86Cursor truth;
+  y86StartCursor(&truth, chunks[0].start);
+  if (chunks[0].speculative.count > 0) {
+    RecordList *list = &chunks[0].speculative;
+    y86CursorAfter(&list->records[list->count - 1], 0, &truth);
+  }
+
+  for (int k = 1; k < count; k++) {
+    Chunk *chunk = &chunks[k];
+    const Y86Instruction *spec = chunk->speculative.records;
+    size_t i = 0;
+
+    chunk->firstAdopted = chunk->speculative.count;
+    while (truth.offset < chunk->end) {
+      while (i < chunk->speculative.count && spec[i].address < truth.offset) {
+        i++;
+      }
+      if (i < chunk->speculative.count) {
+        // where the speculative sweep stood before record i
+        Y86Cursor before = {chunk->start, 0};
+        if (i > 0) {
+          y86CursorAfter(&spec[i - 1], 0, &before);
+        }
+        if (y86CursorsAgree(chunk->bytes, chunk->length, &truth, &before)) {
+          chunk->firstAdopted = i;
+          break;
+        }
+      }
+      Y86Instruction *out = reserveRecords(&chunk->bridge, 1);
+      if (out == NULL) {
+        return -1;
+      }
+      chunk->bridge.count +=
+          y86Decode(chunk->bytes, chunk->length, 0, &truth, out, 1);
+    }
+
+    if (chunk->firstAdopted < chunk->speculative.count) {
+      y86CursorAfter(&spec[chunk->speculative.count - 1], 0, &truth);
+    }
+  }
+  return 0;
+}
+
+int disassembleParallel(const uint8_t *machineCode, size_t length,
+                        long startingOffset, int threads, RecordPrinter print,
+                        OutputSink *outputFile) {
+  size_t start = (size_t)startingOffset;
+  size_t span = start < length ? length - start : 0;
+  int count = threads;
+  if ((size_t)count > span / MIN_CHUNK_BYTES) {
+    count = (int)(span / MIN_CHUNK_BYTES);
+  }
+  if (count < 1) {
+    count = 1;
+  }
+
+  Chunk *chunks = calloc((size_t)count, sizeof(Chunk));
+  if (chunks == NULL) {
+    return -1;
+  }
+
+  // cut the image at nominal, evenly spaced boundaries, moved forward to
+  // the end of a zero run when there is one nearby
+  for (int k = 0; k < count; k++) {
+    size_t nominal = start + span / (size_t)count * (size_t)k;
+    size_t next = k + 1 < count ? start + span / (size_t)count * (size_t)(k + 1)
+                                : length;
+    size_t limit = nominal + CUT_SEARCH_BYTES < next
+                       ? nominal + CUT_SEARCH_BYTES
+                       : next;
+    chunks[k].bytes = machineCode;
+    chunks[k].length = length;
+    chunks[k].start = k == 0 ? start : findCut(machineCode, nominal, limit);
+    chunks[k].isFirstChunk = k == 0;
+    chunks[k].print = print;
+    initRecordList(&chunks[k].speculative);
+    initRecordList(&chunks[k].bridge);
+  }
+  for (int k = 0; k < count; k++) {
+    chunks[k].end = k + 1 < count ? chunks[k + 1].start : length;
+  }
+
+  int res = 0;
+  runOnChunks(chunks, count, decodeChunk);
+  for (int k = 0; k < count; k++) {
+    res |= chunks[k].failed ? -1 : 0;
+  }
+  if (res == 0) {
+    res = resynchronise(chunks, count);
+  }
+  if (res == 0) {
+    runOnChunks(chunks, count, formatChunk);
+    for (int k = 0; k < count; k++) {
+      res |= chunks[k].failed ? -1 : 0;
+    }
+  }
+  // the chunks' text is written out in address order
+  for (int k = 0; k < count; k++) {
+    if (res == 0) {
+      appendOutput(outputFile, chunks[k].text.buffer, chunks[k].text.used);
+    }
+    closeOutputSink(&chunks[k].text);
+    freeRecordList(&chunks[k].speculative);
+    freeRecordList(&chunks[k].bridge);
+  }
+  free(chunks);
+  return res;
+}
@@ -0,0 +1,21 @@
+/* This file contains the prototype for the multi-threaded sweep defined in
+   parallelDisassemble.c (the -j option).
+*/
+
+#ifndef _PARALLELDISASSEMBLE_H_
+#define _PARALLELDISASSEMBLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+#include "printRoutines.h"
+
+// Print the same listing as disassemble(), decoding and formatting chunks
+// of the image on up to threads worker threads. Returns 0, or -1 if memory
+// or threads ran out.
+int disassembleParallel(const uint8_t *machineCode, size_t length,
+                        long startingOffset, int threads, RecordPrinter print,
+                        OutputSink *outputFile);
+
+#endif /* PARALLELDISASSEMBLE */
@@ -0,0 +1,852 @@
+#include "peephole.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "hazards.h"
+#include "printRoutines.h"
+#include "recursiveDescent.h"
+#include "xrefIndex.h"
+
+/*
+  Peephole optimiser.
+
+  The image is traced as --recursive traces it, so only code that can run is
+  touched; every other byte is printed back as data. Reached instructions
+  that follow each other in memory up to a halt, ret or jmp form a run.
+  Branches name their destinations by label and a run that got shorter is
+  followed by a .pos back to the address the next line had, so the file
+  yas assembles from the listing keeps every address outside the changed
+  runs. Code addresses held in constants cannot follow a run that moved, so
+  a run is left alone if, past its first change, it has an instruction that
+  an irmovq or a data quad names (a return address, say), or a byte that a
+  branch into the middle of an instruction lands on. Displacements only
+  ever read or write code as data, and self-modifying code is not followed.
+
+  Each run is cut into basic blocks at branch destinations and after every
+  jXX, call, ret and halt, and every block is optimised on its own, taking
+  every register and condition code as live where it ends:
+
+    values      a forward pass tracks which registers hold a known constant
+                or a copy of another register. Copies read from the
+                original, a copy or constant load of what is already there
+                is dropped, and adding (or subtracting or xoring) a register
+                holding zero becomes andq, which sets the same flags.
+    constants   irmovq $a, X; addq X, Y; irmovq $b, X; addq X, Y becomes
+                irmovq $(a+b), X; addq X, Y when neither X nor the overflow
+                flag (the one flag that can differ) is read afterwards.
+    dead writes a backward liveness pass drops moves and arithmetic whose
+                register and flags are overwritten before anything reads
+                them.
+    stalls      an independent move or arithmetic instruction from after
+                the instruction that uses a load's result is moved up
+                between the two.
+
+  An instruction that touches memory can fault and stop the program, which
+  must then stop with the registers and flags it would have had anyway: no
+  line moves past one, and everything is live where one is.
+
+  The passes repeat while they find something, and a block keeps its
+  changes only if they save cycles by the count of the hazard model:
+  one cycle per instruction plus one per load/use stall.
+*/
+
+#define REG(r) ((r) < 15 ? 1u << (r) : 0u)
+#define FLAG_Z (1u << 15)
+#define FLAG_S (1u << 16)
+#define FLAG_O (1u << 17)
+#define ALL_FLAGS (FLAG_Z | FLAG_S | FLAG_O)
+#define EVERYTHING ((1u << 18) - 1)
+
+// OPq functions
+enum { ALU_ADD, ALU_SUB, ALU_AND, ALU_XOR };
+
+// passes over a block before giving up on it settling down
+#define MAX_ROUNDS 8
+// instructions searched after a load's use for one to fill its stall
+#define MOVE_WINDOW 8
+#define DESCRIPTION_TEXT 64
+
+typedef struct {
+  enum { VALUE_UNKNOWN, VALUE_CONSTANT, VALUE_COPY } kind;
+  uint64_t constant;
+  int reg; // the register this one is a copy of
+} Value;
+
+typedef struct {
+  Y86Instruction insn; // as it will be printed
+  Y86Instruction original;
+  const char *reason; // why insn differs from original, NULL if it does not
+  int removed;
+  int moved;
+} Line;
+
+typedef struct {
+  const uint8_t *bytes;
+  size_t length;
+  uint8_t *starts;
+  uint8_t *listed; // the starts that get a line, not passed over
+  XrefIndex xrefs;
+  uint64_t *pinned; // addresses constants hold, sorted
+  size_t pinnedCount;
+  size_t pinnedCapacity;
+  // the run being optimised, with the original of each position and the
+  // positions that start a block
+  Line *lines;
+  Line *saved;
+  uint64_t *addresses;
+  uint8_t *blockStarts;
+  uint32_t *live;
+  size_t count;
+  size_t capacity;
+  OutputSink scratch;
+  // the report
+  uint64_t removed;
+  uint64_t rewritten;
+  uint64_t moved;
+  uint64_t cyclesSaved;
+  uint64_t blocks;
+  uint64_t runsPinned;
+} Optimiser;
+
+static uint32_t conditionFlags(int ifun) {
+  switch (ifun) {
+  case 1: // le
+  case 6: // g
+    return FLAG_Z | FLAG_S | FLAG_O;
+  case 2: // l
+  case 5: // ge
+    return FLAG_S | FLAG_O;
+  case 3: // e
+  case 4: // ne
+    return FLAG_Z;
+  default:
+    return 0;
+  }
+}
+
+// the registers and condition codes insn reads
+static uint32_t usesOf(const Y86Instruction *insn) {
+  switch (insn->icode) {
+  case I_RRMOVQ:
+    // a cmovXX that does not move leaves rB as it was
+    return REG(insn->rA) |
+           (insn->ifun != 0 ? conditionFlags(insn->ifun) | REG(insn->rB) : 0);
+  case I_RMMOVQ:
+  case I_OPQ:
+    return REG(insn->rA) | REG(insn->rB);
+  case I_MRMOVQ:
+    return REG(insn->rB);
+  case I_JXX:
+    return conditionFlags(insn->ifun);
+  case I_CALL:
+  case I_RET:
+  case I_POPQ:
+    return REG(RSP);
+  case I_PUSHQ:
+    return REG(insn->rA) | REG(RSP);
+  default:
+    return 0;
+  }
+}
+
+// the registers and condition codes insn may write
+static uint32_t defsOf(const Y86Instruction *insn) {
+  switch (insn->icode) {
+  case I_RRMOVQ:
+  case I_IRMOVQ:
+    return REG(insn->rB);
+  case I_MRMOVQ:
+    return REG(insn->rA);
+  case I_OPQ:
+    return REG(insn->rB) | ALL_FLAGS;
+  case I_CALL:
+  case I_RET:
+  case I_PUSHQ:
+    return REG(RSP);
+  case I_POPQ:
+    return REG(RSP) | REG(insn->rA);
+  default:
+    return 0;
+  }
+}
+
+// what insn certainly overwrites
+static uint32_t killsOf(const Y86Instruction *insn) {
+  return insn->icode == I_RRMOVQ && insn->ifun != 0 ? 0 : defsOf(insn);
+}
+
+// whether insn only computes registers and flags, touching no memory and
+// unable to fault, so it may be dropped or moved
+static int isPure(const Y86Instruction *insn) {
+  return insn->icode == I_RRMOVQ || insn->icode == I_IRMOVQ ||
+         (insn->icode == I_OPQ && insn->ifun <= ALU_XOR);
+}
+
+// whether insn can stop the program with an exception
+static int canFault(const Y86Instruction *insn) {
+  return insn->icode != I_NOP && !isPure(insn);
+}
+
+// whether a and b can trade places
+static int independent(const Y86Instruction *a, const Y86Instruction *b) {
+  return (defsOf(a) & (usesOf(b) | defsOf(b))) == 0 &&
+         (usesOf(a) & defsOf(b)) == 0;
+}
+
+static int stalls(const Y86Instruction *load, const Y86Instruction *use) {
+  return LOADS_REGISTER(load->icode) &&
+         readsRegister(use->icode, use->rA, use->rB, load->rA);
+}
+
+// the index of the first line at or after i that is still there, or count
+static size_t nextLine(const Line *lines, size_t i, size_t count) {
+  while (i < count && lines[i].removed) {
+    i++;
+  }
+  return i;
+}
+
+// the cycles a block takes by the hazard model: one per instruction and
+// one per load/use stall
+static uint64_t blockCycles(const Line *lines, size_t count) {
+  uint64_t cycles = 0;
+  const Line *previous = NULL;
+  for (size_t i = nextLine(lines, 0, count); i < count;
+       i = nextLine(lines, i + 1, count)) {
+    cycles += 1 + (previous != NULL && stalls(&previous->insn, &lines[i].insn));
+    previous = &lines[i];
+  }
+  return cycles;
+}
+
+static void removeLine(Line *line, const char *reason) {
+  line->removed = 1;
+  line->reason = reason;
+}
+
+static int root(const Value *values, int reg) {
+  return values[reg].kind == VALUE_COPY ? values[reg].reg : reg;
+}
+
+static int holdsSame(const Value *values, int a, int b) {
+  if (values[a].kind == VALUE_CONSTANT && values[b].kind == VALUE_CONSTANT) {
+    return values[a].constant == values[b].constant;
+  }
+  return root(values, a) == root(values, b);
+}
+
+static int holdsConstant(const Value *values, int reg, uint64_t constant) {
+  return reg < 15 && values[reg].kind == VALUE_CONSTANT &&
+         values[reg].constant == constant;
+}
+
+// forget what reg held, and that other registers copied it
+static void forget(Value *values, int reg) {
+  values[reg].kind = VALUE_UNKNOWN;
+  for (int r = 0; r < 15; r++) {
+    if (values[r].kind == VALUE_COPY && values[r].reg == reg) {
+      values[r].kind = VALUE_UNKNOWN;
+    }
+  }
+}
+
+// read *reg from the register it is a copy of
+static int readOriginal(Line *line, uint8_t *reg, const Value *values) {
+  if (*reg >= 15 || values[*reg].kind != VALUE_COPY) {
+    return 0;
+  }
+  *reg = (uint8_t)values[*reg].reg;
+  line->reason = "read from the original of a copy";
+  return 1;
+}
+
+static int propagateValues(Line *lines, size_t count) {
+  Value values[15];
+  int changed = 0;
+  memset(values, 0, sizeof(values));
+  for (size_t i = nextLine(lines, 0, count); i < count;
+       i = nextLine(lines, i + 1, count)) {
+    Line *line = &lines[i];
+    Y86Instruction *insn = &line->insn;
+    switch (insn->icode) {
+    case I_RRMOVQ:
+      if (insn->ifun == 0 && (insn->rA == insn->rB ||
+                              holdsSame(values, insn->rA, insn->rB))) {
+        removeLine(line, "the value is already there");
+        changed = 1;
+        continue;
+      }
+      changed |= readOriginal(line, &insn->rA, values);
+      break;
+    case I_IRMOVQ:
+      if (holdsConstant(values, insn->rB, insn->immediate)) {
+        removeLine(line, "the constant is already there");
+        changed = 1;
+        continue;
+      }
+      break;
+    case I_RMMOVQ:
+      changed |= readOriginal(line, &insn->rA, values);
+      changed |= readOriginal(line, &insn->rB, values);
+      break;
+    case I_MRMOVQ:
+      changed |= readOriginal(line, &insn->rB, values);
+      break;
+    case I_PUSHQ:
+      changed |= readOriginal(line, &insn->rA, values);
+      break;
+    case I_OPQ:
+      if (insn->ifun != ALU_AND && insn->ifun <= ALU_XOR &&
+          holdsConstant(values, insn->rA, 0)) {
+        // leaves rB as it is and sets the flags from it, with OF clear
+        insn->ifun = ALU_AND;
+        insn->rA = insn->rB;
+        line->reason = "the other operand is zero";
+        changed = 1;
+      } else if (insn->rA != insn->rB) {
+        changed |= readOriginal(line, &insn->rA, values);
+      }
+      break;
+    }
+
+    // what the registers hold afterwards
+    Value value = {VALUE_UNKNOWN, 0, 0};
+    if (insn->icode == I_IRMOVQ) {
+      value.kind = VALUE_CONSTANT;
+      value.constant = insn->immediate;
+    } else if (insn->icode == I_RRMOVQ && insn->ifun == 0) {
+      value = values[insn->rA];
+      if (value.kind == VALUE_UNKNOWN) {
+        value.kind = VALUE_COPY;
+        value.reg = insn->rA;
+      }
+    }
+    uint32_t defs = defsOf(insn);
+    for (int r = 0; r < 15; r++) {
+      if (defs & REG(r)) {
+        forget(values, r);
+      }
+    }
+    if ((insn->icode == I_IRMOVQ || insn->icode == I_RRMOVQ) &&
+        insn->ifun == 0 && insn->rB < 15 &&
+        !(value.kind == VALUE_COPY && value.reg == insn->rB)) {
+      values[insn->rB] = value;
+    }
+  }
+  return changed;
+}
+
+// fill live[i] with what is live after line i
+static void liveAfter(const Line *lines, size_t count, uint32_t *live) {
+  uint32_t after = EVERYTHING;
+  for (size_t i = count; i-- > 0;) {
+    live[i] = after;
+    if (lines[i].removed) {
+      continue;
+    }
+    if (canFault(&lines[i].insn)) {
+      after = EVERYTHING;
+    } else {
+      after = (after & ~killsOf(&lines[i].insn)) | usesOf(&lines[i].insn);
+    }
+  }
+}
+
+static int isConstantStep(const Line *load, const Line *op, int ifun) {
+  return load->insn.icode == I_IRMOVQ && op->insn.icode == I_OPQ &&
+         op->insn.ifun == ifun && op->insn.rA == load->insn.rB &&
+         op->insn.rB != load->insn.rB;
+}
+
+static int mergeConstants(Line *lines, size_t count, uint32_t *live) {
+  int changed = 0;
+  liveAfter(lines, count, live);
+  size_t i = nextLine(lines, 0, count);
+  while (i < count) {
+    size_t j = nextLine(lines, i + 1, count);
+    size_t k = nextLine(lines, j + 1, count);
+    size_t l = nextLine(lines, k + 1, count);
+    if (l < count && (lines[j].insn.ifun == ALU_ADD ||
+                      lines[j].insn.ifun == ALU_SUB) &&
+        isConstantStep(&lines[i], &lines[j], lines[j].insn.ifun) &&
+        isConstantStep(&lines[k], &lines[l], lines[j].insn.ifun) &&
+        lines[k].insn.rB == lines[i].insn.rB &&
+        lines[l].insn.rB == lines[j].insn.rB &&
+        (live[l] & (FLAG_O | REG(lines[k].insn.rB))) == 0) {
+      lines[k].insn.immediate += lines[i].insn.immediate;
+      lines[k].reason = "two constant steps merged";
+      removeLine(&lines[i], "merged into the next constant step");
+      removeLine(&lines[j], "merged into the next constant step");
+      changed = 1;
+      i = nextLine(lines, l + 1, count);
+      continue;
+    }
+    i = j;
+  }
+  return changed;
+}
+
+static int removeDeadWrites(Line *lines, size_t count) {
+  uint32_t live = EVERYTHING;
+  int changed = 0;
+  for (size_t i = count; i-- > 0;) {
+    Line *line = &lines[i];
+    if (line->removed) {
+      continue;
+    }
+    if (isPure(&line->insn) && (defsOf(&line->insn) & live) == 0) {
+      removeLine(line, "nothing reads the result");
+      changed = 1;
+      continue;
+    }
+    if (canFault(&line->insn)) {
+      live = EVERYTHING;
+    } else {
+      live = (live & ~killsOf(&line->insn)) | usesOf(&line->insn);
+    }
+  }
+  return changed;
+}
+
+// move the line at from to position to, shifting those in between
+static void moveLine(Line *lines, size_t from, size_t to) {
+  Line line = lines[from];
+  if (from > to) {
+    memmove(&lines[to + 1], &lines[to], (from - to) * sizeof(Line));
+  } else {
+    memmove(&lines[from], &lines[from + 1], (to - from) * sizeof(Line));
+  }
+  lines[to] = line;
+}
+
+// whether the line at j can move past every line from first to last
+static int canMovePast(const Line *lines, size_t j, size_t first,
+                       size_t last) {
+  for (size_t k = first; k <= last; k++) {
+    if (lines[k].removed) {
+      continue;
+    }
+    if (canFault(&lines[k].insn) ||
+        !independent(&lines[j].insn, &lines[k].insn)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// try each line after the use at n of the load at i for the stall between
+// them; one from before the load would have to move past it
+static int fillStall(Line *lines, size_t count, size_t i, size_t n) {
+  uint64_t before = blockCycles(lines, count);
+  const Y86Instruction *load = &lines[i].insn;
+  size_t j = n;
+  for (int tries = 0; tries < MOVE_WINDOW; tries++) {
+    j = nextLine(lines, j + 1, count);
+    if (j >= count) {
+      break;
+    }
+    if (isPure(&lines[j].insn) && !stalls(load, &lines[j].insn) &&
+        canMovePast(lines, j, n, j - 1)) {
+      moveLine(lines, j, n);
+      if (blockCycles(lines, count) < before) {
+        lines[n].moved = 1;
+        return 1;
+      }
+      moveLine(lines, n, j);
+    }
+  }
+  return 0;
+}
+
+static int breakStalls(Line *lines, size_t count) {
+  int changed = 0;
+  for (size_t i = nextLine(lines, 0, count); i < count;
+       i = nextLine(lines, i + 1, count)) {
+    size_t n = nextLine(lines, i + 1, count);
+    if (n < count && stalls(&lines[i].insn, &lines[n].insn) &&
+        fillStall(lines, count, i, n)) {
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+// optimise one block, keeping the changes only if they save cycles.
+// Returns the cycles saved.
+static uint64_t optimiseBlock(Optimiser *opt, size_t first, size_t end) {
+  Line *lines = opt->lines + first;
+  size_t count = end - first;
+  uint64_t before = blockCycles(lines, count);
+  memcpy(opt->saved + first, lines, count * sizeof(Line));
+
+  int changed = 1;
+  for (int round = 0; changed && round < MAX_ROUNDS; round++) {
+    changed = propagateValues(lines, count);
+    changed |= mergeConstants(lines, count, opt->live + first);
+    changed |= removeDeadWrites(lines, count);
+  }
+  breakStalls(lines, count);
+
+  uint64_t after = blockCycles(lines, count);
+  if (after >= before) {
+    memcpy(lines, opt->saved + first, count * sizeof(Line));
+    return 0;
+  }
+  return before - after;
+}
+
+static int hasPinnedBetween(const Optimiser *opt, uint64_t low,
+                            uint64_t high) {
+  // the first pinned address above low
+  size_t lo = 0;
+  size_t hi = opt->pinnedCount;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (opt->pinned[mid] <= low) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < opt->pinnedCount && opt->pinned[lo] < high;
+}
+
+static int pin(Optimiser *opt, uint64_t address) {
+  if (address >= opt->length) {
+    return 0;
+  }
+  if (opt->pinnedCount == opt->pinnedCapacity) {
+    size_t capacity = opt->pinnedCapacity == 0 ? 256 : opt->pinnedCapacity * 2;
+    uint64_t *grown = realloc(opt->pinned, capacity * sizeof(uint64_t));
+    if (grown == NULL) {
+      return -1;
+    }
+    opt->pinned = grown;
+    opt->pinnedCapacity = capacity;
+  }
+  opt->pinned[opt->pinnedCount++] = address;
+  return 0;
+}
+
+static int compareAddresses(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// walk the image as the listing will, marking the instructions that get a
+// line in opt->listed and collecting every value that may be the address of
+// code: the immediates and displacements of those instructions, branches
+// that land inside one, and the aligned quads of the data
+static int findPinned(Optimiser *opt) {
+  const uint8_t *bytes = opt->bytes;
+  size_t offset = 0;
+  int res = 0;
+  while (res == 0 && offset < opt->length) {
+    size_t code = nextReachedStart(opt->starts, offset, opt->length);
+    for (size_t quad = (offset + 7) & ~(size_t)7; quad + 8 <= code;
+         quad += 8) {
+      uint64_t value = 0;
+      for (int b = 7; b >= 0; b--) {
+        value = value << 8 | bytes[quad + (size_t)b];
+      }
+      res |= pin(opt, value);
+    }
+    if (code == opt->length) {
+      break;
+    }
+    Y86Instruction insn;
+    decodeReachedAt(bytes, opt->length, code, &insn);
+    opt->listed[code / 8] |= (uint8_t)(1 << code % 8);
+    if (insn.icode == I_IRMOVQ) {
+      res |= pin(opt, insn.immediate);
+    }
+    offset = code + insn.length;
+  }
+  // a constant that names no listed instruction is a number, or data
+  size_t kept = 0;
+  for (size_t i = 0; i < opt->pinnedCount; i++) {
+    if (isReachedStart(opt->listed, opt->pinned[i])) {
+      opt->pinned[kept++] = opt->pinned[i];
+    }
+  }
+  opt->pinnedCount = kept;
+  // branches to listed lines are printed as labels and follow them, the
+  // rest are pinned
+  for (offset = nextReachedStart(opt->listed, 0, opt->length);
+       res == 0 && offset < opt->length;
+       offset = nextReachedStart(opt->listed, offset + 1, opt->length)) {
+    Y86Instruction insn;
+    decodeReachedAt(bytes, opt->length, offset, &insn);
+    if ((insn.icode == I_JXX || insn.icode == I_CALL) &&
+        insn.immediate < opt->length &&
+        !isReachedStart(opt->listed, insn.immediate)) {
+      res |= pin(opt, insn.immediate);
+    }
+  }
+  if (opt->pinnedCount > 0) {
+    qsort(opt->pinned, opt->pinnedCount, sizeof(uint64_t), compareAddresses);
+  }
+  return res;
+}
+
+static int growRun(Optimiser *opt) {
+  size_t capacity = opt->capacity == 0 ? 256 : opt->capacity * 2;
+  Line *lines = realloc(opt->lines, capacity * sizeof(Line));
+  if (lines != NULL) {
+    opt->lines = lines;
+  }
+  Line *saved = realloc(opt->saved, capacity * sizeof(Line));
+  if (saved != NULL) {
+    opt->saved = saved;
+  }
+  uint64_t *addresses = realloc(opt->addresses, capacity * sizeof(uint64_t));
+  if (addresses != NULL) {
+    opt->addresses = addresses;
+  }
+  uint8_t *blockStarts = realloc(opt->blockStarts, capacity);
+  if (blockStarts != NULL) {
+    opt->blockStarts = blockStarts;
+  }
+  uint32_t *live = realloc(opt->live, capacity * sizeof(uint32_t));
+  if (live != NULL) {
+    opt->live = live;
+  }
+  if (lines == NULL || saved == NULL || addresses == NULL ||
+      blockStarts == NULL || live == NULL) {
+    return -1;
+  }
+  opt->capacity = capacity;
+  return 0;
+}
+
+// read the run of reached instructions starting at code into opt->lines.
+// Returns the address just past it, or 0 if memory ran out.
+static size_t readRun(Optimiser *opt, size_t code, int *endsRun) {
+  size_t offset = code;
+  opt->count = 0;
+  *endsRun = 0;
+  while (offset < opt->length && isReachedStart(opt->starts, offset)) {
+    if (opt->count == opt->capacity && growRun(opt) != 0) {
+      return 0;
+    }
+    Line *line = &opt->lines[opt->count];
+    memset(line, 0, sizeof(Line));
+    decodeReachedAt(opt->bytes, opt->length, offset, &line->insn);
+    line->original = line->insn;
+    opt->addresses[opt->count] = offset;
+    // halt, ret and jmp end the run, so only jXX and call end a block
+    // inside it
+    int after = opt->count == 0 ? I_NOP : opt->lines[opt->count - 1].insn.icode;
+    opt->blockStarts[opt->count] = opt->count == 0 || after == I_JXX ||
+                                   after == I_CALL ||
+                                   findXrefs(&opt->xrefs, offset) != NULL;
+    opt->count++;
+    offset += line->insn.length;
+    int icode = line->insn.icode;
+    if (icode == I_HALT || icode == I_RET ||
+        (icode == I_JXX && line->insn.ifun == 0)) {
+      *endsRun = 1;
+      break;
+    }
+  }
+  return offset;
+}
+
+static void optimiseRun(Optimiser *opt, size_t end) {
+  uint64_t saved = 0;
+  size_t firstChange = opt->count;
+  size_t first = 0;
+  for (size_t i = 1; i <= opt->count; i++) {
+    if (i == opt->count || opt->blockStarts[i]) {
+      uint64_t blockSaved = optimiseBlock(opt, first, i);
+      if (blockSaved > 0 && firstChange == opt->count) {
+        firstChange = first;
+      }
+      saved += blockSaved;
+      first = i;
+    }
+  }
+  if (saved == 0) {
+    return;
+  }
+  if (hasPinnedBetween(opt, opt->addresses[firstChange], end)) {
+    for (size_t i = 0; i < opt->count; i++) {
+      memset(&opt->lines[i], 0, sizeof(Line));
+      decodeReachedAt(opt->bytes, opt->length, opt->addresses[i],
+                      &opt->lines[i].insn);
+      opt->lines[i].original = opt->lines[i].insn;
+    }
+    opt->runsPinned++;
+    return;
+  }
+  opt->cyclesSaved += saved;
+  for (size_t i = 0; i < opt->count; i++) {
+    const Line *line = &opt->lines[i];
+    opt->removed += line->removed;
+    opt->moved += line->moved;
+    opt->rewritten += !line->removed && line->reason != NULL;
+  }
+  first = 0;
+  for (size_t i = 1; i <= opt->count; i++) {
+    if (i == opt->count || opt->blockStarts[i]) {
+      for (size_t k = first; k < i; k++) {
+        if (opt->lines[k].removed || opt->lines[k].moved ||
+            opt->lines[k].reason != NULL) {
+          opt->blocks++;
+          break;
+        }
+      }
+      first = i;
+    }
+  }
+}
+
+// insn as it reads in the listing, without the indent and column padding
+static void describe(Optimiser *opt, const Y86Instruction *insn, char *text) {
+  opt->scratch.used = 0;
+  printRecord(&opt->scratch, insn, 0);
+  size_t length = 0;
+  for (size_t i = 0; i < opt->scratch.used && length < DESCRIPTION_TEXT - 1;
+       i++) {
+    char c = opt->scratch.buffer[i];
+    if (c == '\n' || (c == ' ' && (length == 0 || text[length - 1] == ' '))) {
+      continue;
+    }
+    text[length++] = c;
+  }
+  while (length > 0 && text[length - 1] == ' ') {
+    length--;
+  }
+  text[length] = '\0';
+}
+
+static void printRun(Optimiser *opt, RecursiveListing *listing) {
+  OutputSink *out = listing->out;
+  char original[DESCRIPTION_TEXT];
+  char note[MAX_NOTE_TEXT];
+  size_t printed = 0;
+
+  moveListingTo(listing, opt->addresses[0]);
+  for (size_t i = 0; i < opt->count; i++) {
+    const Line *line = &opt->lines[i];
+    const XrefEntry *entry = findXrefs(&opt->xrefs, opt->addresses[i]);
+    if (opt->blockStarts[i] && entry != NULL) {
+      printLabel(out, &opt->xrefs, entry);
+    }
+    if (line->removed) {
+      describe(opt, &line->original, original);
+      int written = snprintf(note, sizeof(note), "    # removed %s: %s\n",
+                             original, line->reason);
+      appendOutput(out, note, (size_t)written);
+      continue;
+    }
+    printed += line->insn.length;
+    const Y86Instruction *insn = &line->insn;
+    if ((insn->icode == I_JXX || insn->icode == I_CALL) &&
+        insn->immediate < opt->length &&
+        isReachedStart(opt->listed, insn->immediate)) {
+      printBranchToLabel(out, insn);
+    } else if (line->reason != NULL) {
+      describe(opt, &line->original, original);
+      snprintf(note, sizeof(note), "# %s%s, was %s",
+               line->moved ? "moved into a load/use stall; " : "",
+               line->reason, original);
+      printRecordNoted(out, insn, 0, note);
+    } else if (line->moved) {
+      printRecordNoted(out, insn, 0, "# moved into a load/use stall");
+    } else {
+      printRecord(out, insn, 0);
+    }
+  }
+  // where the next line really is, so a shorter run is followed by a .pos
+  listing->next = opt->addresses[0] + printed;
+}
+
+static void printReport(Optimiser *opt, OutputSink *outputFile) {
+  char text[512];
+  int written = snprintf(
+      text, sizeof(text),
+      "\n# peephole: %llu blocks improved, %llu instructions removed, %llu "
+      "rewritten, %llu moved into load/use stalls\n"
+      "# about %llu cycles saved per pass through the changed blocks\n",
+      (unsigned long long)opt->blocks, (unsigned long long)opt->removed,
+      (unsigned long long)opt->rewritten, (unsigned long long)opt->moved,
+      (unsigned long long)opt->cyclesSaved);
+  appendOutput(outputFile, text, (size_t)written);
+  if (opt->runsPinned > 0) {
+    written = snprintf(text, sizeof(text),
+                       "# %llu run%s of code left as %s: a constant may "
+                       "point into %s\n",
+                       (unsigned long long)opt->runsPinned,
+                       opt->runsPinned == 1 ? "" : "s",
+                       opt->runsPinned == 1 ? "it was" : "they were",
+                       opt->runsPinned == 1 ? "it" : "them");
+    appendOutput(outputFile, text, (size_t)written);
+  }
+  fprintf(stderr,
+          "Peephole: %llu blocks improved, about %llu cycles saved per "
+          "pass\n",
+          (unsigned long long)opt->blocks,
+          (unsigned long long)opt->cyclesSaved);
+}
+
+static void freeOptimiser(Optimiser *opt) {
+  free(opt->starts);
+  free(opt->listed);
+  freeXrefIndex(&opt->xrefs);
+  free(opt->pinned);
+  free(opt->lines);
+  free(opt->saved);
+  free(opt->addresses);
+  free(opt->blockStarts);
+  free(opt->live);
+  closeOutputSink(&opt->scratch);
+}
+
+int optimiseImage(const uint8_t *machineCode, size_t length, long entry,
+                  OutputSink *outputFile) {
+  Optimiser opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.bytes = machineCode;
+  opt.length = length;
+  opt.starts = calloc(length / 8 + 1, 1);
+  opt.listed = calloc(length / 8 + 1, 1);
+  initXrefIndex(&opt.xrefs);
+  if (opt.starts == NULL || opt.listed == NULL ||
+      openOutputSink(&opt.scratch, -1, MAX_RECORD_TEXT) != 0 ||
+      traceReachableCode(machineCode, length, entry, opt.starts,
+                         &opt.xrefs) != 0 ||
+      findPinned(&opt) != 0) {
+    freeOptimiser(&opt);
+    return -1;
+  }
+
+  RecursiveListing listing = {outputFile, 0, 1};
+  size_t offset = 0;
+  while (offset < length) {
+    size_t code = nextReachedStart(opt.starts, offset, length);
+    printUnreached(&listing, machineCode, offset, code);
+    if (code == length) {
+      break;
+    }
+    int endsRun;
+    size_t end = readRun(&opt, code, &endsRun);
+    if (end == 0) {
+      freeOptimiser(&opt);
+      return -1;
+    }
+    // a run that falls into bytes that are not code cannot move
+    if (endsRun) {
+      optimiseRun(&opt, end);
+    }
+    printRun(&opt, &listing);
+    offset = end;
+  }
+  printReport(&opt, outputFile);
+  freeOptimiser(&opt);
+  return 0;
+}
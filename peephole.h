@@ -0,0 +1,24 @@
+/* This file contains the prototype for the peephole optimiser defined in
+   peephole.c (the --optimise option).
+*/
+
+#ifndef _PEEPHOLE_H_
+#define _PEEPHOLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// Print the image as --recursive --xrefs lists it, a .ys file yas can
+// assemble, with the code reachable from entry optimised one basic block at
+// a time: copies of copies and reloads of a value already in place go,
+// adding a register known to hold zero becomes andq, consecutive constant
+// adds are merged, writes nothing reads are dropped, and an instruction is
+// moved between a load and its use where that fills the stall. Each change
+// is noted on its line, and the cycles saved are estimated at the end.
+// Returns 0, or -1 if memory ran out.
+int optimiseImage(const uint8_t *machineCode, size_t length, long entry,
+                  OutputSink *outputFile);
+
+#endif /* PEEPHOLE */
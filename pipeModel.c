@@ -0,0 +1,217 @@
+#include "pipeModel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "emulator.h"
+#include "hazards.h"
+#include "printRoutines.h"
+
+/*
+  The PIPE model does not simulate the pipeline stage by stage. With
+  forwarding, the only cycles an instruction costs beyond the one it issues
+  in come from three hazards, and each depends only on the instruction and
+  the one executed right after it:
+
+    load/use     mrmovq or popq loads a register the next instruction reads
+                 in decode: one bubble while the load reaches memory
+    mispredict   a conditional jXX falls through, but fetch went on at its
+                 destination: two bubbles to cancel the wrong instructions
+    ret          fetch waits for the return address: three bubbles
+
+  So the emulator's trace is read two instructions at a time and the
+  bubbles are added up per instruction address, charged to the instruction
+  that causes them: the load, the jXX, the ret. --annotate-hazards marks
+  the same ones. A run then takes one cycle
+  per instruction, plus every bubble, plus four cycles to drain the last
+  instruction through the remaining stages.
+*/
+
+#define INITIAL_CAPACITY 1024
+#define RECORD_BATCH 1024
+
+typedef struct {
+  uint64_t address;
+  uint64_t runs; // 0 marks an empty slot
+  uint64_t loadUse;
+  uint64_t mispredict;
+  uint64_t ret;
+} PipeStats;
+
+typedef struct {
+  PipeStats *stats;
+  size_t capacity;
+  size_t used;
+  ExecStep previous;
+  PipeStats *previousStats; // NULL before the first step
+  uint64_t loadUse;
+  uint64_t mispredict;
+  uint64_t ret;
+  int failed;
+} Pipeline;
+
+static size_t slotFor(uint64_t address, size_t capacity) {
+  // Fibonacci hashing, as in xrefIndex.c
+  return (size_t)((address * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+static PipeStats *probe(PipeStats *stats, size_t capacity, uint64_t address) {
+  size_t slot = slotFor(address, capacity);
+  while (stats[slot].runs != 0 && stats[slot].address != address) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &stats[slot];
+}
+
+static int growStats(Pipeline *pipe) {
+  size_t capacity =
+      pipe->capacity == 0 ? INITIAL_CAPACITY : pipe->capacity * 2;
+  PipeStats *stats = calloc(capacity, sizeof(PipeStats));
+  if (stats == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < pipe->capacity; i++) {
+    if (pipe->stats[i].runs != 0) {
+      *probe(stats, capacity, pipe->stats[i].address) = pipe->stats[i];
+    }
+  }
+  free(pipe->stats);
+  pipe->stats = stats;
+  pipe->capacity = capacity;
+  return 0;
+}
+
+// the statistics of the instruction at address, or NULL if it never ran
+static PipeStats *findStats(const Pipeline *pipe, uint64_t address) {
+  if (pipe->capacity == 0) {
+    return NULL;
+  }
+  PipeStats *stats = probe(pipe->stats, pipe->capacity, address);
+  return stats->runs != 0 ? stats : NULL;
+}
+
+static void observeStep(void *context, const ExecStep *step) {
+  Pipeline *pipe = context;
+  if (pipe->failed) {
+    return;
+  }
+
+  // what the previous instruction costs now that it is known what ran next
+  const ExecStep *previous = &pipe->previous;
+  int icode = previous->instr >> 4;
+  PipeStats *stats = pipe->previousStats;
+  if (stats != NULL) {
+    if (icode == I_JXX && (previous->instr & 0xF) != 0 &&
+        step->pc != previous->valC) {
+      stats->mispredict += MISPREDICT_BUBBLES;
+      pipe->mispredict += MISPREDICT_BUBBLES;
+    } else if (icode == I_RET) {
+      stats->ret += RET_BUBBLES;
+      pipe->ret += RET_BUBBLES;
+    }
+    if (LOADS_REGISTER(icode) &&
+        readsRegister(step->instr >> 4, step->rA, step->rB, previous->rA)) {
+      stats->loadUse += LOAD_USE_BUBBLES;
+      pipe->loadUse += LOAD_USE_BUBBLES;
+    }
+  }
+
+  if ((pipe->used + 1) * 2 > pipe->capacity && growStats(pipe) != 0) {
+    pipe->failed = 1;
+    return;
+  }
+  stats = probe(pipe->stats, pipe->capacity, step->pc);
+  if (stats->runs == 0) {
+    stats->address = step->pc;
+    pipe->used++;
+  }
+  stats->runs++;
+  pipe->previous = *step;
+  pipe->previousStats = stats;
+}
+
+// print insn, with the statistics of the instruction at its address noted
+// when it ran
+static void printAnnotated(OutputSink *out, const Y86Instruction *insn,
+                           int isFirstPosFlag, const PipeStats *stats) {
+  if (stats == NULL) {
+    printRecord(out, insn, isFirstPosFlag);
+    return;
+  }
+  char note[MAX_NOTE_TEXT];
+  snprintf(note, sizeof(note),
+           "# runs %llu, load/use %llu, mispredict %llu, ret %llu",
+           (unsigned long long)stats->runs, (unsigned long long)stats->loadUse,
+           (unsigned long long)stats->mispredict,
+           (unsigned long long)stats->ret);
+  printRecordNoted(out, insn, isFirstPosFlag, note);
+}
+
+int simulatePipeline(const uint8_t *image, size_t length, long startingOffset,
+                     uint64_t maxSteps, OutputSink *outputFile) {
+  Pipeline pipe;
+  ExecSummary summary;
+  memset(&pipe, 0, sizeof(pipe));
+
+  if (traceImage(image, length, startingOffset, maxSteps, observeStep, &pipe,
+                 &summary) != 0 ||
+      pipe.failed) {
+    free(pipe.stats);
+    return -1;
+  }
+
+  // the listing, annotated
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  size_t count;
+  size_t listed = 0;
+  int isFirstPosFlag = 1;
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  while ((count = y86Decode(image, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const PipeStats *stats = records[i].kind == Y86_CODE
+                                   ? findStats(&pipe, records[i].address)
+                                   : NULL;
+      printAnnotated(outputFile, &records[i], isFirstPosFlag, stats);
+      listed += stats != NULL;
+      isFirstPosFlag = 0;
+    }
+  }
+
+  uint64_t bubbles = pipe.loadUse + pipe.mispredict + pipe.ret;
+  uint64_t cycles = summary.steps == 0 ? 0 : summary.steps + bubbles + 4;
+  char text[512];
+  int written = snprintf(
+      text, sizeof(text),
+      "\n# PIPE: %llu instructions, stopped with status %s at PC = 0x%llx\n"
+      "# %llu cycles: one per instruction, %llu bubbles and 4 to drain\n"
+      "# CPI %.3f (%.3f including the drain)\n"
+      "# bubbles: load/use %llu, mispredicted branches %llu, ret %llu\n",
+      (unsigned long long)summary.steps, summary.status,
+      (unsigned long long)summary.pc, (unsigned long long)cycles,
+      (unsigned long long)bubbles,
+      summary.steps == 0 ? 0.0
+                         : (double)(summary.steps + bubbles) / summary.steps,
+      summary.steps == 0 ? 0.0 : (double)cycles / summary.steps,
+      (unsigned long long)pipe.loadUse, (unsigned long long)pipe.mispredict,
+      (unsigned long long)pipe.ret);
+  appendOutput(outputFile, text, (size_t)written);
+  if (listed < pipe.used) {
+    written = snprintf(text, sizeof(text),
+                       "# %zu executed instruction%s not on a line of "
+                       "this listing\n",
+                       pipe.used - listed,
+                       pipe.used - listed == 1 ? " is" : "s are");
+    appendOutput(outputFile, text, (size_t)written);
+  }
+  fprintf(stderr, "PIPE: %llu instructions in %llu cycles, CPI %.3f\n",
+          (unsigned long long)summary.steps, (unsigned long long)cycles,
+          summary.steps == 0 ? 0.0
+                             : (double)(summary.steps + bubbles) /
+                                   summary.steps);
+  free(pipe.stats);
+  return 0;
+}
@@ -0,0 +1,24 @@
+/* This file contains the prototype for the PIPE timing model defined in
+   pipeModel.c (the --pipe option).
+*/
+
+#ifndef _PIPEMODEL_H_
+#define _PIPEMODEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+
+// Run the image as --exec does and time the run on the five-stage PIPE
+// processor of CS:APP: forwarding everywhere, a one-cycle stall when an
+// instruction uses the register the instruction before it loads, two
+// bubbles after a jXX that is not taken (branches are predicted taken) and
+// three after every ret. Print the listing from startingOffset with each
+// executed instruction annotated with its run count and the bubbles it
+// caused, followed by the total cycles and CPI. Returns 0, or -1 if memory
+// ran out.
+int simulatePipeline(const uint8_t *image, size_t length, long startingOffset,
+                     uint64_t maxSteps, OutputSink *outputFile);
+
+#endif /* PIPEMODEL */
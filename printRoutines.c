@@ -1,210 +1,358 @@
 #include "printRoutines.h"
-#include <stdio.h>
-#include <unistd.h>
+#include <string.h>
 
 /*
-  Print routines corresponding to each instruction in Y-86 assembly
-*/
-
-// print for .pos directive
-int printPos(FILE *out, long address, int isFirstPosFlag) {
-  int res = 0;
-  if (isFirstPosFlag == 1) {
-    return fprintf(out, ".pos 0x%lx\n", address);
-  } else
-    return res += fprintf(out, "\n.pos 0x%lx\n", address);
-}
-
-// print for halt
-int printHalt(FILE *out, int *nextBytes, long *address) {
-  int res = 0;
-  if (nextBytes[0] < 0) {
-    return 0;
-  }
-  res += fprintf(out, "    %-8s \n", "halt");
-  // res += fprintf(out, "%s\n", "       # 00");
-  return res;
-}
-
-// print for nop
-int printNop(FILE *out) {
-  int res = 0;
-  res += fprintf(out, "    %-8s \n", "nop");
-  // res += fprintf(out, "%s\n", "       # 10");
-  return res;
-}
-
-// print for ret
-int printRet(FILE *out) {
-  int res = 0;
-  res += fprintf(out, "    %-8s \n", "ret");
-  // res += fprintf(out, "%s\n", "       # 90");
-  return res;
-}
+  Print routines corresponding to each instruction in Y-86 assembly.
 
-// print for RRMovQ
-int printRRMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  res += fprintf(out, "    %-8s%s, %s \n", "rrmovq", r1, r2);
-  return res;
-}
+  Each routine formats its line directly into the output buffer: mnemonics
+  come pre-padded from opcodeTable, register names carry their lengths, and
+  numbers go through formatHex, so no format strings are parsed per line.
+*/
 
-// print for IRMovQ
-int printIRMovQ(FILE *out, char *reg, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  unsigned long value = getInstructionValue(nextBytes, 0);
-  res += fprintf(out, "    %-8s$0x%lx, %s \n", "irmovq", value, reg);
-  return res;
-}
+// the indent plus the 8-character mnemonic column of every listing line
+#define COLUMN_WIDTH 12
 
-// print for RMMovQ
-int printRMMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  unsigned long disp = getInstructionValue(nextBytes, 0);
-  res += fprintf(out, "    %-8s%s, 0x%lx(%s) \n", "rmmovq", r1, disp, r2);
-  return res;
+static char *copyText(char *dst, const char *text, size_t length) {
+  memcpy(dst, text, length);
+  return dst + length;
 }
 
-// print for MRMovQ
-int printMRMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  unsigned long disp = getInstructionValue(nextBytes, 0);
-  res += fprintf(out, "    %-8s0x%lx(%s), %s \n", "mrmovq", disp, r1, r2);
-  return res;
-}
+#define COPY_LITERAL(dst, literal)                                             \
+  copyText(dst, literal, sizeof(literal) - 1)
 
-// print for OpQ
-int printOpQ(FILE *out, char *instr, char *r1, char *r2, int bigNibble,
-             int littleNibble, int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  res += fprintf(out, "    %-8s%s, %s \n", instr, r1, r2);
-  return res;
+// write the indent and padded mnemonic that start every instruction line
+static char *copyColumn(char *dst, const char *paddedMnemonic) {
+  memcpy(dst, "    ", 4);
+  memcpy(dst + 4, paddedMnemonic, 8);
+  return dst + COLUMN_WIDTH;
 }
 
-// print for JMPXX
-int printJXX(FILE *out, char *jmpInstr, int bigNibble, int littleNibble,
-             int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  unsigned long dest = getInstructionValue(nextBytes, 0);
-  res += fprintf(out, "    %-8s0x%lx \n", jmpInstr, dest);
-  return res;
+static int finishLine(OutputSink *out, char *start, char *end) {
+  commitOutput(out, end);
+  return (int)(end - start);
 }
 
-// print for CMOVXX
-int printCMovXX(FILE *out, char *instr, char *r1, char *r2, int bigNibble,
-                int littleNibble, int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  res += fprintf(out, "    %-8s%s, %s \n", instr, r1, r2);
-  return res;
-}
-
-// print for CALL
-int printCall(FILE *out, int bigNibble, int littleNibble, int *nextBytes,
-              int bytesNeeded) {
-  int res = 0;
-  unsigned long dest = getInstructionValue(nextBytes, 0);
-  res += fprintf(out, "    %-8s0x%lx \n", "call", dest);
-  return res;
+// print for .pos directive
+int printPos(OutputSink *out, long address, int isFirstPosFlag) {
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = start;
+  if (isFirstPosFlag != 1) {
+    *dst++ = '\n';
+  }
+  dst = COPY_LITERAL(dst, ".pos 0x");
+  dst += formatHex(dst, (unsigned long)address);
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
 }
 
-// print for PUSHQ
-int printPushQ(FILE *out, char *r1, int bigNibble, int littleNibble,
-               int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  res += fprintf(out, "    %-8s%s \n", "pushq", r1);
-  return res;
-}
+// print any valid instruction. the mnemonic, register names and operand
+// layout all come from the descriptor tables.
+int printInstruction(OutputSink *out, const OpcodeDescriptor *op,
+                     const RegisterByte *registers, unsigned long value) {
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = copyColumn(start, op->paddedMnemonic);
 
-// print for POPQ
-int printPopQ(FILE *out, char *r1, int bigNibble, int littleNibble,
-              int *nextBytes, int bytesNeeded) {
-  int res = 0;
-  res += fprintf(out, "    %-8s%s \n", "popq", r1);
-  // res += commentHandler(bigNibble, littleNibble, nextBytes, bytesNeeded, out);
-  return res;
+  switch (op->shape) {
+  case SHAPE_REG_REG:
+    dst = copyText(dst, registers->rA, registers->rALength);
+    dst = COPY_LITERAL(dst, ", ");
+    dst = copyText(dst, registers->rB, registers->rBLength);
+    break;
+  case SHAPE_IMM_REG:
+    dst = COPY_LITERAL(dst, "$0x");
+    dst += formatHex(dst, value);
+    dst = COPY_LITERAL(dst, ", ");
+    dst = copyText(dst, registers->rB, registers->rBLength);
+    break;
+  case SHAPE_REG_MEM:
+    dst = copyText(dst, registers->rA, registers->rALength);
+    dst = COPY_LITERAL(dst, ", 0x");
+    dst += formatHex(dst, value);
+    *dst++ = '(';
+    dst = copyText(dst, registers->rB, registers->rBLength);
+    *dst++ = ')';
+    break;
+  case SHAPE_MEM_REG:
+    dst = COPY_LITERAL(dst, "0x");
+    dst += formatHex(dst, value);
+    *dst++ = '(';
+    dst = copyText(dst, registers->rB, registers->rBLength);
+    dst = COPY_LITERAL(dst, "), ");
+    dst = copyText(dst, registers->rA, registers->rALength);
+    break;
+  case SHAPE_DEST:
+    dst = COPY_LITERAL(dst, "0x");
+    dst += formatHex(dst, value);
+    break;
+  case SHAPE_REG:
+    dst = copyText(dst, registers->rA, registers->rALength);
+    break;
+  default:
+    break;
+  }
+  dst = COPY_LITERAL(dst, " \n");
+  return finishLine(out, start, dst);
 }
 
 // print for .byte 0x0
-int printByte(FILE *out, int bigNibble, int littleNibble) {
-  return fprintf(out, "    %-8s0x%x%x\n", ".byte", bigNibble, littleNibble);
+int printByte(OutputSink *out, int bigNibble, int littleNibble) {
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = copyColumn(start, ".byte   ");
+  dst = COPY_LITERAL(dst, "0x");
+  dst += formatHex(dst, bigNibble);
+  dst += formatHex(dst, littleNibble);
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
 }
 
 // print for .quad 0x0
-int printQuad(FILE *out, int bigNibble, int littleNibble, int n1, int n2,
-              int *nextBytes) {
-  int res = 0;
-  // the first case is to print quads when we have NOT previously fetched a
-  // lone byte, i.e. an invalid jump instruction, n1 and n2 were passed as -1,
-  // so we know we have to read 7 bytes to make a quad.
-  if (n1 < 0 || n2 < 0) {
-    res += fprintf(out, "    %-8s0x", ".quad");
+int printQuad(OutputSink *out, const Y86Instruction *quad) {
+  int bigNibble = quad->icode;
+  int littleNibble = quad->ifun;
+  int nextBytes[8];
+  // nextBytes holds the raw bytes after the first one, in memory order.
+  for (int i = 0; i < 7; i++) {
+    nextBytes[i] = (quad->immediate >> 8 * (i + 1)) & 0xFF;
+  }
+
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = copyColumn(start, ".quad   ");
+  dst = COPY_LITERAL(dst, "0x");
+
+  // the first case is to print quads when the invalid icode does not take a
+  // register byte, i.e. an invalid jump instruction, so the 7 bytes after the
+  // first make up the rest of the quad.
+  if (!(opcodeTable[bigNibble << 4 | littleNibble].flags & OP_REGISTER_BYTE)) {
     // loop backwards through our nextBytes for endian purposes
     for (int i = 6; i >= 0; i--) {
       if (nextBytes[i] != 0) {
-        res += fprintf(out, "%x", nextBytes[i]);
+        dst += formatHex(dst, nextBytes[i]);
       }
     }
-    res += fprintf(out, "%x%x", bigNibble, littleNibble);
-    int comment = fprintf(out, "            # %X%X", bigNibble, littleNibble);
+    dst += formatHex(dst, bigNibble);
+    dst += formatHex(dst, littleNibble);
+    dst = COPY_LITERAL(dst, "            # ");
+    dst += formatHexUpper(dst, bigNibble);
+    dst += formatHexUpper(dst, littleNibble);
     for (int i = 0; i < 6; i++) {
-      comment += fprintf(out, "%X", nextBytes[i]);
+      dst += formatHexUpper(dst, nextBytes[i]);
     }
-    comment += fprintf(out, "\n");
-    res += comment;
   }
-  // when we have already fetched an additional byte (such as irmovq), we
-  // include n1 and n2, and read 6 more bytes to make a quad.
+  // when the icode takes a register byte (such as irmovq), its half-bytes n1
+  // and n2 are printed separately and the 6 bytes after it complete the quad.
   else {
-    res += fprintf(out, "    %-8s0x", ".quad");
+    int n1 = nextBytes[0] & 0xF0;
+    int n2 = nextBytes[0] & 0x0F;
 
-    for (int i = 5; i >= 0; i--) {
+    for (int i = 6; i >= 1; i--) {
       if (nextBytes[i] != 0) {
-        res += fprintf(out, "%x", nextBytes[i]);
+        dst += formatHex(dst, nextBytes[i]);
       }
     }
-    res += fprintf(out, "%x%x%x%x", n1, n2, bigNibble, littleNibble);
-    int comment =
-        fprintf(out, "            # %X%X%X%X", bigNibble, littleNibble, n1, n2);
-    for (int i = 0; i < 6; i++) {
-      comment += fprintf(out, "%X", nextBytes[i]);
+    dst += formatHex(dst, n1);
+    dst += formatHex(dst, n2);
+    dst += formatHex(dst, bigNibble);
+    dst += formatHex(dst, littleNibble);
+    dst = COPY_LITERAL(dst, "            # ");
+    dst += formatHexUpper(dst, bigNibble);
+    dst += formatHexUpper(dst, littleNibble);
+    dst += formatHexUpper(dst, n1);
+    dst += formatHexUpper(dst, n2);
+    for (int i = 1; i < 7; i++) {
+      dst += formatHexUpper(dst, nextBytes[i]);
     }
-    comment += fprintf(out, "\n");
-    res += comment;
   }
-  return res;
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
+}
+
+// print 8 bytes of data as the value they hold, for listings that know
+// where the data is
+int printDataQuad(OutputSink *out, uint64_t value) {
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = copyColumn(start, ".quad   ");
+  dst = COPY_LITERAL(dst, "0x");
+  dst += formatHex(dst, value);
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
+}
+
+// print the label line for a jump or call destination, with the addresses
+// of (up to XREF_LIST_LIMIT of) the instructions that branch there.
+int printLabel(OutputSink *out, const XrefIndex *index,
+               const XrefEntry *entry) {
+  char *start = reserveOutput(out, XREF_LINE_TEXT);
+  char *dst = COPY_LITERAL(start, "L_0x");
+  dst += formatHex(dst, entry->target);
+  dst = COPY_LITERAL(dst, ":            # xrefs: ");
+
+  uint32_t shown = 0;
+  for (uint32_t i = entry->firstSite; i != XREF_NONE && shown < XREF_LIST_LIMIT;
+       i = index->sites[i].next, shown++) {
+    if (shown > 0) {
+      dst = COPY_LITERAL(dst, ", ");
+    }
+    dst = COPY_LITERAL(dst, "0x");
+    dst += formatHex(dst, index->sites[i].address);
+  }
+  if (entry->count > shown) {
+    dst = COPY_LITERAL(dst, ", ... (");
+    dst += formatDecimal(dst, entry->count);
+    dst = COPY_LITERAL(dst, " in all)");
+  }
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
+}
+
+// print a jXX or call whose destination has a label
+int printBranchToLabel(OutputSink *out, const Y86Instruction *insn) {
+  const OpcodeDescriptor *op = &opcodeTable[insn->icode << 4 | insn->ifun];
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = copyColumn(start, op->paddedMnemonic);
+  dst = COPY_LITERAL(dst, "L_0x");
+  dst += formatHex(dst, insn->immediate);
+  dst = COPY_LITERAL(dst, " \n");
+  return finishLine(out, start, dst);
+}
+
+// print one decoded record. isFirstPosFlag is set for the first record of a
+// listing so a leading .pos is not preceded by a blank line.
+int printRecord(OutputSink *out, const Y86Instruction *insn,
+                int isFirstPosFlag) {
+  switch (insn->kind) {
+  case Y86_CODE:
+    return printInstruction(out, &opcodeTable[insn->icode << 4 | insn->ifun],
+                            &registerTable[insn->rA << 4 | insn->rB],
+                            insn->immediate);
+  case Y86_QUAD:
+    return printQuad(out, insn);
+  case Y86_BYTE:
+    return printByte(out, insn->icode, insn->ifun);
+  case Y86_POS:
+    return printPos(out, insn->immediate, isFirstPosFlag);
+  default:
+    return 0;
+  }
+}
+
+// print one record with note appended to its line as a comment starting in
+// NOTE_COLUMN. Records that print no line of their own come out unchanged.
+int printRecordNoted(OutputSink *out, const Y86Instruction *insn,
+                     int isFirstPosFlag, const char *note) {
+  size_t noteLength = strlen(note);
+  if (noteLength > MAX_NOTE_TEXT) {
+    noteLength = MAX_NOTE_TEXT;
+  }
+  // reserving the whole line up front keeps the record where it was printed
+  reserveOutput(out, MAX_RECORD_TEXT + NOTE_COLUMN + noteLength + 1);
+  char *start = out->buffer + out->used;
+  int printed = printRecord(out, insn, isFirstPosFlag);
+  if (printed == 0 || start[printed - 1] != '\n') {
+    return printed;
+  }
+  char *dst = start + printed - 1;
+  do {
+    *dst++ = ' ';
+  } while (dst - start < NOTE_COLUMN);
+  dst = copyText(dst, note, noteLength);
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
+}
+
+static const char *const kindNames[] = {"code", "quad", "byte", "pos",
+                                       "skip"};
+
+static char *copyField(char *dst, const char *name, uint64_t value) {
+  dst = copyText(dst, name, strlen(name));
+  return dst + formatDecimal(dst, value);
+}
+
+// print one record as a line of JSON. immediate is a hex string, since a
+// 64-bit value does not survive every JSON reader as a number.
+int printRecordJson(OutputSink *out, const Y86Instruction *insn,
+                    int isFirstPosFlag) {
+  const OpcodeDescriptor *op = &opcodeTable[insn->icode << 4 | insn->ifun];
+  char *start = reserveOutput(out, MAX_RECORD_TEXT + 64);
+  char *dst = copyField(start, "{\"address\":", insn->address);
+  dst = copyField(dst, ",\"length\":", insn->length);
+  dst = COPY_LITERAL(dst, ",\"kind\":\"");
+  dst = copyText(dst, kindNames[insn->kind], strlen(kindNames[insn->kind]));
+  dst = copyField(dst, "\",\"icode\":", insn->icode);
+  dst = copyField(dst, ",\"ifun\":", insn->ifun);
+  dst = copyField(dst, ",\"rA\":", insn->rA);
+  dst = copyField(dst, ",\"rB\":", insn->rB);
+  dst = COPY_LITERAL(dst, ",\"immediate\":\"0x");
+  dst += formatHex(dst, insn->immediate);
+  *dst++ = '"';
+  if (insn->kind == Y86_CODE) {
+    dst = COPY_LITERAL(dst, ",\"mnemonic\":\"");
+    dst = copyText(dst, op->mnemonic, strlen(op->mnemonic));
+    *dst++ = '"';
+  }
+  dst = COPY_LITERAL(dst, "}\n");
+  return finishLine(out, start, dst);
+}
+
+static char *copyLittleEndian(char *dst, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    *dst++ = (char)(value >> 8 * i);
+  }
+  return dst;
+}
+
+int printBinaryHeader(OutputSink *out, uint64_t startingOffset) {
+  char *start = reserveOutput(out, BINARY_HEADER_BYTES);
+  char *dst = COPY_LITERAL(start, BINARY_MAGIC);
+  dst = copyLittleEndian(dst, BINARY_VERSION, 2);
+  dst = copyLittleEndian(dst, BINARY_RECORD_BYTES, 2);
+  dst = copyLittleEndian(dst, startingOffset, 8);
+  return finishLine(out, start, dst);
+}
+
+// print one record in the fixed-width layout described in printRoutines.h
+int printRecordBinary(OutputSink *out, const Y86Instruction *insn,
+                      int isFirstPosFlag) {
+  char *start = reserveOutput(out, BINARY_RECORD_BYTES);
+  char *dst = copyLittleEndian(start, insn->address, 8);
+  dst = copyLittleEndian(dst, insn->immediate, 8);
+  dst = copyLittleEndian(dst, insn->length, 4);
+  *dst++ = (char)insn->kind;
+  *dst++ = (char)insn->icode;
+  *dst++ = (char)insn->ifun;
+  *dst++ = (char)insn->rA;
+  *dst++ = (char)insn->rB;
+  // zeros up to the next record
+  memset(dst, 0, (size_t)(start + BINARY_RECORD_BYTES - dst));
+  return finishLine(out, start, start + BINARY_RECORD_BYTES);
+}
+
+RecordPrinter recordPrinter(const char *format) {
+  if (format == NULL) {
+    return NULL;
+  } else if (strcmp(format, "text") == 0) {
+    return printRecord;
+  } else if (strcmp(format, "ndjson") == 0) {
+    return printRecordJson;
+  } else if (strcmp(format, "bin") == 0) {
+    return printRecordBinary;
+  }
+  return NULL;
 }
 
 // handles creating comments for every instruction. called from within
 // instruction-specific print functions.
 int commentHandler(int bigNibble, int littleNibble, int *nextBytes,
-                   int bytesNeeded, FILE *out) {
-  int comment = 0;
-  comment += fprintf(out, "%s", "            # ");
-  comment += fprintf(out, "%X", bigNibble);
-  comment += fprintf(out, "%X", littleNibble);
+                   int bytesNeeded, OutputSink *out) {
+  char *start = reserveOutput(out, MAX_RECORD_TEXT);
+  char *dst = COPY_LITERAL(start, "            # ");
+  dst += formatHexUpper(dst, bigNibble);
+  dst += formatHexUpper(dst, littleNibble);
 
   for (int i = 0; i < bytesNeeded; i++) {
-    comment += fprintf(out, "%02X", nextBytes[i]);
-  }
-  comment += fprintf(out, "\n");
-  return comment;
-}
-
-// Get the Dest, Dist, or Value from the next 8 bytes of the instruction for
-// printing Start reading at appropriate place from the next bytes based on the
-// instruction
-// @params: int *nextBytes, int startPos
-// @returns: int next8Bytes;
-unsigned long getInstructionValue(int *nextBytes, int startPos) {
-  int j = 0;
-  unsigned long next8Bytes = 0;
-  for (int i = startPos; i < (startPos + 8); i++) {
-    next8Bytes += (unsigned long)nextBytes[i] << 8 * j;
-    j++;
+    // %02X: always two digits
+    *dst++ = "0123456789ABCDEF"[(nextBytes[i] >> 4) & 0xF];
+    *dst++ = "0123456789ABCDEF"[nextBytes[i] & 0xF];
   }
-  return next8Bytes;
+  *dst++ = '\n';
+  return finishLine(out, start, dst);
 }
@@ -5,42 +5,62 @@
 #ifndef _PRINTROUTINES_H_
 #define _PRINTROUTINES_H_
 
-#include <stdio.h>
-
-int printPosition(FILE *, unsigned long);
-int printInstruction(FILE *);
-
-int printHalt(FILE *out, int *nextBytes, long *address);
-int printNop(FILE *out);
-int printRet(FILE *out);
-int printPos(FILE *out, long address, int isFirstPosFlag);
-
-unsigned long getInstructionValue(int *nextBytes, int startPos);
-
-int printIRMovQ(FILE *out, char *reg, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded);
-int printRMMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded);
-int printMRMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded);
-int printOpQ(FILE *out, char *instr, char *r1, char *r2, int bigNibble,
-             int littleNibble, int *nextBytes, int bytesNeeded);
-int printJXX(FILE *out, char *jmpInstr, int bigNibble, int littleNibble,
-             int *nextBytes, int bytesNeeded);
-int printCMovXX(FILE *out, char *instr, char *r1, char *r2, int bigNibble,
-                int littleNibble, int *nextBytes, int bytesNeeded);
-int printRRMovQ(FILE *out, char *r1, char *r2, int bigNibble, int littleNibble,
-                int *nextBytes, int bytesNeeded);
-int printPushQ(FILE *out, char *r1, int bigNibble, int littleNibble,
-               int *nextBytes, int bytesNeeded);
-int printPopQ(FILE *out, char *r1, int bigNibble, int littleNibble,
-              int *nextBytes, int bytesNeeded);
-int printCall(FILE *out, int bigNibble, int littleNibble, int *nextBytes,
-              int bytesNeeded);
-int printQuad(FILE *out, int bigNibble, int littleNibble, int n1, int n2,
-              int *nextBytes);
-int printByte(FILE *out, int bigNibble, int littleNibble);
+#include "decoder.h"
+#include "opcodeTable.h"
+#include "outputSink.h"
+#include "xrefIndex.h"
+
+// a label line lists this many referencing addresses before summarising
+#define XREF_LIST_LIMIT 8
+#define XREF_LINE_TEXT (64 + XREF_LIST_LIMIT * 20)
+
+// notes (--pipe, --annotate-hazards) start in this column, past the longest
+// instruction line, and are cut off after MAX_NOTE_TEXT characters
+#define NOTE_COLUMN 40
+#define MAX_NOTE_TEXT 128
+
+// --format=bin: a header of the magic, then version and record size as
+// 16-bit and the starting offset as 64-bit values, followed by one record
+// per decoded record, all little-endian:
+//
+//   0  address    8 bytes
+//   8  immediate  8 bytes
+//  16  length     4 bytes
+//  20  kind, icode, ifun, rA, rB (a byte each), then 7 bytes of zeros
+//
+// kind numbers follow the Y86_CODE... enum in decoder.h.
+#define BINARY_MAGIC "Y86R"
+#define BINARY_VERSION 1
+#define BINARY_HEADER_BYTES 16
+#define BINARY_RECORD_BYTES 32
+
+// A routine that prints one record, such as printRecord().
+typedef int (*RecordPrinter)(OutputSink *out, const Y86Instruction *insn,
+                             int isFirstPosFlag);
+
+int printPos(OutputSink *out, long address, int isFirstPosFlag);
+int printInstruction(OutputSink *out, const OpcodeDescriptor *op,
+                     const RegisterByte *registers, unsigned long value);
+int printQuad(OutputSink *out, const Y86Instruction *quad);
+int printByte(OutputSink *out, int bigNibble, int littleNibble);
+int printDataQuad(OutputSink *out, uint64_t value);
+int printLabel(OutputSink *out, const XrefIndex *index,
+               const XrefEntry *entry);
+int printBranchToLabel(OutputSink *out, const Y86Instruction *insn);
 int commentHandler(int bigNibble, int littleNibble, int *nextBytes,
-                   int bytesNeeded, FILE *outputFile);
+                   int bytesNeeded, OutputSink *out);
+int printRecord(OutputSink *out, const Y86Instruction *insn,
+                int isFirstPosFlag);
+int printRecordNoted(OutputSink *out, const Y86Instruction *insn,
+                     int isFirstPosFlag, const char *note);
+int printRecordJson(OutputSink *out, const Y86Instruction *insn,
+                    int isFirstPosFlag);
+int printBinaryHeader(OutputSink *out, uint64_t startingOffset);
+int printRecordBinary(OutputSink *out, const Y86Instruction *insn,
+                      int isFirstPosFlag);
+
+// The routine that prints records in the named format (text, ndjson or
+// bin), or NULL if there is no such format.
+RecordPrinter recordPrinter(const char *format);
 
 #endif /* PRINTROUTINES */
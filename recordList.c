@@ -0,0 +1,56 @@
+#include "recordList.h"
+
+#include <stdlib.h>
+
+#define RECORD_BATCH 4096
+
+void initRecordList(RecordList *list) {
+  list->records = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+void freeRecordList(RecordList *list) {
+  free(list->records);
+  initRecordList(list);
+}
+
+Y86Instruction *reserveRecords(RecordList *list, size_t more) {
+  if (list->capacity - list->count < more) {
+    size_t capacity = list->capacity == 0 ? RECORD_BATCH : list->capacity;
+    while (capacity - list->count < more) {
+      capacity *= 2;
+    }
+    Y86Instruction *grown =
+        realloc(list->records, capacity * sizeof(Y86Instruction));
+    if (grown == NULL) {
+      return NULL;
+    }
+    list->records = grown;
+    list->capacity = capacity;
+  }
+  return list->records + list->count;
+}
+
+int decodeIntoList(const uint8_t *bytes, size_t length, Y86Cursor *cursor,
+                   size_t end, RecordList *list) {
+  while (cursor->offset < end && cursor->offset < length) {
+    Y86Instruction *out = reserveRecords(list, RECORD_BATCH);
+    if (out == NULL) {
+      return -1;
+    }
+    // decode in batches, then give back any records that start past end so
+    // the sweep stops on the first record boundary at or after it.
+    size_t count = y86Decode(bytes, length, 0, cursor, out, RECORD_BATCH);
+    size_t kept = 0;
+    while (kept < count && out[kept].address < end) {
+      kept++;
+    }
+    list->count += kept;
+    if (kept < count) {
+      y86CursorAfter(&out[kept - 1], 0, cursor);
+      break;
+    }
+  }
+  return 0;
+}
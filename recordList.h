@@ -0,0 +1,33 @@
+/* This file contains a growable array of decoded records, defined in
+   recordList.c, for the modes that need more than one batch of records in
+   memory at a time.
+*/
+
+#ifndef _RECORDLIST_H_
+#define _RECORDLIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decoder.h"
+
+typedef struct {
+  Y86Instruction *records;
+  size_t count;
+  size_t capacity;
+} RecordList;
+
+void initRecordList(RecordList *list);
+void freeRecordList(RecordList *list);
+
+// Make room for at least more records past count and return where they go.
+// Returns NULL if the list could not grow.
+Y86Instruction *reserveRecords(RecordList *list, size_t more);
+
+// Continue the sweep at cursor until it passes end (or the end of the
+// buffer), appending every record to list. Returns 0, or -1 if the list
+// could not grow.
+int decodeIntoList(const uint8_t *bytes, size_t length, Y86Cursor *cursor,
+                   size_t end, RecordList *list);
+
+#endif /* RECORDLIST */
@@ -0,0 +1,251 @@
+#include "recursiveDescent.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "opcodeTable.h"
+#include "printRoutines.h"
+#include "xrefIndex.h"
+#include "zeroScan.h"
+
+/*
+  Recursive-descent disassembly.
+
+  Starting from the entry point, instructions are decoded one at a time and
+  their successors followed: the next instruction unless the last one was a
+  halt, ret or unconditional jmp, and the destination of every jXX and call.
+  Destinations still to be visited wait on a worklist, and a bitmap over the
+  image records which bytes start an instruction already decoded, so every
+  instruction is decoded once however many paths lead to it.
+
+  The listing then walks the image in address order. Bytes that start a
+  reached instruction print as code; the rest are data, printed as .quad
+  where eight of them sit on an 8-byte boundary and as .byte otherwise.
+  Runs of eight or more zero bytes in the data, and zeros padding it out to
+  an 8-byte boundary, are left out and the next line gets a .pos instead, as
+  in the linear listing. A long run ends at the last 8-byte boundary before
+  the next non-zero byte, so the quad holding that byte is kept whole.
+*/
+
+// a run of data zeros this long is shown as a .pos gap
+#define DATA_ZERO_RUN 8
+
+typedef struct {
+  size_t *addresses;
+  size_t count;
+  size_t capacity;
+} Worklist;
+
+int isReachedStart(const uint8_t *starts, size_t offset) {
+  return (starts[offset / 8] >> (offset % 8)) & 1;
+}
+
+static void mark(uint8_t *bitmap, size_t offset) {
+  bitmap[offset / 8] |= (uint8_t)(1 << (offset % 8));
+}
+
+static int pushAddress(Worklist *worklist, size_t address) {
+  if (worklist->count == worklist->capacity) {
+    size_t capacity = worklist->capacity == 0 ? 256 : worklist->capacity * 2;
+    size_t *grown = realloc(worklist->addresses, capacity * sizeof(size_t));
+    if (grown == NULL) {
+      return -1;
+    }
+    worklist->addresses = grown;
+    worklist->capacity = capacity;
+  }
+  worklist->addresses[worklist->count++] = address;
+  return 0;
+}
+
+int decodeReachedAt(const uint8_t *bytes, size_t length, size_t offset,
+                    Y86Instruction *insn) {
+  // not at a segment start: zero bytes reached by control flow are halts
+  Y86Cursor cursor = {offset, 0};
+  if (y86Decode(bytes, length, 0, &cursor, insn, 1) != 1) {
+    return 0;
+  }
+  if (insn->icode == 0 && insn->ifun == 0) {
+    // halt is one byte here; the linear sweep's habit of swallowing the
+    // byte after it would hide whatever that byte starts
+    insn->kind = Y86_CODE;
+    insn->length = 1;
+    return 1;
+  }
+  return insn->kind == Y86_CODE &&
+         insn->length == opcodeTable[insn->icode << 4 | insn->ifun].length;
+}
+
+// follow every path from entry, marking the first byte of each instruction
+// reached in starts and adding its branches to index, if there is one.
+static int traceCode(const uint8_t *bytes, size_t length, size_t entry,
+                     uint8_t *starts, XrefIndex *index) {
+  Worklist worklist = {NULL, 0, 0};
+  Y86Instruction insn;
+  int res = pushAddress(&worklist, entry);
+
+  while (res == 0 && worklist.count > 0) {
+    size_t offset = worklist.addresses[--worklist.count];
+
+    // walk the fall-through path until it ends or joins code already seen
+    while (offset < length && !isReachedStart(starts, offset) &&
+           decodeReachedAt(bytes, length, offset, &insn)) {
+      mark(starts, offset);
+      offset += insn.length;
+
+      if (insn.icode == 7 || insn.icode == 8) {
+        if (insn.immediate < length &&
+            !isReachedStart(starts, insn.immediate)) {
+          res |= pushAddress(&worklist, (size_t)insn.immediate);
+        }
+        if (index != NULL) {
+          res |= addXref(index, insn.immediate, offset - insn.length,
+                         insn.icode, insn.ifun);
+        }
+      }
+      // halt, ret and jmp do not fall through
+      if (insn.icode == 0 || insn.icode == 9 ||
+          (insn.icode == 7 && insn.ifun == 0)) {
+        break;
+      }
+    }
+  }
+  free(worklist.addresses);
+  return res;
+}
+
+size_t nextReachedStart(const uint8_t *bitmap, size_t from, size_t length) {
+  while (from < length && bitmap[from / 8] == 0) {
+    from = (from / 8 + 1) * 8;
+  }
+  while (from < length && !isReachedStart(bitmap, from)) {
+    from++;
+  }
+  return from < length ? from : length;
+}
+
+static size_t zeroRun(const uint8_t *bytes, size_t from, size_t end) {
+  size_t offset = from;
+  while (offset < end && bytes[offset] == 0) {
+    offset++;
+  }
+  return offset - from;
+}
+
+static uint64_t loadData(const uint8_t *bytes, size_t offset) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = value << 8 | bytes[offset + i];
+  }
+  return value;
+}
+
+void moveListingTo(RecursiveListing *listing, size_t address) {
+  if (listing->isFirstPosFlag || address != listing->next) {
+    printPos(listing->out, (long)address, listing->isFirstPosFlag);
+    listing->isFirstPosFlag = 0;
+  }
+}
+
+void printUnreached(RecursiveListing *listing, const uint8_t *bytes,
+                    size_t from, size_t end) {
+  size_t offset = from;
+  while (offset < end) {
+    size_t zeros = zeroRun(bytes, offset, end);
+    // a long run stops at the quad holding the next non-zero byte, so that
+    // one still prints as a .quad
+    if (zeros >= DATA_ZERO_RUN && (offset + zeros) % 8 != 0 &&
+        offset + zeros != end) {
+      zeros = (offset + zeros) / 8 * 8 - offset;
+    }
+    // long runs, alignment padding and trailing zeros become gaps
+    if (zeros >= DATA_ZERO_RUN ||
+        (zeros > 0 && ((offset + zeros) % 8 == 0 || offset + zeros == end))) {
+      offset += zeros;
+      continue;
+    }
+    moveListingTo(listing, offset);
+    if (offset % 8 == 0 && end - offset >= 8) {
+      printDataQuad(listing->out, loadData(bytes, offset));
+      offset += 8;
+    } else {
+      printByte(listing->out, bytes[offset] >> 4, bytes[offset] & 0xF);
+      offset++;
+    }
+    listing->next = offset;
+  }
+}
+
+// clear the starts that fall inside an earlier reached instruction (jumps
+// into the middle of it), so starts holds exactly the lines listed and a
+// branch is only given a label that is printed.
+static void dropHiddenStarts(const uint8_t *bytes, size_t length,
+                             uint8_t *starts) {
+  Y86Instruction insn;
+  size_t code = nextReachedStart(starts, 0, length);
+  while (code < length) {
+    decodeReachedAt(bytes, length, code, &insn);
+    size_t end = code + insn.length;
+    for (size_t inside = code + 1; inside < end && inside < length;
+         inside++) {
+      starts[inside / 8] &= (uint8_t)~(1 << (inside % 8));
+    }
+    code = nextReachedStart(starts, end, length);
+  }
+}
+
+int traceReachableCode(const uint8_t *machineCode, size_t length, long entry,
+                       uint8_t *starts, XrefIndex *index) {
+  // like the linear sweep, the program starts after any zero bytes at entry
+  size_t start = (size_t)entry < length
+                     ? findNonZero(machineCode, (size_t)entry, length)
+                     : length;
+  return start < length
+             ? traceCode(machineCode, length, start, starts, index)
+             : 0;
+}
+
+int disassembleRecursive(const uint8_t *machineCode, size_t length,
+                         long entry, int labelled, OutputSink *outputFile) {
+  XrefIndex index;
+  XrefIndex *xrefs = labelled ? &index : NULL;
+  uint8_t *starts = calloc(length / 8 + 1, 1);
+  if (starts == NULL) {
+    return -1;
+  }
+  initXrefIndex(&index);
+  if (traceReachableCode(machineCode, length, entry, starts, xrefs) != 0) {
+    free(starts);
+    freeXrefIndex(&index);
+    return -1;
+  }
+  dropHiddenStarts(machineCode, length, starts);
+
+  RecursiveListing listing = {outputFile, 0, 1};
+  Y86Instruction insn;
+  size_t offset = 0;
+  while (offset < length) {
+    size_t code = nextReachedStart(starts, offset, length);
+    printUnreached(&listing, machineCode, offset, code);
+    if (code == length) {
+      break;
+    }
+    decodeReachedAt(machineCode, length, code, &insn);
+    moveListingTo(&listing, code);
+    const XrefEntry *entry = xrefs == NULL ? NULL : findXrefs(xrefs, code);
+    if (entry != NULL) {
+      printLabel(outputFile, xrefs, entry);
+    }
+    if (xrefs != NULL && (insn.icode == 7 || insn.icode == 8) &&
+        insn.immediate < length && isReachedStart(starts, insn.immediate)) {
+      printBranchToLabel(outputFile, &insn);
+    } else {
+      printRecord(outputFile, &insn, 0);
+    }
+    offset = listing.next = code + insn.length;
+  }
+  free(starts);
+  freeXrefIndex(&index);
+  return 0;
+}
@@ -0,0 +1,56 @@
+/* This file contains the prototype for the control-flow-following
+   disassembly defined in recursiveDescent.c (the --recursive option).
+*/
+
+#ifndef _RECURSIVEDESCENT_H_
+#define _RECURSIVEDESCENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decoder.h"
+#include "outputSink.h"
+#include "xrefIndex.h"
+
+// Print a listing of the image in which only code reachable from the first
+// non-zero byte at or after entry is decoded, following jXX and call
+// targets and fall-through edges. Every byte no path reaches is printed as
+// data. With labelled set, branch destinations get label lines and are
+// named by their labels, as in disassembleLabelled(). Returns 0, or -1 if
+// memory ran out.
+int disassembleRecursive(const uint8_t *machineCode, size_t length,
+                         long entry, int labelled, OutputSink *outputFile);
+
+// The pieces of that listing, for other passes over the reachable code.
+
+// Mark the first byte of every instruction reachable from the first non-zero
+// byte at or after entry in starts, a zeroed bitmap of length / 8 + 1 bytes,
+// and add each jXX and call to index unless it is NULL. Returns 0, or -1 if
+// memory ran out.
+int traceReachableCode(const uint8_t *machineCode, size_t length, long entry,
+                       uint8_t *starts, XrefIndex *index);
+int isReachedStart(const uint8_t *starts, size_t offset);
+// the first reached start at or after from, or length if there is none
+size_t nextReachedStart(const uint8_t *starts, size_t from, size_t length);
+// Decode the instruction at offset, where a halt is a single byte. Returns
+// 0 when the bytes there are not a complete, valid instruction.
+int decodeReachedAt(const uint8_t *bytes, size_t length, size_t offset,
+                    Y86Instruction *insn);
+
+// A listing written in address order.
+typedef struct {
+  OutputSink *out;
+  size_t next; // address just past the last line printed
+  int isFirstPosFlag;
+} RecursiveListing;
+
+// Start a new .pos segment unless the line at address follows straight on
+// from the last one.
+void moveListingTo(RecursiveListing *listing, size_t address);
+// Print the bytes from..end, which no path reaches, as data: .quad where
+// eight of them sit on an 8-byte boundary, .byte otherwise, and gaps for
+// runs of zeros.
+void printUnreached(RecursiveListing *listing, const uint8_t *bytes,
+                    size_t from, size_t end);
+
+#endif /* RECURSIVEDESCENT */
@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "segmentIndex.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "machineImage.h"
+
+/*
+  Range listings.
+
+  Where a record starts depends on every byte before it, so a range can only
+  be listed correctly by resuming a sweep at a known record boundary with
+  the cursor state the sweep had there. The index keeps those boundaries:
+  the start of each .pos segment that the decoder finds after a zero run,
+  plus one every INDEX_INTERVAL bytes inside long segments. Finding the one
+  for a range is a binary search in the mapped index, and the decoder then
+  walks at most INDEX_INTERVAL bytes to reach the range.
+
+  The index is checked against the image's length and modification time,
+  not its contents, so listing a range never reads the rest of the image.
+*/
+
+#define RECORD_BATCH 1024
+
+typedef struct {
+  uint64_t *checkpoints;
+  size_t count;
+  size_t capacity;
+} Checkpoints;
+
+static uint64_t loadLittleEndian(const uint8_t *src, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = value << 8 | src[i];
+  }
+  return value;
+}
+
+static char *storeLittleEndian(char *dst, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    *dst++ = (char)(value >> 8 * i);
+  }
+  return dst;
+}
+
+static int addCheckpoint(Checkpoints *list, const Y86Cursor *cursor) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+    uint64_t *grown = realloc(list->checkpoints, capacity * sizeof(uint64_t));
+    if (grown == NULL) {
+      return -1;
+    }
+    list->checkpoints = grown;
+    list->capacity = capacity;
+  }
+  list->checkpoints[list->count++] =
+      (uint64_t)cursor->offset << 1 | (cursor->atSegmentStart != 0);
+  return 0;
+}
+
+// sweep the whole image from startingOffset, noting where it can resume
+static int findCheckpoints(const uint8_t *machineCode, size_t length,
+                           long startingOffset, Checkpoints *list) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  Y86Cursor before; // the sweep's state before the next record
+  size_t count;
+
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  before = cursor;
+  if (addCheckpoint(list, &before) != 0) {
+    return -1;
+  }
+  uint64_t last = before.offset;
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (records[i].address - last >= INDEX_INTERVAL) {
+        if (addCheckpoint(list, &before) != 0) {
+          return -1;
+        }
+        last = records[i].address;
+      }
+      y86CursorAfter(&records[i], 0, &before);
+      if (records[i].kind == Y86_POS) {
+        if (addCheckpoint(list, &before) != 0) {
+          return -1;
+        }
+        last = before.offset;
+      }
+    }
+  }
+  return 0;
+}
+
+// write the index for the image to a temporary file next to indexPath and
+// rename it into place, so a reader never maps half an index
+static int writeIndex(const char *indexPath, const Checkpoints *list,
+                      long startingOffset, size_t length,
+                      const struct stat *info) {
+  OutputSink sink;
+  char header[INDEX_HEADER_BYTES];
+  size_t pathLength = strlen(indexPath);
+  char *tempPath = malloc(pathLength + sizeof(".XXXXXX"));
+  if (tempPath == NULL) {
+    return -1;
+  }
+  memcpy(tempPath, indexPath, pathLength);
+  memcpy(tempPath + pathLength, ".XXXXXX", sizeof(".XXXXXX"));
+  int fd = mkstemp(tempPath);
+  if (fd < 0 || openOutputSink(&sink, fd, OUTPUT_SINK_CAPACITY) != 0) {
+    int savedErrno = errno;
+    if (fd >= 0) {
+      close(fd);
+      unlink(tempPath);
+    }
+    free(tempPath);
+    errno = savedErrno;
+    return -1;
+  }
+  fchmod(fd, 0644);
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, INDEX_MAGIC, 4);
+  char *dst = storeLittleEndian(header + 4, INDEX_VERSION, 2);
+  dst = storeLittleEndian(dst, INDEX_CHECKPOINT_BYTES, 2);
+  dst = storeLittleEndian(dst, (uint64_t)startingOffset, 8);
+  dst = storeLittleEndian(dst, length, 8);
+  dst = storeLittleEndian(dst, (uint64_t)info->st_mtim.tv_sec, 8);
+  dst = storeLittleEndian(dst, (uint64_t)info->st_mtim.tv_nsec, 8);
+  dst = storeLittleEndian(dst, INDEX_INTERVAL, 8);
+  storeLittleEndian(dst, list->count, 8);
+  appendOutput(&sink, header, sizeof(header));
+  for (size_t i = 0; i < list->count; i++) {
+    char *entry = reserveOutput(&sink, INDEX_CHECKPOINT_BYTES);
+    commitOutput(&sink, storeLittleEndian(entry, list->checkpoints[i],
+                                          INDEX_CHECKPOINT_BYTES));
+  }
+
+  int res = closeOutputSink(&sink);
+  int savedErrno = errno;
+  close(fd);
+  if (res == 0 && rename(tempPath, indexPath) != 0) {
+    savedErrno = errno;
+    res = -1;
+  }
+  if (res != 0) {
+    unlink(tempPath);
+  }
+  free(tempPath);
+  errno = savedErrno;
+  return res;
+}
+
+// whether the mapped index was written for this image and sweep
+static int isCurrentIndex(const MachineImage *index, long startingOffset,
+                          size_t length, const struct stat *info) {
+  const uint8_t *bytes = index->bytes;
+  if (index->length < INDEX_HEADER_BYTES ||
+      memcmp(bytes, INDEX_MAGIC, 4) != 0 ||
+      loadLittleEndian(bytes + 4, 2) != INDEX_VERSION ||
+      loadLittleEndian(bytes + 6, 2) != INDEX_CHECKPOINT_BYTES) {
+    return 0;
+  }
+  uint64_t count = loadLittleEndian(bytes + 48, 8);
+  return loadLittleEndian(bytes + 8, 8) == (uint64_t)startingOffset &&
+         loadLittleEndian(bytes + 16, 8) == length &&
+         loadLittleEndian(bytes + 24, 8) == (uint64_t)info->st_mtim.tv_sec &&
+         loadLittleEndian(bytes + 32, 8) == (uint64_t)info->st_mtim.tv_nsec &&
+         count > 0 &&
+         count == (index->length - INDEX_HEADER_BYTES) / INDEX_CHECKPOINT_BYTES;
+}
+
+// map the index at indexPath for the image, building it first when it is
+// missing or stale
+static int openIndex(const char *indexPath, const uint8_t *machineCode,
+                     size_t length, long startingOffset,
+                     const struct stat *info, MachineImage *index) {
+  if (openMachineImage(indexPath, index) == 0) {
+    if (isCurrentIndex(index, startingOffset, length, info)) {
+      return 0;
+    }
+    closeMachineImage(index);
+  }
+
+  Checkpoints list = {NULL, 0, 0};
+  int res = findCheckpoints(machineCode, length, startingOffset, &list);
+  if (res == 0) {
+    res = writeIndex(indexPath, &list, startingOffset, length, info);
+  }
+  if (res == 0) {
+    fprintf(stderr, "Wrote index %s with %llu checkpoints\n", indexPath,
+            (unsigned long long)list.count);
+  }
+  free(list.checkpoints);
+  if (res == 0 && openMachineImage(indexPath, index) != 0) {
+    res = -1;
+  }
+  return res;
+}
+
+// the cursor of the last checkpoint in index at or before start
+static Y86Cursor findCheckpoint(const MachineImage *index, uint64_t start) {
+  const uint8_t *checkpoints = index->bytes + INDEX_HEADER_BYTES;
+  size_t lo = 0;
+  size_t hi = (index->length - INDEX_HEADER_BYTES) / INDEX_CHECKPOINT_BYTES;
+  // the first checkpoint is where the sweep starts, so it always qualifies
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint64_t checkpoint = loadLittleEndian(
+        checkpoints + mid * INDEX_CHECKPOINT_BYTES, INDEX_CHECKPOINT_BYTES);
+    if (checkpoint >> 1 <= start) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  uint64_t checkpoint = loadLittleEndian(
+      checkpoints + lo * INDEX_CHECKPOINT_BYTES, INDEX_CHECKPOINT_BYTES);
+  Y86Cursor cursor;
+  cursor.offset = (size_t)(checkpoint >> 1);
+  cursor.atSegmentStart = (int)(checkpoint & 1);
+  return cursor;
+}
+
+int parseRange(const char *text, uint64_t *start, uint64_t *end) {
+  char *last;
+  *start = strtoull(text, &last, 0);
+  if (last == text || *last != '-') {
+    return -1;
+  }
+  text = last + 1;
+  if (*text == '\0') {
+    *end = UINT64_MAX;
+    return 0;
+  }
+  *end = strtoull(text, &last, 0);
+  return *last == '\0' && *end > *start ? 0 : -1;
+}
+
+int disassembleRange(const uint8_t *machineCode, size_t length,
+                     long startingOffset, uint64_t start, uint64_t end,
+                     const char *imagePath, const char *indexPath,
+                     RecordPrinter print, OutputSink *outputFile,
+                     uint64_t *sweptFrom) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  size_t count;
+  int isFirstPosFlag = 1;
+
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  if (indexPath != NULL) {
+    struct stat info;
+    MachineImage index;
+    if (stat(imagePath, &info) != 0 ||
+        openIndex(indexPath, machineCode, length, startingOffset, &info,
+                  &index) != 0) {
+      return -1;
+    }
+    cursor = findCheckpoint(&index, start);
+    closeMachineImage(&index);
+  }
+  if (sweptFrom != NULL) {
+    *sweptFrom = cursor.offset;
+  }
+
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const Y86Instruction *insn = &records[i];
+      if (insn->address >= end) {
+        return 0;
+      }
+      if (insn->address + insn->length > start) {
+        // a text listing opens with a .pos for its first line
+        if (isFirstPosFlag && print == printRecord &&
+            insn->kind != Y86_POS && insn->kind != Y86_SKIP) {
+          printPos(outputFile, (long)insn->address, 1);
+          isFirstPosFlag = 0;
+        }
+        if (print(outputFile, insn, isFirstPosFlag) > 0) {
+          isFirstPosFlag = 0;
+        }
+      }
+    }
+  }
+  return 0;
+}
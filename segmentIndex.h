@@ -0,0 +1,56 @@
+/* This file contains the range listing (the --range option) and the index
+   sidecar that lets it start near the range (--index), defined in
+   segmentIndex.c.
+*/
+
+#ifndef _SEGMENTINDEX_H_
+#define _SEGMENTINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outputSink.h"
+#include "printRoutines.h"
+
+// An index file is a 64-byte header followed by one 8-byte checkpoint per
+// place a sweep can resume from, all little-endian:
+//
+//   0  magic                       "Y86I"
+//   4  version, checkpoint size    16 bits each
+//   8  starting offset of the sweep
+//  16  length of the image         which, with its modification time,
+//  24  modification time, seconds  tells whether the index is stale
+//  32  and nanoseconds
+//  40  bytes between checkpoints
+//  48  number of checkpoints       then 8 bytes of zeros
+//
+// A checkpoint holds an offset at which a record of the sweep starts,
+// shifted left by one, with the cursor's atSegmentStart in the low bit.
+// There is one at the start of every .pos segment and one at least every
+// INDEX_INTERVAL bytes, in ascending order.
+#define INDEX_MAGIC "Y86I"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_BYTES 64
+#define INDEX_CHECKPOINT_BYTES 8
+#define INDEX_INTERVAL 4096
+
+// Parse "START-END" (END may be left out for the end of the image, which
+// sets *end to UINT64_MAX). Returns 0, or -1 if text is not a range.
+int parseRange(const char *text, uint64_t *start, uint64_t *end);
+
+// Print the records of the sweep from startingOffset that overlap
+// [start, end) of the image (machineCode, length) read from imagePath, the
+// same lines a whole listing has for those bytes. Without an indexPath the
+// sweep is decoded from startingOffset with nothing printed up to start.
+// With one, the index there is built first if it is missing or stale, and
+// the sweep resumes from the last checkpoint at or before start, which is
+// stored in *sweptFrom unless it is NULL. A text listing opens with a .pos
+// for its first line, as a whole listing does after a zero run. Returns 0,
+// or -1 with errno set if the index could not be read or written.
+int disassembleRange(const uint8_t *machineCode, size_t length,
+                     long startingOffset, uint64_t start, uint64_t end,
+                     const char *imagePath, const char *indexPath,
+                     RecordPrinter print, OutputSink *outputFile,
+                     uint64_t *sweptFrom);
+
+#endif /* SEGMENTINDEX */
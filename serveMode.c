@@ -0,0 +1,872 @@
+#define _XOPEN_SOURCE 700
+
+#include "serveMode.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "disassembler.h"
+#include "machineImage.h"
+#include "outputSink.h"
+#include "printRoutines.h"
+#include "segmentIndex.h"
+#include "threadPool.h"
+
+/*
+  Listing server.
+
+  The main thread owns the connections. It polls the idle ones, together
+  with the listening socket, and queues a connection on the thread pool
+  when a request arrives on it; the worker answers that one request and
+  hands the connection back through a list and a pipe that wakes the main
+  thread. So a client that keeps its connection open between requests
+  holds no worker, and a client that stops halfway through a request holds
+  one for at most SERVE_TIMEOUT seconds. Finished listings are kept in a
+  table shared by the workers and evicted least recently used first once
+  they take more than the capacity.
+  A request for a file costs a stat() to build its key; when the listing is
+  in the table it is sent straight from there, without opening the file.
+
+  Entries are reference counted, so a worker can send one without holding
+  the table's lock and eviction never frees a listing that is being sent.
+*/
+
+#define LISTING_BUCKETS 4096
+#define LISTING_KEY_TEXT 160
+// the first listing buffer a request formats into; it grows as needed
+#define LISTING_SINK_CAPACITY (64 * 1024)
+#define CONNECTION_BUFFER (2 * SERVE_MAX_LINE)
+
+typedef struct Listing {
+  char key[LISTING_KEY_TEXT];
+  char *text;
+  size_t length;
+  int refs;                   // one for the table while it holds it
+  struct Listing *newer;      // the table's recency list
+  struct Listing *older;
+  struct Listing *nextInBucket;
+} Listing;
+
+typedef struct {
+  pthread_mutex_t lock;
+  Listing *buckets[LISTING_BUCKETS];
+  Listing *newest;
+  Listing *oldest;
+  uint64_t used; // bytes of listings held
+  uint64_t capacity;
+} ListingTable;
+
+typedef struct Connection Connection;
+
+typedef struct {
+  ListingTable table;
+  pthread_mutex_t lock;   // guards finished
+  Connection *finished;   // handed back by the workers
+  int wake[2];            // a byte written to wake[1] wakes the main thread
+} Server;
+
+struct Connection {
+  int fd;
+  int closing; // set by the worker when the connection cannot go on
+  Server *server;
+  Connection *next; // in the server's finished list
+  char buffer[CONNECTION_BUFFER];
+  size_t start; // unread input is buffer[start .. end)
+  size_t end;
+};
+
+typedef struct {
+  long startingOffset;
+  const char *format;
+  RecordPrinter print;
+  const char *range; // NULL for the whole listing
+  uint64_t rangeStart;
+  uint64_t rangeEnd;
+  const char *path; // NULL when the image follows as inline bytes
+  size_t byteCount;
+} Request;
+
+static void releaseListing(ListingTable *table, Listing *listing) {
+  pthread_mutex_lock(&table->lock);
+  int refs = --listing->refs;
+  pthread_mutex_unlock(&table->lock);
+  if (refs == 0) {
+    free(listing->text);
+    free(listing);
+  }
+}
+
+static Listing **findBucket(ListingTable *table, const char *key) {
+  uint64_t hash = xxHash64(key, strlen(key), 0);
+  return &table->buckets[hash % LISTING_BUCKETS];
+}
+
+// take listing out of the recency list. the caller holds the lock.
+static void unlinkListing(ListingTable *table, Listing *listing) {
+  if (listing->newer != NULL) {
+    listing->newer->older = listing->older;
+  } else {
+    table->newest = listing->older;
+  }
+  if (listing->older != NULL) {
+    listing->older->newer = listing->newer;
+  } else {
+    table->oldest = listing->newer;
+  }
+}
+
+static void linkNewest(ListingTable *table, Listing *listing) {
+  listing->newer = NULL;
+  listing->older = table->newest;
+  if (table->newest != NULL) {
+    table->newest->newer = listing;
+  } else {
+    table->oldest = listing;
+  }
+  table->newest = listing;
+}
+
+// the listing for key, marked as just used and referenced for the caller,
+// or NULL
+static Listing *findListing(ListingTable *table, const char *key) {
+  pthread_mutex_lock(&table->lock);
+  Listing *listing = *findBucket(table, key);
+  while (listing != NULL && strcmp(listing->key, key) != 0) {
+    listing = listing->nextInBucket;
+  }
+  if (listing != NULL) {
+    listing->refs++;
+    unlinkListing(table, listing);
+    linkNewest(table, listing);
+  }
+  pthread_mutex_unlock(&table->lock);
+  return listing;
+}
+
+// evict the least recently used listings until the table fits its
+// capacity. the caller holds the lock.
+static void evictListings(ListingTable *table) {
+  while (table->used > table->capacity && table->oldest != NULL) {
+    Listing *victim = table->oldest;
+    Listing **link = findBucket(table, victim->key);
+    while (*link != victim) {
+      link = &(*link)->nextInBucket;
+    }
+    *link = victim->nextInBucket;
+    unlinkListing(table, victim);
+    table->used -= victim->length;
+    if (--victim->refs == 0) {
+      free(victim->text);
+      free(victim);
+    }
+  }
+}
+
+// put listing in the table, unless it is bigger than the whole table or
+// another worker put the same one there first, and keep the caller's
+// reference to it.
+static void addListing(ListingTable *table, Listing *listing) {
+  pthread_mutex_lock(&table->lock);
+  Listing **bucket = findBucket(table, listing->key);
+  Listing *present = *bucket;
+  while (present != NULL && strcmp(present->key, listing->key) != 0) {
+    present = present->nextInBucket;
+  }
+  if (present == NULL && listing->length <= table->capacity) {
+    listing->refs++;
+    listing->nextInBucket = *bucket;
+    *bucket = listing;
+    linkNewest(table, listing);
+    table->used += listing->length;
+    evictListings(table);
+  }
+  pthread_mutex_unlock(&table->lock);
+}
+
+static int sendAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += sent;
+    length -= (size_t)sent;
+  }
+  return 0;
+}
+
+static int sendError(int fd, const char *message, const char *detail) {
+  char text[SERVE_MAX_LINE];
+  int written =
+      snprintf(text, sizeof(text), "ERROR %s%s%s\n", message,
+               detail == NULL ? "" : ": ", detail == NULL ? "" : detail);
+  if (written >= (int)sizeof(text)) {
+    written = (int)sizeof(text) - 1;
+    text[written - 1] = '\n';
+  }
+  return sendAll(fd, text, (size_t)written);
+}
+
+// the next request line, with its newline replaced by a NUL, or NULL with
+// errno set to 0 at the end of the input, EMSGSIZE for a line too long to be
+// a request, ETIMEDOUT if the rest of the line did not come in time, or as
+// read() left it. the line stays valid until the next read from the
+// connection.
+static char *readLine(Connection *connection) {
+  size_t scanned = connection->start;
+  for (;;) {
+    char *newline = memchr(connection->buffer + scanned, '\n',
+                           connection->end - scanned);
+    if (newline != NULL) {
+      char *line = connection->buffer + connection->start;
+      *newline = '\0';
+      connection->start = (size_t)(newline + 1 - connection->buffer);
+      return line;
+    }
+    if (connection->end - connection->start >= SERVE_MAX_LINE) {
+      errno = EMSGSIZE;
+      return NULL;
+    }
+    if (connection->end == sizeof(connection->buffer)) {
+      size_t unread = connection->end - connection->start;
+      memmove(connection->buffer, connection->buffer + connection->start,
+              unread);
+      connection->start = 0;
+      connection->end = unread;
+    }
+    scanned = connection->end;
+    ssize_t got = read(connection->fd, connection->buffer + connection->end,
+                       sizeof(connection->buffer) - connection->end);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      errno = got == 0                                    ? 0
+              : errno == EAGAIN || errno == EWOULDBLOCK ? ETIMEDOUT
+                                                          : errno;
+      return NULL;
+    }
+    connection->end += (size_t)got;
+  }
+}
+
+// read the count bytes of an inline image into a new buffer. Returns NULL
+// with errno set to ENOMEM, EPIPE if the connection ended first, ETIMEDOUT
+// if the bytes did not come in time, or as read() left it.
+static uint8_t *readBytes(Connection *connection, size_t count) {
+  uint8_t *bytes = malloc(count == 0 ? 1 : count);
+  if (bytes == NULL) {
+    return NULL;
+  }
+  size_t buffered = connection->end - connection->start;
+  size_t done = buffered < count ? buffered : count;
+  memcpy(bytes, connection->buffer + connection->start, done);
+  connection->start += done;
+  while (done < count) {
+    ssize_t got = read(connection->fd, bytes + done, count - done);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      errno = got == 0                                    ? EPIPE
+              : errno == EAGAIN || errno == EWOULDBLOCK ? ETIMEDOUT
+                                                          : errno;
+      free(bytes);
+      return NULL;
+    }
+    done += (size_t)got;
+  }
+  return bytes;
+}
+
+// a whole field of digits (hex with 0x), or -1 if text is not one
+static int parseNumber(const char *text, uint64_t *value) {
+  char *end;
+  *value = strtoull(text, &end, 0);
+  return end != text && *end == '\0' && *text != '-' ? 0 : -1;
+}
+
+// split the request line into request. Returns 0, or -1 if it is not a
+// request.
+static int parseRequest(char *line, Request *request) {
+  int hasBytes = 0;
+  uint64_t number;
+
+  memset(request, 0, sizeof(*request));
+  request->format = "text";
+  request->print = printRecord;
+  while (*line != '\0') {
+    if (strncmp(line, "path=", 5) == 0) {
+      request->path = line + 5;
+      return hasBytes || *request->path == '\0' ? -1 : 0;
+    }
+    char *end = strchr(line, ' ');
+    if (end != NULL) {
+      *end = '\0';
+    }
+    if (strncmp(line, "offset=", 7) == 0) {
+      if (parseNumber(line + 7, &number) != 0 || number > LONG_MAX) {
+        return -1;
+      }
+      request->startingOffset = (long)number;
+    } else if (strncmp(line, "bytes=", 6) == 0) {
+      if (parseNumber(line + 6, &number) != 0 || number > SIZE_MAX) {
+        return -1;
+      }
+      request->byteCount = (size_t)number;
+      hasBytes = 1;
+    } else if (strncmp(line, "format=", 7) == 0) {
+      request->format = line + 7;
+      request->print = recordPrinter(request->format);
+      if (request->print == NULL) {
+        return -1;
+      }
+    } else if (strncmp(line, "range=", 6) == 0) {
+      request->range = line + 6;
+      if (parseRange(request->range, &request->rangeStart,
+                     &request->rangeEnd) != 0) {
+        return -1;
+      }
+    } else {
+      return -1;
+    }
+    line = end == NULL ? line + strlen(line) : end + 1;
+  }
+  return hasBytes ? 0 : -1;
+}
+
+// the key of the listing the request asks for, of the file described by
+// info or, without one, of the inline bytes
+static void listingKey(const Request *request, const struct stat *info,
+                       const uint8_t *bytes, char *key) {
+  int written;
+  if (info != NULL) {
+    written = snprintf(key, LISTING_KEY_TEXT, "file %llx:%llx %llx %lld.%09ld",
+                       (unsigned long long)info->st_dev,
+                       (unsigned long long)info->st_ino,
+                       (unsigned long long)info->st_size,
+                       (long long)info->st_mtim.tv_sec,
+                       (long)info->st_mtim.tv_nsec);
+  } else {
+    written = snprintf(
+        key, LISTING_KEY_TEXT, "bytes %016llx %zx",
+        (unsigned long long)xxHash64(bytes, request->byteCount, 0),
+        request->byteCount);
+  }
+  snprintf(key + written, LISTING_KEY_TEXT - (size_t)written,
+           " %lx %s %llx-%llx", request->startingOffset, request->format,
+           (unsigned long long)request->rangeStart,
+           (unsigned long long)request->rangeEnd);
+}
+
+// format the listing the request asks for into a new entry for key.
+// Returns NULL with errno set if it could not be made.
+static Listing *makeListing(const Request *request, const uint8_t *bytes,
+                            size_t length, const char *key) {
+  OutputSink text;
+  int res = 0;
+  Listing *listing = calloc(1, sizeof(Listing));
+  if (listing == NULL ||
+      openOutputSink(&text, -1, LISTING_SINK_CAPACITY) != 0) {
+    free(listing);
+    return NULL;
+  }
+  if (request->print == printRecordBinary) {
+    printBinaryHeader(&text, (uint64_t)request->startingOffset);
+  }
+  if (request->range != NULL) {
+    res = disassembleRange(bytes, length, request->startingOffset,
+                           request->rangeStart, request->rangeEnd, NULL, NULL,
+                           request->print, &text, NULL);
+  } else {
+    disassemble(bytes, length, request->startingOffset, request->print,
+                &text, NULL);
+  }
+  if (res != 0 || text.error != 0) {
+    int error = res != 0 ? errno : text.error;
+    closeOutputSink(&text);
+    free(listing);
+    errno = error;
+    return NULL;
+  }
+  strcpy(listing->key, key);
+  listing->text = text.buffer;
+  listing->length = text.used;
+  listing->refs = 1;
+  return listing;
+}
+
+// find or make the listing a request asks for. Returns NULL after
+// answering with the error, with *failed set if the connection is no longer
+// usable.
+static Listing *lookUpListing(Connection *connection, const Request *request,
+                              int *failed) {
+  char key[LISTING_KEY_TEXT];
+  uint8_t *bytes = NULL;
+  struct stat info;
+  Listing *listing;
+
+  if (request->path == NULL) {
+    bytes = readBytes(connection, request->byteCount);
+    if (bytes == NULL) {
+      if (errno != EPIPE) {
+        sendError(connection->fd, strerror(errno), NULL);
+      }
+      *failed = 1;
+      return NULL;
+    }
+    listingKey(request, NULL, bytes, key);
+  } else if (stat(request->path, &info) == 0) {
+    listingKey(request, &info, NULL, key);
+  } else {
+    *failed = sendError(connection->fd, strerror(errno), request->path) != 0;
+    return NULL;
+  }
+
+  listing = findListing(&connection->server->table, key);
+  if (listing == NULL && bytes != NULL) {
+    listing = makeListing(request, bytes, request->byteCount, key);
+  } else if (listing == NULL) {
+    MachineImage image;
+    if (openMachineImage(request->path, &image) != 0) {
+      *failed = sendError(connection->fd, strerror(errno), request->path) != 0;
+      return NULL;
+    }
+    listing = makeListing(request, image.bytes, image.length, key);
+    int error = errno;
+    closeMachineImage(&image);
+    errno = error;
+  } else {
+    free(bytes);
+    return listing;
+  }
+  if (listing == NULL) {
+    *failed = sendError(connection->fd, strerror(errno), NULL) != 0;
+    free(bytes);
+    return NULL;
+  }
+  free(bytes);
+  addListing(&connection->server->table, listing);
+  return listing;
+}
+
+// answer the next request on a connection. Returns 0, or -1 if the
+// connection ended or can no longer be used.
+static int answerRequest(Connection *connection) {
+  Request request;
+  int failed = 0;
+
+  char *line = readLine(connection);
+  if (line == NULL) {
+    if (errno != 0) {
+      sendError(connection->fd, strerror(errno), NULL);
+    }
+    return -1;
+  }
+  if (parseRequest(line, &request) != 0) {
+    sendError(connection->fd, "not a request", NULL);
+    return -1;
+  }
+  if (request.path == NULL && request.byteCount > SERVE_MAX_BYTES) {
+    sendError(connection->fd, "inline image too large", NULL);
+    return -1;
+  }
+  Listing *listing = lookUpListing(connection, &request, &failed);
+  if (listing == NULL) {
+    return failed ? -1 : 0;
+  }
+  char header[32];
+  int written = snprintf(header, sizeof(header), "OK %zu\n", listing->length);
+  failed = sendAll(connection->fd, header, (size_t)written) != 0 ||
+           sendAll(connection->fd, listing->text, listing->length) != 0;
+  releaseListing(&connection->server->table, listing);
+  return failed ? -1 : 0;
+}
+
+// answer one request, then hand the connection back to the main thread
+static void serveRequest(void *arg) {
+  Connection *connection = arg;
+  Server *server = connection->server;
+
+  connection->closing = answerRequest(connection) != 0;
+  pthread_mutex_lock(&server->lock);
+  connection->next = server->finished;
+  server->finished = connection;
+  pthread_mutex_unlock(&server->lock);
+  // the pipe is non-blocking; when it is full the main thread is awake
+  while (write(server->wake[1], "", 1) < 0 && errno == EINTR) {
+  }
+}
+
+static int fillAddress(struct sockaddr_un *address, const char *socketPath) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(address->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(address->sun_path, socketPath);
+  return 0;
+}
+
+// bind a listening socket to socketPath. A socket file left there by a
+// server that is gone is replaced; one with a server behind it is not.
+static int listenOn(const char *socketPath) {
+  struct sockaddr_un address;
+  if (fillAddress(&address, socketPath) != 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+  if (res != 0 && errno == EADDRINUSE) {
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 &&
+        connect(probe, (struct sockaddr *)&address, sizeof(address)) != 0 &&
+        errno == ECONNREFUSED && unlink(socketPath) == 0) {
+      res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    } else {
+      errno = EADDRINUSE;
+    }
+    if (probe >= 0) {
+      close(probe);
+    }
+  }
+  if (res != 0 || listen(fd, SOMAXCONN) != 0) {
+    int savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return -1;
+  }
+  return fd;
+}
+
+// a new connection for client, or NULL if it could not be set up. reads
+// and writes that stall for SERVE_TIMEOUT fail, so a worker is not held by
+// a client that stops halfway through a request.
+static Connection *openConnection(Server *server, int client) {
+  struct timeval timeout = {SERVE_TIMEOUT, 0};
+  if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout)) != 0 ||
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                 sizeof(timeout)) != 0) {
+    return NULL;
+  }
+  Connection *connection = malloc(sizeof(Connection));
+  if (connection == NULL) {
+    return NULL;
+  }
+  connection->fd = client;
+  connection->closing = 0;
+  connection->server = server;
+  connection->start = 0;
+  connection->end = 0;
+  return connection;
+}
+
+static void closeConnection(Connection *connection) {
+  close(connection->fd);
+  free(connection);
+}
+
+static int setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Serve until accept() or poll() fails: poll the wake pipe, the listening
+ * socket and the idle connections, queue each connection with input on the
+ * pool, and take back the ones the workers have finished with. A finished
+ * connection that already has its next request line buffered is queued
+ * again straight away, since poll() would not report it.
+ **/
+static void serveConnections(Server *server, int fd, ThreadPool *pool) {
+  Connection *idle[SERVE_MAX_CONNECTIONS];
+  struct pollfd polled[SERVE_MAX_CONNECTIONS + 2];
+  size_t idleCount = 0;
+  size_t open = 0;      // idle or with a worker
+  int accepting = 1;    // cleared while the process is out of descriptors
+
+  for (;;) {
+    polled[0].fd = server->wake[0];
+    polled[1].fd = accepting ? fd : -1;
+    for (size_t i = 0; i < idleCount; i++) {
+      polled[i + 2].fd = idle[i]->fd;
+    }
+    for (size_t i = 0; i < idleCount + 2; i++) {
+      polled[i].events = POLLIN;
+      polled[i].revents = 0;
+    }
+    if (poll(polled, idleCount + 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Failed to wait for requests: %s\n", strerror(errno));
+      break;
+    }
+
+    // from the end, so the last connection moved into a gap was seen
+    for (size_t i = idleCount; i-- > 0;) {
+      if (polled[i + 2].revents != 0) {
+        Connection *connection = idle[i];
+        idle[i] = idle[--idleCount];
+        if (submitTask(pool, serveRequest, connection) != 0) {
+          closeConnection(connection);
+          open--;
+          accepting = 1;
+        }
+      }
+    }
+
+    if (polled[0].revents != 0) {
+      char drained[64];
+      while (read(server->wake[0], drained, sizeof(drained)) > 0) {
+      }
+      pthread_mutex_lock(&server->lock);
+      Connection *finished = server->finished;
+      server->finished = NULL;
+      pthread_mutex_unlock(&server->lock);
+      while (finished != NULL) {
+        Connection *connection = finished;
+        finished = connection->next;
+        int buffered =
+            memchr(connection->buffer + connection->start, '\n',
+                   connection->end - connection->start) != NULL;
+        if (!connection->closing && !buffered) {
+          idle[idleCount++] = connection;
+        } else if (connection->closing ||
+                   submitTask(pool, serveRequest, connection) != 0) {
+          closeConnection(connection);
+          open--;
+          accepting = 1;
+        }
+      }
+    }
+
+    if (polled[1].revents != 0) {
+      int client = accept(fd, NULL, NULL);
+      Connection *connection = NULL;
+      if (client < 0) {
+        if (errno == EMFILE || errno == ENFILE) {
+          // wait for a connection to close rather than spin
+          accepting = open == 0;
+        } else if (errno != EINTR && errno != ECONNABORTED &&
+                   errno != EAGAIN && errno != EWOULDBLOCK) {
+          fprintf(stderr, "Failed to accept a connection: %s\n",
+                  strerror(errno));
+          break;
+        }
+      } else if (open == SERVE_MAX_CONNECTIONS) {
+        sendError(client, "too many connections", NULL);
+        close(client);
+      } else if ((connection = openConnection(server, client)) == NULL) {
+        close(client);
+      } else {
+        idle[idleCount++] = connection;
+        open++;
+      }
+    }
+  }
+  for (size_t i = 0; i < idleCount; i++) {
+    closeConnection(idle[i]);
+  }
+}
+
+int serveListings(const char *socketPath, int threads, uint64_t capacity) {
+  Server server;
+  memset(&server, 0, sizeof(server));
+  server.table.capacity = capacity;
+  pthread_mutex_init(&server.table.lock, NULL);
+  pthread_mutex_init(&server.lock, NULL);
+  if (pipe(server.wake) != 0 || setNonBlocking(server.wake[0]) != 0 ||
+      setNonBlocking(server.wake[1]) != 0) {
+    fprintf(stderr, "Failed to make a pipe: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int fd = listenOn(socketPath);
+  if (fd < 0 || setNonBlocking(fd) != 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", socketPath,
+            strerror(errno));
+    return -1;
+  }
+  ThreadPool *pool = createThreadPool(threads);
+  if (pool == NULL) {
+    fprintf(stderr, "Failed to start %d threads\n", threads);
+    close(fd);
+    unlink(socketPath);
+    return -1;
+  }
+  fprintf(stderr, "Serving listings on %s with %d threads\n", socketPath,
+          threads);
+
+  serveConnections(&server, fd, pool);
+  destroyThreadPool(pool);
+  while (server.finished != NULL) {
+    Connection *connection = server.finished;
+    server.finished = connection->next;
+    closeConnection(connection);
+  }
+  close(fd);
+  unlink(socketPath);
+  return -1;
+}
+
+// copy the listing after an OK header from fd to outputFd, starting with
+// the part of it already read into buffered
+static int copyListing(int fd, const char *buffered, size_t bufferedLength,
+                       uint64_t length, int outputFd) {
+  char buffer[64 * 1024];
+  const char *data = buffered;
+  size_t got = bufferedLength;
+  for (;;) {
+    if (got > length) {
+      got = (size_t)length;
+    }
+    for (size_t done = 0; done < got;) {
+      ssize_t written = write(outputFd, data + done, got - done);
+      if (written < 0 && errno != EINTR) {
+        return -1;
+      }
+      done += written < 0 ? 0 : (size_t)written;
+    }
+    length -= got;
+    if (length == 0) {
+      return 0;
+    }
+    ssize_t part = read(fd, buffer, sizeof(buffer));
+    if (part < 0 && errno == EINTR) {
+      got = 0;
+      continue;
+    }
+    if (part <= 0) {
+      errno = part == 0 ? EPIPE : errno;
+      return -1;
+    }
+    data = buffer;
+    got = (size_t)part;
+  }
+}
+
+int requestListing(const char *socketPath, const char *inputName,
+                   long startingOffset, const char *format,
+                   const char *range, int outputFd) {
+  char line[SERVE_MAX_LINE];
+  struct sockaddr_un address;
+  MachineImage image;
+  int written;
+
+  memset(&image, 0, sizeof(image));
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || fillAddress(&address, socketPath) != 0 ||
+      connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "Failed to connect to %s: %s\n", socketPath,
+            strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  written = snprintf(line, sizeof(line), "offset=%ld format=%s%s%s ",
+                     startingOffset, format, range == NULL ? "" : " range=",
+                     range == NULL ? "" : range);
+  if (strcmp(inputName, "-") == 0) {
+    // standard input is sent whole, as inline bytes
+    if (openMachineImage("/dev/stdin", &image) != 0) {
+      fprintf(stderr, "Failed to read standard input: %s\n", strerror(errno));
+      close(fd);
+      return -1;
+    }
+    if (image.length > SERVE_MAX_BYTES) {
+      fprintf(stderr, "Failed to send standard input: %s\n",
+              strerror(EFBIG));
+      closeMachineImage(&image);
+      close(fd);
+      return -1;
+    }
+    written += snprintf(line + written, sizeof(line) - (size_t)written,
+                        "bytes=%zu\n", image.length);
+  } else {
+    // the server may be running somewhere else
+    char *path = realpath(inputName, NULL);
+    if (path == NULL) {
+      fprintf(stderr, "Failed to open %s: %s\n", inputName, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    written += snprintf(line + written, sizeof(line) - (size_t)written,
+                        "path=%s\n", path);
+    free(path);
+  }
+  if (written >= (int)sizeof(line)) {
+    fprintf(stderr, "Failed to ask for %s: %s\n", inputName,
+            strerror(ENAMETOOLONG));
+    closeMachineImage(&image);
+    close(fd);
+    return -1;
+  }
+  int res = sendAll(fd, line, (size_t)written);
+  if (res == 0 && image.length > 0) {
+    res = sendAll(fd, (const char *)image.bytes, image.length);
+  }
+  closeMachineImage(&image);
+
+  // the answer's first line says how much listing follows, or what failed
+  size_t got = 0;
+  char *newline = NULL;
+  while (res == 0 && newline == NULL && got < sizeof(line) - 1) {
+    ssize_t part = read(fd, line + got, sizeof(line) - 1 - got);
+    if (part < 0 && errno == EINTR) {
+      continue;
+    }
+    if (part <= 0) {
+      errno = part == 0 ? EPIPE : errno;
+      res = -1;
+      break;
+    }
+    newline = memchr(line + got, '\n', (size_t)part);
+    got += (size_t)part;
+  }
+  if (res != 0 || newline == NULL) {
+    fprintf(stderr, "No answer from %s: %s\n", socketPath,
+            strerror(res != 0 ? errno : EPROTO));
+    close(fd);
+    return -1;
+  }
+  *newline = '\0';
+  if (strncmp(line, "OK ", 3) != 0) {
+    fprintf(stderr, "%s: %s\n", socketPath,
+            strncmp(line, "ERROR ", 6) == 0 ? line + 6 : line);
+    close(fd);
+    return -1;
+  }
+  uint64_t length = strtoull(line + 3, NULL, 10);
+  char *listing = newline + 1;
+  if (copyListing(fd, listing, (size_t)(line + got - listing), length,
+                  outputFd) != 0) {
+    fprintf(stderr, "Failed to copy the listing: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/* This file contains the listing server (the --serve option) and its
+   client (--client), defined in serveMode.c.
+*/
+
+#ifndef _SERVEMODE_H_
+#define _SERVEMODE_H_
+
+#include <stdint.h>
+
+// A request is one line of space-separated fields, followed for inline
+// bytes by the image itself:
+//
+//   offset=0x100 format=ndjson range=0x100-0x200 path=/abs/prog.mem\n
+//   bytes=4096\n<4096 bytes of image>
+//
+// offset, format and range are optional and default to 0, text and the
+// whole listing. path= takes the rest of the line, so it comes last; a
+// relative path is taken from the server's working directory. The answer is
+//
+//   OK <length>\n<length bytes of listing>
+//   ERROR <message>\n
+//
+// after which the connection takes the next request. A request line that
+// cannot be parsed, is longer than SERVE_MAX_LINE or asks for more than
+// SERVE_MAX_BYTES of inline bytes is answered with ERROR and the connection
+// closed, as is one whose line or bytes stall for SERVE_TIMEOUT seconds.
+#define SERVE_MAX_LINE 4096
+#define SERVE_MAX_BYTES ((size_t)256 * 1024 * 1024)
+#define SERVE_TIMEOUT 10
+
+// At most this many connections are open at once; one more is answered
+// with ERROR and closed. Idle connections hold no worker.
+#define SERVE_MAX_CONNECTIONS 512
+
+// Listen on a Unix domain socket at socketPath (replacing a stale one) and
+// answer requests with threads workers, each taking one request at a time
+// from whichever connection it came on. Listings are kept in memory, up to
+// capacity bytes, for as long as the file they came from (by device, inode,
+// size and modification time) or the inline bytes (by hash) are asked for
+// again. Runs until interrupted;
+// returns -1 after printing what went wrong if it cannot serve.
+int serveListings(const char *socketPath, int threads, uint64_t capacity);
+
+// Ask the server at socketPath for the listing of inputName ("-" sends
+// standard input as inline bytes) and write it to outputFd. format and
+// range are passed on as given, range may be NULL. Returns 0, or -1 after
+// printing what went wrong.
+int requestListing(const char *socketPath, const char *inputName,
+                   long startingOffset, const char *format,
+                   const char *range, int outputFd);
+
+#endif /* SERVEMODE */
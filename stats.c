@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/*
+  Run statistics for --stats.
+
+  Nothing here runs unless --stats was given: the sweeps take a RunStats
+  pointer that is NULL otherwise and test it once per batch of records.
+  When it is set they charge the clock after every read, every decoded
+  batch and every formatted batch, and the output sink charges it around
+  each write, so each lap costs two clock reads per thousand records or so.
+*/
+
+// only these icodes decode as instructions, so only they are ever counted
+#define ICODE_COUNT 12
+
+static const char *const icodeNames[ICODE_COUNT] = {
+    "halt", "nop",  "rrmovq", "irmovq", "rmmovq", "mrmovq",
+    "OPq",  "jXX",  "call",   "ret",    "pushq",  "popq"};
+
+static const char *const phaseNames[PHASE_COUNT] = {"read", "decode",
+                                                    "format", "write"};
+
+static double seconds(clockid_t clock) {
+  struct timespec time;
+  clock_gettime(clock, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+void startStats(RunStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->lapWall = seconds(CLOCK_MONOTONIC);
+  stats->lapCpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void chargeStats(RunStats *stats, int phase) {
+  double wall = seconds(CLOCK_MONOTONIC);
+  double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+  stats->wall[phase] += wall - stats->lapWall;
+  stats->cpu[phase] += cpu - stats->lapCpu;
+  stats->lapWall = wall;
+  stats->lapCpu = cpu;
+}
+
+void countRecords(RunStats *stats, const Y86Instruction *records,
+                  size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const Y86Instruction *insn = &records[i];
+    switch (insn->kind) {
+    case Y86_CODE:
+      stats->instructions[insn->icode]++;
+      break;
+    case Y86_QUAD:
+      stats->quads++;
+      break;
+    case Y86_BYTE:
+      stats->bytes++;
+      break;
+    case Y86_POS:
+      stats->posSegments++;
+      stats->zeroBytes += insn->length;
+      break;
+    default:
+      // zero runs at the end (and a halt cut off there) decode as icode 0
+      // function 0; nothing else that is skipped does
+      if (insn->icode == 0 && insn->ifun == 0) {
+        stats->zeroBytes += insn->length;
+      } else {
+        stats->skippedBytes += insn->length;
+      }
+      break;
+    }
+  }
+}
+
+static long peakRss(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void reportText(const RunStats *stats) {
+  double wall = 0;
+  double cpu = 0;
+  uint64_t instructions = 0;
+
+  fprintf(stderr,
+          "Stats: %llu bytes in, %llu bytes out, peak RSS %ld KiB\n"
+          "  %-8s %10s %10s\n",
+          (unsigned long long)stats->bytesIn,
+          (unsigned long long)stats->bytesOut, peakRss(), "phase", "wall s",
+          "CPU s");
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    fprintf(stderr, "  %-8s %10.6f %10.6f\n", phaseNames[phase],
+            stats->wall[phase], stats->cpu[phase]);
+    wall += stats->wall[phase];
+    cpu += stats->cpu[phase];
+  }
+  fprintf(stderr, "  %-8s %10.6f %10.6f\n", "total", wall, cpu);
+
+  for (int icode = 0; icode < ICODE_COUNT; icode++) {
+    instructions += stats->instructions[icode];
+  }
+  fprintf(stderr, "  %llu instructions:", (unsigned long long)instructions);
+  for (int icode = 0; icode < ICODE_COUNT; icode++) {
+    if (stats->instructions[icode] != 0) {
+      fprintf(stderr, " %s %llu", icodeNames[icode],
+              (unsigned long long)stats->instructions[icode]);
+    }
+  }
+  fprintf(stderr,
+          "\n  invalid encodings: %llu as .quad, %llu as .byte\n"
+          "  %llu .pos segments, %llu zero bytes, %llu other bytes "
+          "skipped\n",
+          (unsigned long long)stats->quads, (unsigned long long)stats->bytes,
+          (unsigned long long)stats->posSegments,
+          (unsigned long long)stats->zeroBytes,
+          (unsigned long long)stats->skippedBytes);
+}
+
+static void reportJson(const RunStats *stats) {
+  fprintf(stderr,
+          "{\"bytesIn\":%llu,\"bytesOut\":%llu,\"peakRssKiB\":%ld,"
+          "\"phases\":{",
+          (unsigned long long)stats->bytesIn,
+          (unsigned long long)stats->bytesOut, peakRss());
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+            phase == 0 ? "" : ",", phaseNames[phase], stats->wall[phase],
+            stats->cpu[phase]);
+  }
+  fprintf(stderr, "},\"instructions\":{");
+  for (int icode = 0; icode < ICODE_COUNT; icode++) {
+    fprintf(stderr, "%s\"%s\":%llu", icode == 0 ? "" : ",",
+            icodeNames[icode],
+            (unsigned long long)stats->instructions[icode]);
+  }
+  fprintf(stderr,
+          "},\"quads\":%llu,\"bytes\":%llu,\"posSegments\":%llu,"
+          "\"zeroBytes\":%llu,\"skippedBytes\":%llu}\n",
+          (unsigned long long)stats->quads, (unsigned long long)stats->bytes,
+          (unsigned long long)stats->posSegments,
+          (unsigned long long)stats->zeroBytes,
+          (unsigned long long)stats->skippedBytes);
+}
+
+void reportStats(const RunStats *stats, int json) {
+  if (json) {
+    reportJson(stats);
+  } else {
+    reportText(stats);
+  }
+}
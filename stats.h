@@ -0,0 +1,48 @@
+/* This file contains the counters and timers behind the --stats option and
+   the routines that fill in and report them, defined in stats.c.
+*/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decoder.h"
+
+// Where the time of a run goes
+enum { PHASE_READ, PHASE_DECODE, PHASE_FORMAT, PHASE_WRITE, PHASE_COUNT };
+
+// What one sweep did. The timers work like lap counters: chargeStats() adds
+// the time since the last charge to one phase, so the phases always add up
+// to the whole run.
+typedef struct RunStats {
+  double wall[PHASE_COUNT]; // seconds
+  double cpu[PHASE_COUNT];
+  double lapWall;
+  double lapCpu;
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint64_t instructions[16]; // by icode
+  uint64_t quads;            // invalid encodings shown as .quad
+  uint64_t bytes;            // and as .byte
+  uint64_t posSegments;
+  uint64_t zeroBytes;    // in .pos gaps and trailing zero runs
+  uint64_t skippedBytes; // everything else printed as nothing
+} RunStats;
+
+// Clear stats and start the first lap.
+void startStats(RunStats *stats);
+
+// Charge the wall and CPU time since the last charge to phase.
+void chargeStats(RunStats *stats, int phase);
+
+// Count count records fresh from the decoder.
+void countRecords(RunStats *stats, const Y86Instruction *records,
+                  size_t count);
+
+// Print stats on stderr, as text or (json set) as one JSON object, with the
+// peak resident set size of the process.
+void reportStats(const RunStats *stats, int json);
+
+#endif /* STATS */
@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "streamDisassemble.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compressedInput.h"
+#include "decoder.h"
+#include "printRoutines.h"
+
+/*
+  Streaming sweep.
+
+  Bytes are read into a fixed buffer and decoded with y86DecodePartial(),
+  which stops short of any record the next read could still change. The
+  few undecoded bytes left at the end are moved to the front, base (the
+  address of buffer[0]) moves forward by what was consumed, and the buffer
+  is topped up again. Once read() reports the end of the input the rest is
+  decoded with y86Decode(), exactly as for a whole image.
+
+  The first few bytes are read before anything else to see whether the
+  input is compressed. If it is, every later read comes from a
+  CompressedInput, which inflates on a thread of its own while this one
+  decodes, and the starting offset is skipped by inflating past it since
+  compressed bytes cannot be seeked into.
+*/
+
+#define STREAM_BUFFER_BYTES (256 * 1024)
+#define STREAM_RECORD_BATCH 1024
+
+// read up to length bytes, from compressed when the input is compressed,
+// retrying on EINTR. returns the count, 0 at the end of the input or -1 on
+// error.
+static ssize_t readSome(int fd, CompressedInput *compressed, uint8_t *buffer,
+                        size_t length) {
+  ssize_t got;
+  if (compressed != NULL) {
+    return readCompressedInput(compressed, buffer, length);
+  }
+  do {
+    got = read(fd, buffer, length);
+  } while (got < 0 && errno == EINTR);
+  return got;
+}
+
+// move past the next count bytes of the input: seek when fd allows it,
+// otherwise read them into buffer and drop them.
+static int skipBytes(int fd, CompressedInput *compressed, uint64_t count,
+                     uint8_t *buffer) {
+  if (count == 0 ||
+      (compressed == NULL && lseek(fd, (off_t)count, SEEK_CUR) >= 0)) {
+    return 0;
+  }
+  while (count > 0) {
+    size_t want = count < STREAM_BUFFER_BYTES ? count : STREAM_BUFFER_BYTES;
+    ssize_t got = readSome(fd, compressed, buffer, want);
+    if (got < 0) {
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    count -= (uint64_t)got;
+  }
+  return 0;
+}
+
+// read the first bytes of the input to tell whether it is compressed, and
+// skip to startingOffset. *compressed is set when it is; otherwise the bytes
+// read from startingOffset on are left at the front of buffer, their count
+// in *used.
+static int openInput(int fd, uint64_t startingOffset, uint8_t *buffer,
+                     CompressedInput **compressed, size_t *used) {
+  size_t peeked = 0;
+  while (peeked < COMPRESSED_MAGIC_BYTES) {
+    ssize_t got =
+        readSome(fd, NULL, buffer + peeked, COMPRESSED_MAGIC_BYTES - peeked);
+    if (got < 0) {
+      return -1;
+    }
+    if (got == 0) {
+      break;
+    }
+    peeked += (size_t)got;
+  }
+
+  *compressed = NULL;
+  *used = 0;
+  int format = compressedFormat(buffer, peeked);
+  if (format != COMPRESSED_NONE) {
+    *compressed = openCompressedInput(fd, format, buffer, peeked);
+    if (*compressed == NULL) {
+      return -1;
+    }
+    return skipBytes(fd, *compressed, startingOffset, buffer);
+  }
+  if (startingOffset < peeked) {
+    *used = peeked - (size_t)startingOffset;
+    memmove(buffer, buffer + startingOffset, *used);
+    return 0;
+  }
+  return skipBytes(fd, NULL, startingOffset - peeked, buffer);
+}
+
+int disassembleStream(int fd, long startingOffset, RecordPrinter print,
+                      OutputSink *outputFile, RunStats *stats) {
+  Y86Instruction records[STREAM_RECORD_BATCH];
+  Y86Cursor cursor;
+  Y86Instruction run;  // the start of a zero run still being read
+  int runPending = 0;
+  uint64_t base = (uint64_t)startingOffset;
+  size_t used = 0;
+  size_t count;
+  int ended = 0;
+  int drained = 0;
+  int isFirstPosFlag = 1;
+  int res = 0;
+  CompressedInput *compressed = NULL;
+
+  uint8_t *buffer = malloc(STREAM_BUFFER_BYTES);
+  if (buffer == NULL) {
+    return -1;
+  }
+  if (openInput(fd, base, buffer, &compressed, &used) != 0) {
+    int savedErrno = errno;
+    if (compressed != NULL) {
+      closeCompressedInput(compressed);
+    }
+    free(buffer);
+    errno = savedErrno;
+    return -1;
+  }
+  if (stats != NULL) {
+    stats->bytesIn += used;
+  }
+
+  y86StartCursor(&cursor, 0);
+  while (!ended) {
+    // when the last read emptied the pipe the next one is likely to block,
+    // so hand over what is formatted so far first
+    if (drained) {
+      flushOutputSink(outputFile);
+    }
+    ssize_t got =
+        readSome(fd, compressed, buffer + used, STREAM_BUFFER_BYTES - used);
+    if (got < 0) {
+      res = -1;
+      break;
+    }
+    ended = got == 0;
+    drained = (size_t)got < STREAM_BUFFER_BYTES - used;
+    used += (size_t)got;
+    if (stats != NULL) {
+      stats->bytesIn += (uint64_t)got;
+      chargeStats(stats, PHASE_READ);
+    }
+
+    do {
+      count = ended ? y86Decode(buffer, used, base, &cursor, records,
+                                STREAM_RECORD_BATCH)
+                    : y86DecodePartial(buffer, used, base, &cursor, records,
+                                       STREAM_RECORD_BATCH);
+      if (stats != NULL) {
+        countRecords(stats, records, count);
+        chargeStats(stats, PHASE_DECODE);
+      }
+      for (size_t i = 0; i < count; i++) {
+        Y86Instruction *insn = &records[i];
+        // a zero run split across reads comes back in pieces; they are put
+        // back together so every format sees the records a whole-image
+        // sweep produces
+        if (runPending && (uint64_t)run.length + insn->length <= UINT32_MAX) {
+          insn->address = run.address;
+          insn->length += run.length;
+        } else if (runPending) {
+          print(outputFile, &run, isFirstPosFlag);
+        }
+        runPending = 0;
+        if (!ended && insn->kind == Y86_SKIP && insn->icode == 0) {
+          run = *insn;
+          runPending = 1;
+          continue;
+        }
+        print(outputFile, insn, isFirstPosFlag);
+        isFirstPosFlag = isFirstPosFlag && insn->kind == Y86_SKIP;
+      }
+      if (stats != NULL) {
+        chargeStats(stats, PHASE_FORMAT);
+      }
+    } while (count > 0);
+
+    // keep the bytes the decoder could not finish yet
+    memmove(buffer, buffer + cursor.offset, used - cursor.offset);
+    base += cursor.offset;
+    used -= cursor.offset;
+    cursor.offset = 0;
+  }
+
+  int savedErrno = errno;
+  if (compressed != NULL) {
+    closeCompressedInput(compressed);
+  }
+  free(buffer);
+  errno = savedErrno;
+  return res;
+}
@@ -0,0 +1,22 @@
+/* This file contains the prototype for the streaming sweep defined in
+   streamDisassemble.c, used for pipes and standard input (the --stream
+   option).
+*/
+
+#ifndef _STREAMDISASSEMBLE_H_
+#define _STREAMDISASSEMBLE_H_
+
+#include "outputSink.h"
+#include "printRoutines.h"
+#include "stats.h"
+
+// Print the same listing as disassemble() for the bytes read from fd, which
+// need not be seekable. The first startingOffset bytes are skipped. Input
+// goes through a fixed-size buffer and the listing is written as it is
+// produced, so memory use does not depend on the size of the input. stats,
+// unless NULL, counts the records and times reading, decoding and
+// formatting. Returns 0, or -1 with errno set if reading failed.
+int disassembleStream(int fd, long startingOffset, RecordPrinter print,
+                      OutputSink *outputFile, RunStats *stats);
+
+#endif /* STREAMDISASSEMBLE */
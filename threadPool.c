@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "threadPool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  TaskFunction run;
+  void *arg;
+} Task;
+
+// A double-ended queue of tasks held in a circular buffer. The owner pushes
+// and pops at the bottom (newest first); thieves take from the top (oldest
+// first), so they tend to pick up the larger, older pieces of work.
+typedef struct {
+  pthread_mutex_t lock;
+  Task *tasks;
+  size_t capacity;
+  size_t top;   // index of the oldest task
+  size_t count; // tasks queued
+} Deque;
+
+typedef struct {
+  ThreadPool *pool;
+  int index;
+  pthread_t thread;
+} Worker;
+
+struct ThreadPool {
+  Worker *workers;
+  Deque *deques;
+  int threads;
+  int started;
+  int nextDeque; // where the next task from outside the pool goes
+
+  pthread_mutex_t lock;
+  pthread_cond_t workAvailable;
+  pthread_cond_t allDone;
+  long queued;     // tasks sitting in deques
+  long unfinished; // tasks submitted but not yet finished
+  int shutdown;
+};
+
+// the worker the calling thread is, so tasks can queue follow-up work on
+// their own deque
+static pthread_key_t currentWorker;
+static pthread_once_t currentWorkerOnce = PTHREAD_ONCE_INIT;
+
+static void createCurrentWorkerKey(void) {
+  pthread_key_create(&currentWorker, NULL);
+}
+
+int processorCount(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count < 1 ? 1 : (int)count;
+}
+
+static int pushBottom(Deque *deque, Task task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    size_t capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+    Task *grown = malloc(capacity * sizeof(Task));
+    if (grown == NULL) {
+      pthread_mutex_unlock(&deque->lock);
+      return -1;
+    }
+    for (size_t i = 0; i < deque->count; i++) {
+      grown[i] = deque->tasks[(deque->top + i) % deque->capacity];
+    }
+    free(deque->tasks);
+    deque->tasks = grown;
+    deque->capacity = capacity;
+    deque->top = 0;
+  }
+  deque->tasks[(deque->top + deque->count) % deque->capacity] = task;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return 0;
+}
+
+static int popBottom(Deque *deque, Task *task) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    deque->count--;
+    *task = deque->tasks[(deque->top + deque->count) % deque->capacity];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static int stealTop(Deque *deque, Task *task) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    *task = deque->tasks[deque->top];
+    deque->top = (deque->top + 1) % deque->capacity;
+    deque->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// take a task from our own deque, or steal one from the others, starting
+// with our neighbour so thieves spread out over the victims.
+static int findTask(ThreadPool *pool, int self, Task *task) {
+  if (popBottom(&pool->deques[self], task)) {
+    return 1;
+  }
+  for (int i = 1; i < pool->threads; i++) {
+    if (stealTop(&pool->deques[(self + i) % pool->threads], task)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *workerMain(void *arg) {
+  Worker *worker = arg;
+  ThreadPool *pool = worker->pool;
+  Task task;
+
+  pthread_setspecific(currentWorker, worker);
+  while (1) {
+    if (findTask(pool, worker->index, &task)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+
+      task.run(task.arg);
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->unfinished == 0) {
+        pthread_cond_broadcast(&pool->allDone);
+      }
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued <= 0 && !pool->shutdown) {
+      pthread_cond_wait(&pool->workAvailable, &pool->lock);
+    }
+    int stop = pool->shutdown && pool->queued <= 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+ThreadPool *createThreadPool(int threads) {
+  pthread_once(&currentWorkerOnce, createCurrentWorkerKey);
+
+  ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->threads = threads < 1 ? 1 : threads;
+  pool->workers = calloc((size_t)pool->threads, sizeof(Worker));
+  pool->deques = calloc((size_t)pool->threads, sizeof(Deque));
+  if (pool->workers == NULL || pool->deques == NULL) {
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->workAvailable, NULL);
+  pthread_cond_init(&pool->allDone, NULL);
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+
+  for (int i = 0; i < pool->threads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(&pool->workers[i].thread, NULL, workerMain,
+                       &pool->workers[i]) != 0) {
+      break;
+    }
+    pool->started++;
+  }
+  if (pool->started == 0) {
+    destroyThreadPool(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+int submitTask(ThreadPool *pool, TaskFunction run, void *arg) {
+  Task task = {run, arg};
+  Worker *self = pthread_getspecific(currentWorker);
+  int index;
+
+  pthread_mutex_lock(&pool->lock);
+  if (self != NULL && self->pool == pool) {
+    index = self->index;
+  } else {
+    // only the threads that actually started take work
+    index = pool->nextDeque;
+    pool->nextDeque = (pool->nextDeque + 1) % pool->started;
+  }
+  pool->unfinished++;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (pushBottom(&pool->deques[index], task) != 0) {
+    pthread_mutex_lock(&pool->lock);
+    pool->unfinished--;
+    pthread_mutex_unlock(&pool->lock);
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pthread_cond_signal(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+void waitThreadPool(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->unfinished > 0) {
+    pthread_cond_wait(&pool->allDone, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void destroyThreadPool(ThreadPool *pool) {
+  if (pool->started > 0) {
+    waitThreadPool(pool);
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->started; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < pool->threads; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->workAvailable);
+  pthread_cond_destroy(&pool->allDone);
+  free(pool->workers);
+  free(pool->deques);
+  free(pool);
+}
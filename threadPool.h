@@ -0,0 +1,30 @@
+/* This file contains the interface to the work-stealing thread pool defined
+   in threadPool.c. Each worker owns a deque of tasks; it takes work from its
+   own deque first and steals from the other workers' when that runs dry.
+*/
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+typedef void (*TaskFunction)(void *arg);
+
+typedef struct ThreadPool ThreadPool;
+
+// Number of processors online, at least 1.
+int processorCount(void);
+
+// Start a pool of threads workers. Returns NULL if it could not be started.
+ThreadPool *createThreadPool(int threads);
+
+// Queue run(arg). Tasks submitted from a worker go on that worker's own
+// deque; others are spread over the workers in turn. Returns 0, or -1 if
+// the task could not be queued.
+int submitTask(ThreadPool *pool, TaskFunction run, void *arg);
+
+// Block until every task submitted so far has finished.
+void waitThreadPool(ThreadPool *pool);
+
+// Finish all queued tasks, stop the workers and free the pool.
+void destroyThreadPool(ThreadPool *pool);
+
+#endif /* THREADPOOL */
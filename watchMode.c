@@ -0,0 +1,400 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "watchMode.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "machineImage.h"
+#include "outputSink.h"
+#include "printRoutines.h"
+#include "recordList.h"
+
+/*
+  Watch mode.
+
+  The decoded records of the image, the listing text and where each
+  record's text starts are all kept in memory. When the file is rewritten
+  the new bytes are compared with the old ones to find the dirty range
+  [lo, hi). Records that end before lo cannot have changed (a record
+  depends on its own bytes and at most the byte after it), so the sweep
+  restarts after the last of them and runs until it is past hi and lands
+  on the start of an old record in the same state, from which the old
+  records are valid again. Only the records in between are decoded and
+  formatted; the three parts are spliced together and the listing file is
+  rewritten from the first line that changed.
+*/
+
+#define EVENT_BUFFER_BYTES 4096
+
+typedef struct {
+  uint8_t *bytes; // the image the records were decoded from
+  size_t length;
+  RecordList records;
+  size_t *textStart; // records.count + 1 offsets into text
+  char *text;
+  size_t textLength;
+} WatchState;
+
+static void freeWatchState(WatchState *state) {
+  free(state->bytes);
+  freeRecordList(&state->records);
+  free(state->textStart);
+  free(state->text);
+  memset(state, 0, sizeof(*state));
+}
+
+// read the whole file into a buffer of our own, so the next rewrite cannot
+// change the bytes under us.
+static int loadImage(const char *path, uint8_t **bytes, size_t *length) {
+  MachineImage image;
+  if (openMachineImage(path, &image) != 0) {
+    return -1;
+  }
+  *bytes = malloc(image.length + 1);
+  if (*bytes != NULL) {
+    memcpy(*bytes, image.bytes, image.length);
+    *length = image.length;
+  }
+  closeMachineImage(&image);
+  return *bytes == NULL ? -1 : 0;
+}
+
+// format count records into text, writing where each one's text starts to
+// textStart. isFirst is set when the first of them begins the listing.
+static void formatRecords(const Y86Instruction *records, size_t count,
+                          int isFirst, OutputSink *text, size_t *textStart) {
+  for (size_t i = 0; i < count; i++) {
+    textStart[i] = text->used;
+    printRecord(text, &records[i], isFirst && i == 0);
+  }
+}
+
+// the first record that ends at or after offset, i.e. the first one whose
+// decoding could depend on the byte there.
+static size_t firstRecordReaching(const RecordList *list, size_t offset) {
+  size_t low = 0;
+  size_t high = list->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const Y86Instruction *insn = &list->records[middle];
+    if (insn->address + insn->length < offset) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static int buildState(WatchState *state, long startingOffset) {
+  Y86Cursor cursor;
+  OutputSink text;
+
+  initRecordList(&state->records);
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  if (decodeIntoList(state->bytes, state->length, &cursor, state->length,
+                     &state->records) != 0) {
+    return -1;
+  }
+  state->textStart = malloc((state->records.count + 1) * sizeof(size_t));
+  size_t capacity = MAX_RECORD_TEXT + state->records.count * 32;
+  if (state->textStart == NULL || openOutputSink(&text, -1, capacity) != 0) {
+    return -1;
+  }
+  formatRecords(state->records.records, state->records.count, 1, &text,
+                state->textStart);
+  if (text.error != 0) {
+    closeOutputSink(&text);
+    return -1;
+  }
+  state->textStart[state->records.count] = text.used;
+  state->text = text.buffer;
+  state->textLength = text.used;
+  return 0;
+}
+
+typedef struct {
+  size_t dirtyLow;
+  size_t dirtyHigh;
+  size_t decodedLow; // the range actually decoded again
+  size_t decodedHigh;
+  size_t records;
+  size_t firstChangedText;
+} UpdateReport;
+
+/**
+ * Bring state up to date with the image (bytes, length), which it takes
+ * over. Returns 1 if anything changed, 0 if not, -1 if memory ran out (state
+ * is then left as it was).
+ **/
+static int updateState(WatchState *state, uint8_t *bytes, size_t length,
+                       long startingOffset, UpdateReport *report) {
+  size_t common = length < state->length ? length : state->length;
+  size_t lo = 0;
+  while (lo < common && bytes[lo] == state->bytes[lo]) {
+    lo++;
+  }
+  if (lo == common && length == state->length) {
+    free(bytes);
+    return 0;
+  }
+  // a change of length moves the end of the image, and with it whatever
+  // the sweep does there, so nothing after lo can be trusted
+  size_t hi = length;
+  if (length == state->length) {
+    while (hi > lo && bytes[hi - 1] == state->bytes[hi - 1]) {
+      hi--;
+    }
+  } else if (state->length > hi) {
+    hi = state->length;
+  }
+
+  const Y86Instruction *old = state->records.records;
+  size_t oldCount = state->records.count;
+  size_t k = firstRecordReaching(&state->records, lo);
+  Y86Cursor cursor;
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  if (k > 0) {
+    y86CursorAfter(&old[k - 1], 0, &cursor);
+  }
+  report->decodedLow = cursor.offset;
+
+  // decode until the sweep meets an old record past hi in the same state
+  RecordList fresh;
+  initRecordList(&fresh);
+  size_t j = k;
+  int synced = 0;
+  while (cursor.offset < length) {
+    while (j < oldCount && old[j].address < cursor.offset) {
+      j++;
+    }
+    if (j < oldCount && old[j].address >= hi) {
+      Y86Cursor before;
+      y86StartCursor(&before, (size_t)startingOffset);
+      if (j > 0) {
+        y86CursorAfter(&old[j - 1], 0, &before);
+      }
+      if (y86CursorsAgree(bytes, length, &cursor, &before)) {
+        synced = 1;
+        break;
+      }
+    }
+    Y86Instruction *out = reserveRecords(&fresh, 1);
+    if (out == NULL) {
+      freeRecordList(&fresh);
+      free(bytes);
+      return -1;
+    }
+    fresh.count += y86Decode(bytes, length, 0, &cursor, out, 1);
+  }
+  if (!synced) {
+    j = oldCount;
+  }
+  report->decodedHigh = cursor.offset;
+
+  // splice old[0, k), fresh and old[j, oldCount) together
+  size_t count = k + fresh.count + (oldCount - j);
+  RecordList records;
+  OutputSink freshText;
+  initRecordList(&records);
+  size_t *textStart = malloc((count + 1) * sizeof(size_t));
+  if (textStart == NULL || reserveRecords(&records, count + 1) == NULL ||
+      openOutputSink(&freshText, -1, MAX_RECORD_TEXT + fresh.count * 32) != 0) {
+    free(textStart);
+    freeRecordList(&records);
+    freeRecordList(&fresh);
+    free(bytes);
+    return -1;
+  }
+  memcpy(records.records, old, k * sizeof(Y86Instruction));
+  memcpy(records.records + k, fresh.records,
+         fresh.count * sizeof(Y86Instruction));
+  memcpy(records.records + k + fresh.count, old + j,
+         (oldCount - j) * sizeof(Y86Instruction));
+  records.count = count;
+
+  formatRecords(fresh.records, fresh.count, k == 0, &freshText,
+                textStart + k);
+  size_t head = state->textStart[k];
+  size_t tail = state->textLength - state->textStart[j];
+  size_t textLength = head + freshText.used + tail;
+  char *text = freshText.error != 0 ? NULL : malloc(textLength + 1);
+  if (text == NULL) {
+    free(textStart);
+    freeRecordList(&records);
+    freeRecordList(&fresh);
+    closeOutputSink(&freshText);
+    free(bytes);
+    return -1;
+  }
+  memcpy(text, state->text, head);
+  memcpy(text + head, freshText.buffer, freshText.used);
+  memcpy(text + head + freshText.used, state->text + state->textStart[j],
+         tail);
+
+  memcpy(textStart, state->textStart, k * sizeof(size_t));
+  for (size_t i = 0; i < fresh.count; i++) {
+    textStart[k + i] += head;
+  }
+  for (size_t i = j; i <= oldCount; i++) {
+    textStart[k + fresh.count + i - j] =
+        state->textStart[i] - state->textStart[j] + head + freshText.used;
+  }
+
+  report->dirtyLow = lo;
+  report->dirtyHigh = hi;
+  report->records = fresh.count;
+  report->firstChangedText = head;
+
+  closeOutputSink(&freshText);
+  freeRecordList(&fresh);
+  freeWatchState(state);
+  state->bytes = bytes;
+  state->length = length;
+  state->records = records;
+  state->textStart = textStart;
+  state->text = text;
+  state->textLength = textLength;
+  return 1;
+}
+
+// rewrite the listing from offset from on and cut it to its new length.
+static int writeListing(int fd, const WatchState *state, size_t from) {
+  size_t done = from;
+  while (done < state->textLength) {
+    ssize_t res = pwrite(fd, state->text + done, state->textLength - done,
+                         (off_t)done);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    done += (size_t)res;
+  }
+  return ftruncate(fd, (off_t)state->textLength);
+}
+
+static double milliseconds(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start->tv_sec) * 1e3 +
+         (double)(end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// whether the inotify events in buffer include one for name
+static int mentions(const char *buffer, ssize_t length, const char *name) {
+  const char *event = buffer;
+  while (event < buffer + length) {
+    const struct inotify_event *header = (const struct inotify_event *)event;
+    if (header->len > 0 && strcmp(header->name, name) == 0) {
+      return 1;
+    }
+    event += sizeof(struct inotify_event) + header->len;
+  }
+  return 0;
+}
+
+int watchAndDisassemble(const char *inputName, const char *outputName,
+                        long startingOffset) {
+  WatchState state;
+  memset(&state, 0, sizeof(state));
+
+  // builds rewrite the file or move a new one into place, so the directory
+  // is watched rather than the file itself
+  const char *slash = strrchr(inputName, '/');
+  const char *name = slash == NULL ? inputName : slash + 1;
+  char *dir = slash == NULL ? strdup(".")
+                            : strndup(inputName, (size_t)(slash - inputName));
+  int notify = inotify_init();
+  if (dir == NULL || notify < 0 ||
+      inotify_add_watch(notify, *dir == '\0' ? "/" : dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "Failed to watch %s: %s\n", inputName, strerror(errno));
+    free(dir);
+    if (notify >= 0) {
+      close(notify);
+    }
+    return -1;
+  }
+  free(dir);
+
+  int outputFd = open(outputName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (outputFd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", outputName, strerror(errno));
+    close(notify);
+    return -1;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (loadImage(inputName, &state.bytes, &state.length) != 0 ||
+      buildState(&state, startingOffset) != 0 ||
+      writeListing(outputFd, &state, 0) != 0) {
+    fprintf(stderr, "Failed to disassemble %s: %s\n", inputName,
+            strerror(errno));
+    freeWatchState(&state);
+    close(outputFd);
+    close(notify);
+    return -1;
+  }
+  fprintf(stderr, "Wrote %s (%zu records) in %.1f ms; watching %s\n",
+          outputName, state.records.count, milliseconds(&start), inputName);
+
+  char events[EVENT_BUFFER_BYTES]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    ssize_t got = read(notify, events, sizeof(events));
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (!mentions(events, got, name)) {
+      continue;
+    }
+
+    uint8_t *bytes;
+    size_t length;
+    UpdateReport report;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (loadImage(inputName, &bytes, &length) != 0) {
+      fprintf(stderr, "Failed to read %s: %s\n", inputName, strerror(errno));
+      continue;
+    }
+    int res = updateState(&state, bytes, length, startingOffset, &report);
+    if (res < 0) {
+      fprintf(stderr, "Failed to update %s: out of memory\n", outputName);
+      continue;
+    }
+    if (res == 0) {
+      continue;
+    }
+    if (writeListing(outputFd, &state, report.firstChangedText) != 0) {
+      fprintf(stderr, "Failed to write %s: %s\n", outputName,
+              strerror(errno));
+      continue;
+    }
+    fprintf(stderr,
+            "Updated %s in %.1f ms: bytes 0x%zx-0x%zx changed, "
+            "re-decoded 0x%zx-0x%zx (%zu records)\n",
+            outputName, milliseconds(&start), report.dirtyLow,
+            report.dirtyHigh, report.decodedLow, report.decodedHigh,
+            report.records);
+  }
+
+  fprintf(stderr, "Stopped watching %s: %s\n", inputName, strerror(errno));
+  freeWatchState(&state);
+  close(outputFd);
+  close(notify);
+  return -1;
+}
@@ -0,0 +1,16 @@
+/* This file contains the prototype for the watch mode defined in
+   watchMode.c (the --watch option).
+*/
+
+#ifndef _WATCHMODE_H_
+#define _WATCHMODE_H_
+
+// Write the listing of inputName to outputName, then keep it up to date:
+// every time inputName is rewritten only the part of the listing the new
+// bytes can affect is decoded and formatted again, and outputName is
+// rewritten from the first line that changed. Runs until interrupted;
+// returns -1 if watching or writing fails.
+int watchAndDisassemble(const char *inputName, const char *outputName,
+                        long startingOffset);
+
+#endif /* WATCHMODE */
@@ -0,0 +1,129 @@
+#include "xrefIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder.h"
+
+/*
+  The map is an open-addressing table keyed by target address with linear
+  probing, kept at most half full. Sites live in one array and each entry
+  chains its own through XrefSite.next, so adding a branch is a probe and an
+  append however many other branches share its target.
+*/
+
+#define INITIAL_CAPACITY 1024
+#define RECORD_BATCH 1024
+
+static size_t slotFor(uint64_t target, size_t capacity) {
+  // Fibonacci hashing: the top bits of the product are well mixed even for
+  // targets that differ only in their low bits
+  return (size_t)((target * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+void initXrefIndex(XrefIndex *index) {
+  memset(index, 0, sizeof(*index));
+}
+
+void freeXrefIndex(XrefIndex *index) {
+  free(index->entries);
+  free(index->sites);
+  initXrefIndex(index);
+}
+
+static XrefEntry *probe(XrefEntry *entries, size_t capacity, uint64_t target) {
+  size_t slot = slotFor(target, capacity);
+  while (entries[slot].count != 0 && entries[slot].target != target) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &entries[slot];
+}
+
+static int growEntries(XrefIndex *index) {
+  size_t capacity = index->capacity == 0 ? INITIAL_CAPACITY
+                                         : index->capacity * 2;
+  XrefEntry *entries = calloc(capacity, sizeof(XrefEntry));
+  if (entries == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < index->capacity; i++) {
+    if (index->entries[i].count != 0) {
+      *probe(entries, capacity, index->entries[i].target) = index->entries[i];
+    }
+  }
+  free(index->entries);
+  index->entries = entries;
+  index->capacity = capacity;
+  return 0;
+}
+
+int addXref(XrefIndex *index, uint64_t target, uint64_t site, uint8_t icode,
+            uint8_t ifun) {
+  if ((index->used + 1) * 2 > index->capacity && growEntries(index) != 0) {
+    return -1;
+  }
+  if (index->siteCount == index->siteCapacity) {
+    size_t capacity =
+        index->siteCapacity == 0 ? INITIAL_CAPACITY : index->siteCapacity * 2;
+    // site numbers must stay below XREF_NONE
+    if (capacity > XREF_NONE) {
+      return -1;
+    }
+    XrefSite *sites = realloc(index->sites, capacity * sizeof(XrefSite));
+    if (sites == NULL) {
+      return -1;
+    }
+    index->sites = sites;
+    index->siteCapacity = capacity;
+  }
+
+  uint32_t added = (uint32_t)index->siteCount++;
+  index->sites[added] = (XrefSite){site, XREF_NONE, icode, ifun};
+
+  XrefEntry *entry = probe(index->entries, index->capacity, target);
+  if (entry->count == 0) {
+    *entry = (XrefEntry){target, added, added, 0, 0};
+    index->used++;
+  } else {
+    index->sites[entry->lastSite].next = added;
+    entry->lastSite = added;
+  }
+  entry->count++;
+  entry->callCount += icode == 8;
+  return 0;
+}
+
+const XrefEntry *findXrefs(const XrefIndex *index, uint64_t target) {
+  if (index->capacity == 0) {
+    return NULL;
+  }
+  const XrefEntry *entry = probe(index->entries, index->capacity, target);
+  return entry->count != 0 ? entry : NULL;
+}
+
+int indexBranches(const uint8_t *machineCode, size_t length,
+                  long startingOffset, XrefIndex *index, uint8_t *lineStarts) {
+  Y86Instruction records[RECORD_BATCH];
+  Y86Cursor cursor;
+  size_t count;
+
+  y86StartCursor(&cursor, (size_t)startingOffset);
+  while ((count = y86Decode(machineCode, length, 0, &cursor, records,
+                            RECORD_BATCH)) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const Y86Instruction *insn = &records[i];
+      if (insn->kind == Y86_POS || insn->kind == Y86_SKIP) {
+        continue;
+      }
+      if (lineStarts != NULL) {
+        lineStarts[insn->address / 8] |= (uint8_t)(1 << insn->address % 8);
+      }
+      if (insn->kind == Y86_CODE && (insn->icode == 7 || insn->icode == 8) &&
+          addXref(index, insn->immediate, insn->address, insn->icode,
+                  insn->ifun) != 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
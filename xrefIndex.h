@@ -0,0 +1,64 @@
+/* This file contains the cross-reference index defined in xrefIndex.c: a
+   hash map from every jXX/call destination to the instructions that branch
+   there, built while the image is decoded.
+*/
+
+#ifndef _XREFINDEX_H_
+#define _XREFINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XREF_NONE UINT32_MAX
+
+// One branch: the address of the jXX or call and which of the two it is.
+// Sites with the same target are chained through next in the order they
+// were added.
+typedef struct {
+  uint64_t address;
+  uint32_t next;
+  uint8_t icode;
+  uint8_t ifun;
+} XrefSite;
+
+// Everything that branches to target. count == 0 marks a free slot.
+typedef struct {
+  uint64_t target;
+  uint32_t firstSite;
+  uint32_t lastSite;
+  uint32_t count;
+  uint32_t callCount;
+} XrefEntry;
+
+typedef struct {
+  XrefEntry *entries; // open addressing, capacity is a power of two
+  size_t capacity;
+  size_t used;
+  XrefSite *sites;
+  size_t siteCount;
+  size_t siteCapacity;
+} XrefIndex;
+
+void initXrefIndex(XrefIndex *index);
+void freeXrefIndex(XrefIndex *index);
+
+// Record that the instruction at site (icode 7 or 8) branches to target.
+// Returns 0, or -1 if the index could not grow.
+int addXref(XrefIndex *index, uint64_t target, uint64_t site, uint8_t icode,
+            uint8_t ifun);
+
+// The branches to target, or NULL if there are none, found in constant
+// time. Walk them with
+//   for (uint32_t i = entry->firstSite; i != XREF_NONE;
+//        i = index->sites[i].next)
+const XrefEntry *findXrefs(const XrefIndex *index, uint64_t target);
+
+// Sweep the image from startingOffset as the linear listing does, adding
+// every jXX and call to index. When lineStarts is not NULL it is a bitmap
+// with a bit per byte of the image, and the bit for the first byte of every
+// listing line (instruction, .quad or .byte) is set. Returns 0, or -1 if
+// the index could not grow.
+int indexBranches(const uint8_t *machineCode, size_t length,
+                  long startingOffset, XrefIndex *index, uint8_t *lineStarts);
+
+#endif /* XREFINDEX */
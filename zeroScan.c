@@ -0,0 +1,116 @@
+#include "zeroScan.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SCANNERS 1
+#include <immintrin.h>
+#endif
+
+/*
+  Zero runs are what .pos gaps are made of, and images such as
+  test_files/pipetest.mem are mostly zeros, so the decoder spends much of its
+  time here. Each scanner compares a whole block against zero and only looks
+  at individual bytes once a block with a non-zero byte in it turns up.
+
+  The vector scanners are compiled for their instruction set with a target
+  attribute and picked at run time, so the binary still runs on CPUs without
+  them.
+*/
+
+typedef size_t (*ScanFunction)(const uint8_t *bytes, size_t from,
+                               size_t limit);
+
+static size_t scanBytes(const uint8_t *bytes, size_t from, size_t limit) {
+  while (from < limit && bytes[from] == 0) {
+    from++;
+  }
+  return from;
+}
+
+// portable fallback: eight bytes per step.
+static size_t scanWords(const uint8_t *bytes, size_t from, size_t limit) {
+  while (limit - from >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes + from, sizeof(word));
+    if (word != 0) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return from + (size_t)__builtin_clzll(word) / 8;
+#else
+      return from + (size_t)__builtin_ctzll(word) / 8;
+#endif
+    }
+    from += 8;
+  }
+  return scanBytes(bytes, from, limit);
+}
+
+#ifdef HAVE_X86_SCANNERS
+__attribute__((target("sse2"))) static size_t
+scanSse2(const uint8_t *bytes, size_t from, size_t limit) {
+  const __m128i zero = _mm_setzero_si128();
+  while (limit - from >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(bytes + from));
+    unsigned zeros = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+    if (zeros != 0xFFFF) {
+      return from + (size_t)__builtin_ctz(~zeros);
+    }
+    from += 16;
+  }
+  return scanWords(bytes, from, limit);
+}
+
+// 64 bytes per step while the run lasts, then 32 to find the byte.
+__attribute__((target("avx2"))) static size_t
+scanAvx2(const uint8_t *bytes, size_t from, size_t limit) {
+  const __m256i zero = _mm256_setzero_si256();
+  while (limit - from >= 64) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)(bytes + from));
+    __m256i high = _mm256_loadu_si256((const __m256i *)(bytes + from + 32));
+    if (!_mm256_testz_si256(_mm256_or_si256(low, high),
+                            _mm256_or_si256(low, high))) {
+      break;
+    }
+    from += 64;
+  }
+  while (limit - from >= 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + from));
+    unsigned zeros =
+        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero));
+    if (zeros != 0xFFFFFFFFu) {
+      return from + (size_t)__builtin_ctz(~zeros);
+    }
+    from += 32;
+  }
+  return scanSse2(bytes, from, limit);
+}
+#endif
+
+static ScanFunction chooseScanner(void) {
+#ifdef HAVE_X86_SCANNERS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return scanAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return scanSse2;
+  }
+#endif
+  return scanWords;
+}
+
+// chosen on first use. threads racing to choose all store the same value.
+static ScanFunction scanner;
+
+size_t findNonZero(const uint8_t *bytes, size_t from, size_t limit) {
+  // most runs the decoder asks about are empty or a few bytes long
+  if (from < limit && bytes[from] != 0) {
+    return from;
+  }
+  ScanFunction scan = __atomic_load_n(&scanner, __ATOMIC_RELAXED);
+  if (scan == NULL) {
+    scan = chooseScanner();
+    __atomic_store_n(&scanner, scan, __ATOMIC_RELAXED);
+  }
+  return scan(bytes, from, limit);
+}
@@ -0,0 +1,16 @@
+/* This file contains the zero-run scanner used by the decoder, defined in
+   zeroScan.c. It looks at 16, 32 or 64 bytes per step using whichever of
+   AVX2, SSE2 or plain 64-bit words the CPU running it supports.
+*/
+
+#ifndef _ZEROSCAN_H_
+#define _ZEROSCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Return the offset of the first non-zero byte in bytes[from .. limit), or
+// limit if they are all zero.
+size_t findNonZero(const uint8_t *bytes, size_t from, size_t limit);
+
+#endif /* ZEROSCAN */